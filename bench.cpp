@@ -0,0 +1,595 @@
+// Throughput benchmark for server/rcopy on loopback
+//
+// Sweeps file size x window x buffer size x error rate, repeats every
+// point and records goodput, retransmit ratio, CPU time per GB and peak
+// RSS of both ends. Results go to CSV (one row per run) and JSON (one
+// object per point) so two commits can be diffed.
+//
+//   ./bench [--sizes 64K,1M,16M] [--windows 10,100] [--buffers 1000,auto]
+//           [--errors 0,0.01] [--repeat 3] [--port N] [--timeout S]
+//           [--csv FILE] [--json FILE] [--keep] [--trace]
+//           [--background N] [--background-size SIZE] [--background-priority P]
+//           [--priority P]
+//
+// Run from the directory holding ./server and ./rcopy. RCOPY_* variables
+// in the environment are passed on to both. The per-packet libcpe464
+// trace is switched off unless --trace is given, printing it costs more
+// than the transfer.
+//
+// --background keeps N bulk copies (window 400, RCOPY_PRIORITY=bulk by
+// default) running against the same server the whole time, restarted as
+// they finish, so the measured runs show completion time under load.
+// Set RCOPY_EGRESS_RATE to have the server's scheduler share a capped link.
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <csignal>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+struct Options {
+    std::vector<uint64_t> sizes{64 * 1024, 1024 * 1024, 16 * 1024 * 1024};
+    std::vector<int> windows{10, 100};
+    std::vector<std::string> buffers{"1000", "auto"};
+    std::vector<double> errors{0.0, 0.01};
+    int repeat = 3;
+    int port = 0;
+    int timeout = 120;
+    std::string csv;
+    std::string json;
+    bool keep = false;
+    bool trace = false;
+    int background = 0;
+    uint64_t background_size = 64 * 1024 * 1024;
+    std::string background_priority = "bulk";
+    std::string priority;           // RCOPY_PRIORITY of the measured runs, empty leaves it alone
+};
+
+// What one rcopy run cost, server numbers come from its Session: line.
+struct Run {
+    bool ok = false;
+    double wall_s = 0;
+    uint64_t data_pdus = 0;
+    uint64_t packets = 0;
+    double client_cpu_s = 0;
+    double server_cpu_s = 0;
+    long client_rss_kb = 0;
+    long server_rss_kb = 0;
+
+    double goodput(uint64_t bytes) const { return wall_s > 0 ? bytes / 1e6 / wall_s : 0; }
+    double retransmit_ratio() const { return packets ? (double)(data_pdus - packets) / packets : 0; }
+    double cpu_per_gb(uint64_t bytes) const {
+        return bytes ? (client_cpu_s + server_cpu_s) / (bytes / 1e9) : 0;
+    }
+};
+
+struct Point {
+    uint64_t size;
+    int window;
+    std::string buffer;
+    double error;
+    std::vector<Run> runs;
+};
+
+void usage(const char *name) {
+    fprintf(stderr, "usage: %s [--sizes LIST] [--windows LIST] [--buffers LIST] [--errors LIST]\n"
+                    "       [--repeat N] [--port N] [--timeout S] [--csv FILE] [--json FILE] [--keep] [--trace]\n"
+                    "       [--background N] [--background-size SIZE] [--background-priority P] [--priority P]\n"
+                    "sizes take K/M/G suffixes, buffers take auto\n", name);
+    exit(2);
+}
+
+std::vector<std::string> split(const std::string &list) {
+    std::vector<std::string> items;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ','))
+        if (!item.empty()) items.push_back(item);
+    return items;
+}
+
+uint64_t parse_size(const std::string &text) {
+    char *end = nullptr;
+    double value = strtod(text.c_str(), &end);
+    switch (*end) {
+    case 'k': case 'K': value *= 1024; break;
+    case 'm': case 'M': value *= 1024 * 1024; break;
+    case 'g': case 'G': value *= 1024.0 * 1024 * 1024; break;
+    case '\0': break;
+    default:
+        fprintf(stderr, "bad size %s\n", text.c_str());
+        exit(2);
+    }
+    return (uint64_t)value;
+}
+
+Options parse_args(int argc, char *argv[]) {
+    Options options;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--keep" || arg == "--trace") {
+            (arg == "--keep" ? options.keep : options.trace) = true;
+            continue;
+        }
+        if (i + 1 >= argc) usage(argv[0]);
+        std::string value = argv[++i];
+        if (arg == "--sizes") {
+            options.sizes.clear();
+            for (auto &item : split(value)) options.sizes.push_back(parse_size(item));
+        } else if (arg == "--windows") {
+            options.windows.clear();
+            for (auto &item : split(value)) options.windows.push_back(atoi(item.c_str()));
+        } else if (arg == "--buffers") {
+            options.buffers = split(value);
+        } else if (arg == "--errors") {
+            options.errors.clear();
+            for (auto &item : split(value)) options.errors.push_back(atof(item.c_str()));
+        } else if (arg == "--repeat") {
+            options.repeat = atoi(value.c_str());
+        } else if (arg == "--port") {
+            options.port = atoi(value.c_str());
+        } else if (arg == "--timeout") {
+            options.timeout = atoi(value.c_str());
+        } else if (arg == "--csv") {
+            options.csv = value;
+        } else if (arg == "--json") {
+            options.json = value;
+        } else if (arg == "--background") {
+            options.background = atoi(value.c_str());
+        } else if (arg == "--background-size") {
+            options.background_size = parse_size(value);
+        } else if (arg == "--background-priority") {
+            options.background_priority = value;
+        } else if (arg == "--priority") {
+            options.priority = value;
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (options.repeat < 1 || options.sizes.empty() || options.windows.empty() ||
+        options.buffers.empty() || options.errors.empty() || options.background < 0)
+        usage(argv[0]);
+    return options;
+}
+
+// Same bytes for the same size on every machine, and nothing deflate can
+// shrink, so RCOPY_COMPRESS does not change what is measured.
+void make_file(const std::string &path, uint64_t size) {
+    std::ofstream out(path, std::ios::binary);
+    std::vector<uint64_t> block(8192);
+    uint64_t state = 0x9e3779b97f4a7c15ULL ^ size;
+    for (uint64_t written = 0; written < size;) {
+        for (auto &word : block) {
+            state ^= state >> 12;
+            state ^= state << 25;
+            state ^= state >> 27;
+            word = state * 0x2545f4914f6cdd1dULL;
+        }
+        uint64_t chunk = std::min<uint64_t>(size - written, block.size() * sizeof(uint64_t));
+        out.write(reinterpret_cast<const char *>(block.data()), chunk);
+        written += chunk;
+    }
+    if (!out) {
+        perror(path.c_str());
+        exit(1);
+    }
+}
+
+bool same_file(const std::string &a, const std::string &b) {
+    std::ifstream left(a, std::ios::binary), right(b, std::ios::binary);
+    if (!left || !right) return false;
+    std::vector<char> x(1 << 20), y(1 << 20);
+    while (true) {
+        left.read(x.data(), x.size());
+        right.read(y.data(), y.size());
+        if (left.gcount() != right.gcount()) return false;
+        if (left.gcount() == 0) return true;
+        if (memcmp(x.data(), y.data(), left.gcount()) != 0) return false;
+    }
+}
+
+// env holds NAME=value pairs set for this child only. Everything is built
+// before the fork, the background threads may be holding the allocator.
+pid_t spawn(const std::vector<std::string> &args, const std::string &log, bool truncate,
+            const std::vector<std::string> &env = {}) {
+    std::vector<char *> argv;
+    for (auto &arg : args) argv.push_back(const_cast<char *>(arg.c_str()));
+    argv.push_back(nullptr);
+    std::vector<char *> envp;
+    for (auto &pair : env) envp.push_back(const_cast<char *>(pair.c_str()));
+    for (char **variable = environ; *variable; variable++) envp.push_back(*variable);
+    envp.push_back(nullptr);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork");
+        exit(1);
+    }
+    if (pid == 0) {
+        int fd = open(log.c_str(), O_WRONLY | O_CREAT | (truncate ? O_TRUNC : O_APPEND), 0644);
+        if (fd >= 0) {
+            dup2(fd, STDOUT_FILENO);
+            dup2(fd, STDERR_FILENO);
+            close(fd);
+        }
+        // the first of a name wins, ours come before the inherited ones
+        execve(argv[0], argv.data(), envp.data());
+        perror(argv[0]);
+        _exit(127);
+    }
+    return pid;
+}
+
+// The server is up once its port can no longer be bound.
+bool port_taken(int port) {
+    int fd = socket(AF_INET6, SOCK_DGRAM, 0);
+    if (fd < 0) return false;
+    struct sockaddr_in6 address = {};
+    address.sin6_family = AF_INET6;
+    address.sin6_addr = in6addr_any;
+    address.sin6_port = htons(port);
+    bool taken = bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0 && errno == EADDRINUSE;
+    close(fd);
+    return taken;
+}
+
+pid_t start_server(double error, int port, const std::string &log) {
+    pid_t pid = spawn({"./server", std::to_string(error), std::to_string(port)}, log, false);
+    for (int tries = 0; tries < 500 && !port_taken(port); tries++) {
+        if (waitpid(pid, nullptr, WNOHANG) == pid) {
+            fprintf(stderr, "server exited, see %s\n", log.c_str());
+            exit(1);
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return pid;
+}
+
+void stop_server(pid_t pid) {
+    kill(pid, SIGTERM);
+    waitpid(pid, nullptr, 0);
+}
+
+// Waits for pid up to timeout seconds, a pidfd wakes us the moment it exits.
+bool wait_client(pid_t pid, int timeout, int *status, struct rusage *usage) {
+    int fd = syscall(SYS_pidfd_open, pid, 0);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(timeout);
+    while (true) {
+        pid_t done = wait4(pid, status, WNOHANG, usage);
+        if (done == pid) break;
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+            deadline - std::chrono::steady_clock::now()).count();
+        if (left <= 0) {
+            kill(pid, SIGKILL);
+            wait4(pid, status, 0, usage);
+            if (fd >= 0) close(fd);
+            return false;
+        }
+        if (fd >= 0) {
+            struct pollfd exited = {fd, POLLIN, 0};
+            poll(&exited, 1, (int)left);
+        } else {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+    if (fd >= 0) close(fd);
+    return true;
+}
+
+// The server child prints its Session: line after the EOF ack, which can
+// land a moment after rcopy has exited, or after its 10 EOF resends when
+// the ack was lost. Waiting that out keeps every line with its own run.
+bool read_session(const std::string &log, std::streamoff &offset, Run &run) {
+    for (int tries = 0; tries < 1500; tries++) {
+        std::ifstream in(log);
+        in.seekg(offset);
+        std::string line;
+        std::streamoff position = offset;
+        while (std::getline(in, line)) {
+            if (in.eof()) break;    // partial line, the child is still writing
+            position += line.size() + 1;
+            unsigned long long pdus = 0;
+            unsigned packets = 0;
+            double user = 0, sys = 0;
+            long rss = 0;
+            if (sscanf(line.c_str(), "Session: %llu data PDUs for %u packets, cpu %lf s user %lf s sys, max RSS %ld KB",
+                       &pdus, &packets, &user, &sys, &rss) == 5) {
+                run.data_pdus = pdus;
+                run.packets = packets;
+                run.server_cpu_s = user + sys;
+                run.server_rss_kb = rss;
+                offset = position;
+                return true;
+            }
+        }
+        offset = position;
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return false;
+}
+
+double seconds(const struct timeval &time) { return time.tv_sec + time.tv_usec / 1e6; }
+
+// Bulk copies kept running behind the measured runs, each restarted by its
+// own thread the moment it finishes.
+class Background {
+public:
+    Background(const Options &options, const std::string &dir) : options_(options), dir_(dir) {}
+    ~Background() { stop(); }
+
+    void start(int port) {
+        stopping_ = false;
+        pids_ = std::vector<std::atomic<pid_t>>(options_.background);
+        for (int i = 0; i < options_.background; i++)
+            threads_.emplace_back([this, port, i] { loop(port, i); });
+    }
+
+    void stop() {
+        stopping_ = true;
+        for (pid_t pid : pids_)
+            if (pid > 0) kill(pid, SIGTERM);
+        for (auto &thread : threads_) thread.join();
+        threads_.clear();
+    }
+
+    uint64_t completed() const { return completed_; }
+    uint64_t failed() const { return failed_; }
+
+private:
+    void loop(int port, int index) {
+        std::string input = dir_ + "/background_in";
+        std::string output = dir_ + "/background_out_" + std::to_string(index);
+        std::vector<std::string> env;
+        if (!options_.background_priority.empty()) env.push_back("RCOPY_PRIORITY=" + options_.background_priority);
+        while (!stopping_) {
+            pid_t pid = spawn({"./rcopy", input, output, "400", "1400", "0", "localhost", std::to_string(port)},
+                              dir_ + "/background_" + std::to_string(index) + ".log", true, env);
+            pids_[index] = pid;
+            int status = 0;
+            waitpid(pid, &status, 0);
+            pids_[index] = 0;
+            if (stopping_) break;
+            (WIFEXITED(status) && WEXITSTATUS(status) == 0 ? completed_ : failed_)++;
+        }
+    }
+
+    const Options &options_;
+    std::string dir_;
+    std::vector<std::thread> threads_;
+    std::vector<std::atomic<pid_t>> pids_;
+    std::atomic<bool> stopping_{false};
+    std::atomic<uint64_t> completed_{0};
+    std::atomic<uint64_t> failed_{0};
+};
+
+Run run_once(const Point &point, const std::string &input, const std::string &output, const Options &options,
+             int port, const std::string &server_log, std::streamoff &offset, const std::string &client_log) {
+    Run run;
+    unlink(output.c_str());
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::string> env;
+    if (!options.priority.empty()) env.push_back("RCOPY_PRIORITY=" + options.priority);
+    pid_t pid = spawn({"./rcopy", input, output, std::to_string(point.window), point.buffer,
+                       std::to_string(point.error), "localhost", std::to_string(port)}, client_log, true, env);
+    int status = 0;
+    struct rusage usage = {};
+    bool finished = wait_client(pid, options.timeout, &status, &usage);
+    run.wall_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    run.client_cpu_s = seconds(usage.ru_utime) + seconds(usage.ru_stime);
+    run.client_rss_kb = usage.ru_maxrss;
+
+    bool session = finished && read_session(server_log, offset, run);
+    run.ok = finished && WIFEXITED(status) && WEXITSTATUS(status) == 0 && session && same_file(input, output);
+    return run;
+}
+
+struct Summary {
+    double mean = 0, stddev = 0, min = 0, max = 0;
+};
+
+template <typename Metric>
+Summary summarize(const std::vector<Run> &runs, Metric metric) {
+    Summary summary;
+    std::vector<double> values;
+    for (auto &run : runs)
+        if (run.ok) values.push_back(metric(run));
+    if (values.empty()) return summary;
+    summary.min = summary.max = values[0];
+    for (double value : values) {
+        summary.mean += value;
+        summary.min = std::min(summary.min, value);
+        summary.max = std::max(summary.max, value);
+    }
+    summary.mean /= values.size();
+    for (double value : values) summary.stddev += (value - summary.mean) * (value - summary.mean);
+    summary.stddev = values.size() > 1 ? sqrt(summary.stddev / (values.size() - 1)) : 0;
+    return summary;
+}
+
+std::string revision() {
+    std::string text;
+    FILE *git = popen("git rev-parse --short HEAD 2>/dev/null", "r");
+    if (!git) return text;
+    char line[64];
+    if (fgets(line, sizeof(line), git)) text = line;
+    pclose(git);
+    while (!text.empty() && (text.back() == '\n' || text.back() == '\r')) text.pop_back();
+    return text;
+}
+
+void write_csv(const std::string &path, const std::vector<Point> &points) {
+    FILE *out = fopen(path.c_str(), "w");
+    if (!out) {
+        perror(path.c_str());
+        return;
+    }
+    fprintf(out, "size,window,buffer,error,run,ok,wall_s,goodput_MBps,data_pdus,packets,retransmit_ratio,"
+                 "client_cpu_s,server_cpu_s,cpu_s_per_gb,client_rss_kb,server_rss_kb\n");
+    for (auto &point : points) {
+        for (size_t i = 0; i < point.runs.size(); i++) {
+            const Run &run = point.runs[i];
+            fprintf(out, "%llu,%d,%s,%g,%zu,%d,%.6f,%.3f,%llu,%llu,%.6f,%.6f,%.6f,%.3f,%ld,%ld\n",
+                    (unsigned long long)point.size, point.window, point.buffer.c_str(), point.error, i + 1,
+                    run.ok, run.wall_s, run.goodput(point.size), (unsigned long long)run.data_pdus,
+                    (unsigned long long)run.packets, run.retransmit_ratio(), run.client_cpu_s, run.server_cpu_s,
+                    run.cpu_per_gb(point.size), run.client_rss_kb, run.server_rss_kb);
+        }
+    }
+    fclose(out);
+}
+
+void json_summary(FILE *out, const char *name, const Summary &summary, const char *tail) {
+    fprintf(out, "      \"%s\": {\"mean\": %.6f, \"stddev\": %.6f, \"min\": %.6f, \"max\": %.6f}%s\n",
+            name, summary.mean, summary.stddev, summary.min, summary.max, tail);
+}
+
+void write_json(const std::string &path, const std::vector<Point> &points, const Options &options) {
+    FILE *out = fopen(path.c_str(), "w");
+    if (!out) {
+        perror(path.c_str());
+        return;
+    }
+    fprintf(out, "{\n  \"revision\": \"%s\",\n", revision().c_str());
+    fprintf(out, "  \"priority\": \"%s\", \"background\": %d, \"background_size\": %llu, \"background_priority\": \"%s\",\n",
+            options.priority.c_str(), options.background, (unsigned long long)options.background_size,
+            options.background_priority.c_str());
+    fprintf(out, "  \"points\": [\n");
+    for (size_t p = 0; p < points.size(); p++) {
+        const Point &point = points[p];
+        uint64_t size = point.size;
+        int ok = 0;
+        long client_rss = 0, server_rss = 0;
+        for (auto &run : point.runs) {
+            ok += run.ok;
+            client_rss = std::max(client_rss, run.client_rss_kb);
+            server_rss = std::max(server_rss, run.server_rss_kb);
+        }
+        fprintf(out, "    {\n      \"size\": %llu, \"window\": %d, \"buffer\": \"%s\", \"error\": %g,\n"
+                     "      \"runs\": %zu, \"ok\": %d,\n",
+                (unsigned long long)size, point.window, point.buffer.c_str(), point.error, point.runs.size(), ok);
+        json_summary(out, "goodput_MBps", summarize(point.runs, [size](const Run &run) { return run.goodput(size); }), ",");
+        json_summary(out, "wall_s", summarize(point.runs, [](const Run &run) { return run.wall_s; }), ",");
+        json_summary(out, "retransmit_ratio", summarize(point.runs, [](const Run &run) { return run.retransmit_ratio(); }), ",");
+        json_summary(out, "cpu_s_per_gb", summarize(point.runs, [size](const Run &run) { return run.cpu_per_gb(size); }), ",");
+        fprintf(out, "      \"client_rss_kb\": %ld, \"server_rss_kb\": %ld\n    }%s\n",
+                client_rss, server_rss, p + 1 < points.size() ? "," : "");
+    }
+    fprintf(out, "  ]\n}\n");
+    fclose(out);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    Options options = parse_args(argc, argv);
+    signal(SIGPIPE, SIG_IGN);
+    if (!options.trace) setenv("CPE464_OVERRIDE_DEBUG", "0", 0);
+    if (access("./server", X_OK) != 0 || access("./rcopy", X_OK) != 0) {
+        fprintf(stderr, "run from the directory holding ./server and ./rcopy (make all)\n");
+        return 1;
+    }
+
+    char dir_template[] = "/tmp/rcopy-bench-XXXXXX";
+    if (!mkdtemp(dir_template)) {
+        perror("mkdtemp");
+        return 1;
+    }
+    std::string dir = dir_template;
+    int port = options.port ? options.port : 42000 + getpid() % 2000;
+
+    std::vector<Point> points;
+    for (double error : options.errors)
+        for (uint64_t size : options.sizes)
+            for (int window : options.windows)
+                for (auto &buffer : options.buffers)
+                    points.push_back({size, window, buffer, error, {}});
+
+    for (uint64_t size : options.sizes) make_file(dir + "/in_" + std::to_string(size), size);
+    if (options.background) make_file(dir + "/background_in", options.background_size);
+    Background background(options, dir);
+
+    printf("%10s %6s %6s %6s  %10s %8s %9s %9s %9s %9s\n", "size", "window", "buffer", "error",
+           "MB/s", "+-", "retrans", "cpu s/GB", "rcopy KB", "server KB");
+    int failures = 0;
+    std::string server_log = dir + "/server.log";
+    std::string client_log = dir + "/rcopy.log";
+    pid_t server = -1;
+    double server_error = -1;
+    std::streamoff offset = 0;
+    for (auto &point : points) {
+        if (point.error != server_error) {
+            // the server drops at its own rate, one instance per error rate
+            background.stop();
+            if (server > 0) stop_server(server);
+            server = start_server(point.error, port, server_log);
+            server_error = point.error;
+            background.start(port);
+        }
+        std::string input = dir + "/in_" + std::to_string(point.size);
+        std::string output = dir + "/out";
+        for (int i = 0; i < options.repeat; i++) {
+            std::ifstream log(server_log, std::ios::ate);
+            offset = log ? (std::streamoff)log.tellg() : 0;
+            point.runs.push_back(run_once(point, input, output, options, port, server_log, offset, client_log));
+            if (!point.runs.back().ok) {
+                failures++;
+                fprintf(stderr, "run failed: size %llu window %d buffer %s error %g, see %s\n",
+                        (unsigned long long)point.size, point.window, point.buffer.c_str(), point.error,
+                        client_log.c_str());
+                options.keep = true;
+            }
+        }
+
+        uint64_t size = point.size;
+        Summary goodput = summarize(point.runs, [size](const Run &run) { return run.goodput(size); });
+        Summary retransmit = summarize(point.runs, [](const Run &run) { return run.retransmit_ratio(); });
+        Summary cpu = summarize(point.runs, [size](const Run &run) { return run.cpu_per_gb(size); });
+        long client_rss = 0, server_rss = 0;
+        for (auto &run : point.runs) {
+            client_rss = std::max(client_rss, run.client_rss_kb);
+            server_rss = std::max(server_rss, run.server_rss_kb);
+        }
+        printf("%10llu %6d %6s %6g  %10.2f %8.2f %9.4f %9.2f %9ld %9ld\n", (unsigned long long)size,
+               point.window, point.buffer.c_str(), point.error, goodput.mean, goodput.stddev, retransmit.mean,
+               cpu.mean, client_rss, server_rss);
+        fflush(stdout);
+    }
+    background.stop();
+    if (server > 0) stop_server(server);
+    if (options.background) {
+        printf("background: %d bulk copies of %llu bytes (%s), %llu finished, %llu failed\n", options.background,
+               (unsigned long long)options.background_size, options.background_priority.c_str(),
+               (unsigned long long)background.completed(), (unsigned long long)background.failed());
+    }
+
+    if (!options.csv.empty()) write_csv(options.csv, points);
+    if (!options.json.empty()) write_json(options.json, points, options);
+    if (options.keep) {
+        printf("logs and files kept in %s\n", dir.c_str());
+    } else {
+        std::string command = "rm -rf " + dir;
+        if (system(command.c_str()) != 0) fprintf(stderr, "could not remove %s\n", dir.c_str());
+    }
+    return failures ? 1 : 0;
+}
@@ -8,6 +8,8 @@ typedef struct Packet {
     int sequence_number;
     int data_size;
     int valid;
+    uint64_t sent_ns;   // last time the sender put it on the wire
+    int sends;          // 1 until retransmitted, RTT is only sampled then
     uint8_t data[];
 } Packet;
 
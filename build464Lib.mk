@@ -20,6 +20,9 @@ HFILE = cpe464
 CPE464_VER = libcpe464.$(BUILD_MAJOR).$(BUILD_MINOR)
 CPE464_LIB = $(CPE464_VER).a
 
+# the prerequisites of all are steps in order, never run them side by side
+.NOTPARALLEL:
+
 all: header $(OBJS) link combHeader clean
 	@echo "-------------------------------"
 
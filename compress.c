@@ -0,0 +1,297 @@
+#include "compress.h"
+#include <stdio.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+static int raw_payload(Compressor *codec, const uint8_t *data, size_t available, uint8_t *payload, size_t *consumed);
+static size_t deflate_chunk(Compressor *codec, const uint8_t *data, size_t length);
+static void run_job(CompressJob *job);
+static void *pool_thread(void *arg);
+
+typedef struct PoolWorker {
+    CompressPool *pool;
+    int index;
+} PoolWorker;
+
+Compressor* create_compressor(int slice_size) {
+    Compressor *codec = calloc(1, sizeof(Compressor));
+    if (!codec) return NULL;
+
+    // raw deflate at the fastest level, one stream reset per PDU
+    if (deflateInit2(&codec->stream, Z_BEST_SPEED, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        free(codec);
+        return NULL;
+    }
+    codec->slice_size = slice_size;
+    codec->max_input = (size_t)slice_size * COMPRESS_MAX_RATIO;
+    codec->scratch_size = deflateBound(&codec->stream, codec->max_input);
+    codec->scratch = malloc(codec->scratch_size);
+    codec->ratio = 2.0;
+    if (!codec->scratch) {
+        free_compressor(codec);
+        return NULL;
+    }
+    return codec;
+}
+
+// Fills payload (at most slice_size bytes) from the front of data and
+// returns its length, *consumed tells how much input it covers.
+int compress_payload(Compressor *codec, const uint8_t *data, size_t available, uint8_t *payload, size_t *consumed) {
+    size_t room = codec->slice_size - COMPRESS_HEADER;
+    size_t minimum = codec->slice_size - 1;
+    if (codec->bypass > 0) {
+        codec->bypass--;
+        return raw_payload(codec, data, available, payload, consumed);
+    }
+
+    // guess how much input will just fill the payload, shrink on overshoot
+    size_t length = room * codec->ratio * 0.9;
+    if (length < minimum) length = minimum;
+    if (length > codec->max_input) length = codec->max_input;
+    if (length > available) length = available;
+
+    int tries = 0;
+    int incompressible = 0;
+    for (tries = 0; tries < 4; tries++) {
+        size_t out = deflate_chunk(codec, data, length);
+        if (out <= room && out + COMPRESS_HEADER < length) {
+            uint32_t lengthNW = htonl(length);
+            payload[0] = COMPRESS_DEFLATE;
+            memcpy(payload + 1, &lengthNW, 4);
+            memcpy(payload + COMPRESS_HEADER, codec->scratch, out);
+            codec->ratio = 0.5 * codec->ratio + 0.5 * ((double)length / out);
+            codec->bytes_in += length;
+            codec->bytes_out += out + COMPRESS_HEADER;
+            *consumed = length;
+            return out + COMPRESS_HEADER;
+        }
+        if (length <= minimum || out >= length) {
+            incompressible = 1;
+            break;
+        }
+        length = (double)length * room / out * 0.95;
+        if (length < minimum) length = minimum;
+    }
+
+    if (incompressible) {
+        // did not shrink, stop paying for deflate for a while
+        codec->ratio = 1.0;
+        codec->bypass = COMPRESS_BYPASS;
+    }
+    return raw_payload(codec, data, available, payload, consumed);
+}
+
+void free_compressor(Compressor *codec) {
+    if (!codec) return;
+    deflateEnd(&codec->stream);
+    free(codec->scratch);
+    free(codec);
+}
+
+CompressPool* create_compress_pool(int workers, int slice_size) {
+    CompressPool *pool = calloc(1, sizeof(CompressPool));
+    if (!pool) return NULL;
+
+    if (workers < 1) workers = 1;
+    pool->workers = workers;
+    pool->jobs = calloc(workers, sizeof(CompressJob));
+    pool->threads = calloc(workers, sizeof(pthread_t));
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->finished, NULL);
+    if (!pool->jobs || !pool->threads) {
+        free_compress_pool(pool);
+        return NULL;
+    }
+
+    // raw payloads cost 3 bytes of framing each, compressed ones less
+    size_t outSize = COMPRESS_SEGMENT + (COMPRESS_SEGMENT / (slice_size - 1) + 2) * 3 + slice_size;
+    int i = 0;
+    for (i = 0; i < workers; i++) {
+        pool->jobs[i].codec = create_compressor(slice_size);
+        pool->jobs[i].out = malloc(outSize);
+        if (!pool->jobs[i].codec || !pool->jobs[i].out) {
+            free_compress_pool(pool);
+            return NULL;
+        }
+    }
+    for (i = 1; i < workers; i++) {
+        PoolWorker *worker = malloc(sizeof(PoolWorker));
+        worker->pool = pool;
+        worker->index = i;
+        if (pthread_create(&pool->threads[i], NULL, pool_thread, worker)) {
+            perror("pthread_create");
+            exit(-1);
+        }
+    }
+    return pool;
+}
+
+// Packs up to workers * COMPRESS_SEGMENT bytes, one segment per job.
+void compress_segments(CompressPool *pool, const uint8_t *data, size_t length) {
+    int i = 0;
+    for (i = 0; i < pool->workers; i++) {
+        size_t offset = (size_t)i * COMPRESS_SEGMENT;
+        pool->jobs[i].data = data + offset;
+        pool->jobs[i].length = (offset >= length) ? 0 :
+            ((length - offset > COMPRESS_SEGMENT) ? COMPRESS_SEGMENT : length - offset);
+        pool->jobs[i].out_fill = 0;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->running = pool->workers - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+
+    run_job(&pool->jobs[0]);
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->running > 0)
+        pthread_cond_wait(&pool->finished, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+void compress_totals(CompressPool *pool, uint64_t *in, uint64_t *out, uint64_t *raw) {
+    *in = *out = *raw = 0;
+    int i = 0;
+    for (i = 0; i < pool->workers; i++) {
+        *in += pool->jobs[i].codec->bytes_in;
+        *out += pool->jobs[i].codec->bytes_out;
+        *raw += pool->jobs[i].codec->bytes_raw;
+    }
+}
+
+void free_compress_pool(CompressPool *pool) {
+    if (!pool) return;
+    pthread_mutex_lock(&pool->lock);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->lock);
+    int i = 0;
+    for (i = 1; i < pool->workers; i++) {
+        if (pool->threads[i]) pthread_join(pool->threads[i], NULL);
+    }
+    for (i = 0; pool->jobs && i < pool->workers; i++) {
+        free_compressor(pool->jobs[i].codec);
+        free(pool->jobs[i].out);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->finished);
+    free(pool->jobs);
+    free(pool->threads);
+    free(pool);
+}
+
+Decompressor* create_decompressor(int slice_size) {
+    Decompressor *codec = calloc(1, sizeof(Decompressor));
+    if (!codec) return NULL;
+
+    if (inflateInit2(&codec->stream, -15) != Z_OK) {
+        free(codec);
+        return NULL;
+    }
+    codec->scratch_size = (size_t)slice_size * COMPRESS_MAX_RATIO;
+    codec->scratch = malloc(codec->scratch_size);
+    if (!codec->scratch) {
+        free_decompressor(codec);
+        return NULL;
+    }
+    return codec;
+}
+
+// Returns the payload's original bytes, or NULL if it does not decode.
+const uint8_t* decompress_payload(Decompressor *codec, const uint8_t *payload, int length, size_t *raw_length) {
+    if (length < 1) return NULL;
+    if (payload[0] == COMPRESS_RAW) {
+        *raw_length = length - 1;
+        return payload + 1;
+    }
+    if (payload[0] != COMPRESS_DEFLATE || length < COMPRESS_HEADER) return NULL;
+
+    uint32_t lengthNW = 0;
+    memcpy(&lengthNW, payload + 1, 4);
+    size_t expected = ntohl(lengthNW);
+    if (expected > codec->scratch_size) return NULL;
+
+    inflateReset(&codec->stream);
+    codec->stream.next_in = (Bytef *)payload + COMPRESS_HEADER;
+    codec->stream.avail_in = length - COMPRESS_HEADER;
+    codec->stream.next_out = codec->scratch;
+    codec->stream.avail_out = expected;
+    if (inflate(&codec->stream, Z_FINISH) != Z_STREAM_END || codec->stream.total_out != expected)
+        return NULL;
+    *raw_length = expected;
+    return codec->scratch;
+}
+
+void free_decompressor(Decompressor *codec) {
+    if (!codec) return;
+    inflateEnd(&codec->stream);
+    free(codec->scratch);
+    free(codec);
+}
+
+static int raw_payload(Compressor *codec, const uint8_t *data, size_t available, uint8_t *payload, size_t *consumed) {
+    size_t length = codec->slice_size - 1;
+    if (length > available) length = available;
+    payload[0] = COMPRESS_RAW;
+    memcpy(payload + 1, data, length);
+    codec->bytes_raw += length;
+    *consumed = length;
+    return length + 1;
+}
+
+static void run_job(CompressJob *job) {
+    uint8_t payload[job->codec->slice_size];
+    size_t position = 0;
+    while (position < job->length) {
+        size_t consumed = 0;
+        uint16_t length = compress_payload(job->codec, job->data + position, job->length - position, payload, &consumed);
+        memcpy(job->out + job->out_fill, &length, 2);
+        memcpy(job->out + job->out_fill + 2, payload, length);
+        job->out_fill += 2 + length;
+        position += consumed;
+    }
+}
+
+static void *pool_thread(void *arg) {
+    PoolWorker *worker = arg;
+    CompressPool *pool = worker->pool;
+    int index = worker->index;
+    free(worker);
+
+    unsigned seen = 0;
+    while (1) {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->generation == seen && !pool->stop)
+            pthread_cond_wait(&pool->start, &pool->lock);
+        if (pool->stop) {
+            pthread_mutex_unlock(&pool->lock);
+            return NULL;
+        }
+        seen = pool->generation;
+        pthread_mutex_unlock(&pool->lock);
+
+        run_job(&pool->jobs[index]);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->running == 0)
+            pthread_cond_signal(&pool->finished);
+        pthread_mutex_unlock(&pool->lock);
+    }
+}
+
+static size_t deflate_chunk(Compressor *codec, const uint8_t *data, size_t length) {
+    deflateReset(&codec->stream);
+    codec->stream.next_in = (Bytef *)data;
+    codec->stream.avail_in = length;
+    codec->stream.next_out = codec->scratch;
+    codec->stream.avail_out = codec->scratch_size;
+    if (deflate(&codec->stream, Z_FINISH) != Z_STREAM_END) {
+        // cannot happen with a deflateBound() sized buffer, send it raw
+        return length;
+    }
+    return codec->stream.total_out;
+}
@@ -0,0 +1,74 @@
+#ifndef COMPRESS_H
+#define COMPRESS_H
+#include <stdlib.h>
+#include <stdint.h>
+#include <zlib.h>
+#include <pthread.h>
+
+// Every compressed data PDU decodes on its own, so a lost packet only
+// costs its own retransmission. Payload layouts:
+//   0 data                  sent as is
+//   1 length(4) deflate     raw deflate of length bytes
+#define COMPRESS_RAW 0
+#define COMPRESS_DEFLATE 1
+#define COMPRESS_HEADER 5
+#define COMPRESS_MAX_RATIO 64   // a PDU carries at most this many payloads of input
+#define COMPRESS_BYPASS 256     // PDUs sent raw after one that did not shrink
+#define COMPRESS_SEGMENT (512 * 1024)   // input each worker packs on its own
+#define COMPRESS_WORKERS 4
+
+typedef struct Compressor {
+    z_stream stream;
+    int slice_size;
+    uint8_t *scratch;       // deflate output before it is known to fit
+    size_t scratch_size;
+    size_t max_input;
+    double ratio;           // recent input/output, sizes the next attempt
+    int bypass;             // PDUs left to send raw without trying
+    uint64_t bytes_in;      // input that went out compressed
+    uint64_t bytes_out;     // and what it shrank to
+    uint64_t bytes_raw;     // input that went out raw
+} Compressor;
+
+typedef struct Decompressor {
+    z_stream stream;
+    uint8_t *scratch;
+    size_t scratch_size;
+} Decompressor;
+
+// One segment of input and the len(2) payload records it packed into.
+typedef struct CompressJob {
+    Compressor *codec;
+    const uint8_t *data;
+    size_t length;
+    uint8_t *out;
+    size_t out_fill;
+} CompressJob;
+
+// Segments are packed in parallel, the caller takes job 0 itself.
+typedef struct CompressPool {
+    int workers;
+    CompressJob *jobs;
+    pthread_t *threads;
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t finished;
+    unsigned generation;
+    int running;
+    int stop;
+} CompressPool;
+
+Compressor* create_compressor(int slice_size);
+int compress_payload(Compressor *codec, const uint8_t *data, size_t available, uint8_t *payload, size_t *consumed);
+void free_compressor(Compressor *codec);
+
+CompressPool* create_compress_pool(int workers, int slice_size);
+void compress_segments(CompressPool *pool, const uint8_t *data, size_t length);
+void compress_totals(CompressPool *pool, uint64_t *in, uint64_t *out, uint64_t *raw);
+void free_compress_pool(CompressPool *pool);
+
+Decompressor* create_decompressor(int slice_size);
+const uint8_t* decompress_payload(Decompressor *codec, const uint8_t *payload, int length, size_t *raw_length);
+void free_decompressor(Decompressor *codec);
+
+#endif // COMPRESS_H
@@ -59,7 +59,41 @@ extern "C" {
 
     // Select
     #include <sys/select.h>
+
+    // sendmmsg/recvmmsg, defined with _GNU_SOURCE
+    struct mmsghdr;
+    struct timespec;
 	
+#ifdef CPE464_PASSTHROUGH
+    /*
+     * Passthrough build (-DCPE464_PASSTHROUGH): no error injection and no
+     * bookkeeping. The calls below are the plain socket calls, and nothing
+     * of the library but in_cksum() is linked in.
+     */
+    static inline int sendErr_init(double error_rate, int drop_flag, int flip_flag,
+                                   int debug_flag, int random_flag)
+    {
+        (void)error_rate; (void)drop_flag; (void)flip_flag;
+        (void)debug_flag; (void)random_flag;
+        return 0;
+    }
+
+    static inline int sendErr_setSession(int s, unsigned long session)
+    {
+        (void)s; (void)session;
+        return 0;
+    }
+
+    #define sendErr(...)      send(__VA_ARGS__)
+    #define recvErr(...)      recv(__VA_ARGS__)
+    #define sendtoErr(...)    sendto(__VA_ARGS__)
+    #define recvfromErr(...)  recvfrom(__VA_ARGS__)
+    #define recvmsgErr(...)   recvmsg(__VA_ARGS__)
+    #define sendmmsgErr(...)  sendmmsg(__VA_ARGS__)
+    #define recvmmsgErr(...)  recvmmsg(__VA_ARGS__)
+
+    #define sendtoErr_init(...) sendErr_init(__VA_ARGS__)
+#else
 	int forkMod(void);
 	
 	int socketMod(int doman, int type, int protocol);
@@ -100,6 +134,15 @@ extern "C" {
                      int debug_flag,
                      int random_flag);
 
+    /*
+     * Errors are drawn from a random stream per socket, seeded from the seed
+     * above plus a session id, the socket number by default. Name the session
+     * so its drops do not depend on which socket number it got:
+     *
+     *    sendErr_setSession(socketNum, sessionId);
+     */
+    int sendErr_setSession(int s, unsigned long session);
+
     ssize_t sendErr  (int s, void *msg, int len, unsigned int flags);
 
     ssize_t recvErr(int s, void *buf, size_t len, int flags);
@@ -110,6 +153,27 @@ extern "C" {
     ssize_t recvfromErr(int s, void *buf, size_t len, int flags,
                         struct sockaddr *from, socklen_t *fromlen);
 
+    /*
+     * Same as recvfromErr(...) for a read that also wants the control
+     * messages, the packet is taken from the first iovec.
+     */
+    ssize_t recvmsgErr(int s, struct msghdr *msg, int flags);
+
+    /*
+     * Many datagrams in one call. Each message is numbered, printed and run
+     * through the errors as if it went through sendtoErr(...) on its own,
+     * the survivors then leave in one sendmmsg(). The return value counts
+     * the messages handled, dropped ones included; msg_len is set for each.
+     * Only the first iovec of a message is sent.
+     */
+    int sendmmsgErr(int s, struct mmsghdr *msgs, unsigned int vlen, int flags);
+
+    /*
+     * recvmmsg(), with every datagram printed as recvfromErr(...) would.
+     */
+    int recvmmsgErr(int s, struct mmsghdr *msgs, unsigned int vlen, int flags,
+                    struct timespec *timeout);
+
     #define socket(...)	  socketMod(__VA_ARGS__)
 	#define bind(...)     bindMod(__VA_ARGS__)
     #define select(...)   selectMod(__VA_ARGS__)
@@ -117,13 +181,17 @@ extern "C" {
 
     #define send(...)     sendErr(__VA_ARGS__)
     #define sendto(...)   sendtoErr(__VA_ARGS__)
+    #define sendmmsg(...) sendmmsgErr(__VA_ARGS__)
 
 #ifdef CPE464_OVERRIDE_RECV
     #define recv(...)     recvErr(__VA_ARGS__)
     #define recvfrom(...) recvfromErr(__VA_ARGS__)
+    #define recvmsg(...)  recvmsgErr(__VA_ARGS__)
+    #define recvmmsg(...) recvmmsgErr(__VA_ARGS__)
 #endif
 
     #define sendtoErr_init(...) sendErr_init(__VA_ARGS__)
+#endif
 
 #ifdef __cplusplus
 }
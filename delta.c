@@ -0,0 +1,186 @@
+#include "delta.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <arpa/inet.h>
+
+#define SIG_READ_SIZE (1024 * 1024)     // bytes per read() while signing
+#define FILTER_BITS 20
+
+static uint32_t filter_bit(uint32_t weak);
+static uint32_t table_slot(DeltaIndex *index, uint32_t weak);
+
+uint32_t delta_block_size(uint64_t file_size) {
+    // about sqrt(size) keeps signatures and per-block overhead both small
+    uint32_t block = DELTA_BLOCK_MIN;
+    while (block < DELTA_BLOCK_MAX && (uint64_t)block * block < file_size) block *= 2;
+    while (file_size / block > DELTA_MAX_BLOCKS) block *= 2;
+    return block;
+}
+
+void weak_sums(const uint8_t *data, size_t length, uint32_t *a, uint32_t *b) {
+    uint32_t sumA = 0, sumB = 0;
+    size_t i = 0;
+    for (i = 0; i < length; i++) {
+        sumA += data[i];
+        sumB += (uint32_t)(length - i) * data[i];
+    }
+    *a = sumA & 0xFFFF;
+    *b = sumB & 0xFFFF;
+}
+
+uint64_t strong_hash(const uint8_t *data, size_t length) {
+    // word at a time multiply/rotate mix, then a final avalanche
+    uint64_t hash = 0x9E3779B97F4A7C15ULL ^ length;
+    size_t i = 0;
+    for (i = 0; i + 8 <= length; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        word *= 0xBF58476D1CE4E5B9ULL;
+        word ^= word >> 31;
+        hash = (hash ^ word) * 0x94D049BB133111EBULL;
+        hash = (hash << 27) | (hash >> 37);
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, data + i, length - i);
+    hash ^= tail * 0xBF58476D1CE4E5B9ULL;
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+BlockSig* compute_signatures(int fd, uint32_t block_size, uint32_t *count) {
+    size_t bufferSize = (SIG_READ_SIZE / block_size) * block_size;
+    if (bufferSize == 0) bufferSize = block_size;
+    uint8_t *buffer = malloc(bufferSize);
+    size_t capacity = 1024;
+    BlockSig *sigs = malloc(capacity * sizeof(BlockSig));
+    if (!buffer || !sigs) {
+        free(buffer);
+        free(sigs);
+        return NULL;
+    }
+
+    *count = 0;
+    size_t fill = 0;
+    while (1) {
+        ssize_t got = read(fd, buffer + fill, bufferSize - fill);
+        if (got < 0 && errno == EINTR) continue;
+        if (got < 0) perror("read");
+        if (got > 0) fill += got;
+        if (got > 0 && fill < bufferSize) continue;
+
+        // sign every whole block, a short tail is always sent literally
+        size_t offset = 0;
+        for (offset = 0; offset + block_size <= fill && *count < DELTA_MAX_BLOCKS; offset += block_size) {
+            if (*count == capacity) {
+                capacity *= 2;
+                BlockSig *grown = realloc(sigs, capacity * sizeof(BlockSig));
+                if (!grown) break;
+                sigs = grown;
+            }
+            uint32_t a = 0, b = 0;
+            weak_sums(buffer + offset, block_size, &a, &b);
+            sigs[*count].weak = weak_value(a, b);
+            sigs[*count].strong = strong_hash(buffer + offset, block_size);
+            (*count)++;
+        }
+        if (got <= 0 || fill < bufferSize) break;
+        fill = 0;
+    }
+    free(buffer);
+    return sigs;
+}
+
+void put_signature(uint8_t *buffer, const BlockSig *sig) {
+    uint32_t words[3] = { htonl(sig->weak), htonl(sig->strong >> 32), htonl(sig->strong & 0xFFFFFFFF) };
+    memcpy(buffer, words, SIG_SIZE);
+}
+
+void get_signature(const uint8_t *buffer, BlockSig *sig) {
+    uint32_t words[3];
+    memcpy(words, buffer, SIG_SIZE);
+    sig->weak = ntohl(words[0]);
+    sig->strong = ((uint64_t)ntohl(words[1]) << 32) | ntohl(words[2]);
+}
+
+DeltaIndex* create_delta_index(uint32_t block_size, uint32_t count) {
+    DeltaIndex *index = calloc(1, sizeof(DeltaIndex));
+    if (!index) return NULL;
+
+    uint32_t slots = 16;
+    while (slots < 2 * count) slots *= 2;
+    index->block_size = block_size;
+    index->count = count;
+    index->mask = slots - 1;
+    index->sigs = calloc(count ? count : 1, sizeof(BlockSig));
+    index->table = malloc(slots * sizeof(int32_t));
+    index->filter = calloc(1, (1 << FILTER_BITS) / 8);
+    if (!index->sigs || !index->table || !index->filter) {
+        free_delta_index(index);
+        return NULL;
+    }
+    return index;
+}
+
+void build_delta_index(DeltaIndex *index) {
+    memset(index->table, 0xFF, (index->mask + 1) * sizeof(int32_t));
+    uint32_t i = 0;
+    for (i = 0; i < index->count; i++) {
+        BlockSig *sig = &index->sigs[i];
+        uint32_t slot = table_slot(index, sig->weak);
+        int duplicate = 0;
+        while (index->table[slot] >= 0) {
+            BlockSig *other = &index->sigs[index->table[slot]];
+            // identical blocks (runs of zeros) would only lengthen the chain
+            if (other->weak == sig->weak && other->strong == sig->strong) {
+                duplicate = 1;
+                break;
+            }
+            slot = (slot + 1) & index->mask;
+        }
+        if (duplicate) continue;
+        index->table[slot] = i;
+        uint32_t bit = filter_bit(sig->weak);
+        index->filter[bit >> 3] |= 1 << (bit & 7);
+    }
+}
+
+int32_t find_block(DeltaIndex *index, uint32_t weak, const uint8_t *data) {
+    uint32_t bit = filter_bit(weak);
+    if (!(index->filter[bit >> 3] & (1 << (bit & 7)))) return -1;
+
+    uint32_t slot = table_slot(index, weak);
+    uint64_t strong = 0;
+    int hashed = 0;
+    while (index->table[slot] >= 0) {
+        int32_t block = index->table[slot];
+        if (index->sigs[block].weak == weak) {
+            if (!hashed) {
+                strong = strong_hash(data, index->block_size);
+                hashed = 1;
+            }
+            if (index->sigs[block].strong == strong) return block;
+        }
+        slot = (slot + 1) & index->mask;
+    }
+    return -1;
+}
+
+void free_delta_index(DeltaIndex *index) {
+    if (!index) return;
+    free(index->sigs);
+    free(index->table);
+    free(index->filter);
+    free(index);
+}
+
+static uint32_t filter_bit(uint32_t weak) {
+    return (weak * 0x9E3779B1u) >> (32 - FILTER_BITS);
+}
+
+static uint32_t table_slot(DeltaIndex *index, uint32_t weak) {
+    return ((weak * 0x85EBCA6Bu) ^ (weak >> 16)) & index->mask;
+}
@@ -0,0 +1,58 @@
+#ifndef DELTA_H
+#define DELTA_H
+#include <stdlib.h>
+#include <stdint.h>
+
+#define DELTA_BLOCK_MIN 512
+#define DELTA_BLOCK_MAX (64 * 1024)
+#define DELTA_MAX_BLOCKS (1 << 24)
+#define SIG_SIZE 12         // weak(4) strong(8) on the wire, network order
+#define SIGS_PER_PDU 100    // signatures per SIG packet after its index(4)
+#define DELTA_DIGEST_SIZE 32 // SHA-256 of the new file in the end record
+
+// Record types of a delta stream:
+//   'L' len(4)    literal, followed by exactly len bytes
+//   'C' index(4)  copy block index of the receiver's old file
+//   'E' sha256(32) end of the file, the digest of all of it
+#define DELTA_LITERAL 'L'
+#define DELTA_COPY 'C'
+#define DELTA_END 'E'
+
+typedef struct BlockSig {
+    uint32_t weak;      // rolling checksum, cheap to slide one byte at a time
+    uint64_t strong;    // confirms a weak match
+} BlockSig;
+
+// Server side lookup of the receiver's block signatures.
+typedef struct DeltaIndex {
+    BlockSig *sigs;
+    uint32_t count;
+    uint32_t block_size;
+    int32_t *table;     // open addressing on the weak checksum, -1 = empty
+    uint32_t mask;
+    uint8_t *filter;    // one bit per weak checksum bucket, rejects most misses
+} DeltaIndex;
+
+uint32_t delta_block_size(uint64_t file_size);
+void weak_sums(const uint8_t *data, size_t length, uint32_t *a, uint32_t *b);
+uint64_t strong_hash(const uint8_t *data, size_t length);
+BlockSig* compute_signatures(int fd, uint32_t block_size, uint32_t *count);
+void put_signature(uint8_t *buffer, const BlockSig *sig);
+void get_signature(const uint8_t *buffer, BlockSig *sig);
+
+DeltaIndex* create_delta_index(uint32_t block_size, uint32_t count);
+void build_delta_index(DeltaIndex *index);
+int32_t find_block(DeltaIndex *index, uint32_t weak, const uint8_t *data);
+void free_delta_index(DeltaIndex *index);
+
+static inline uint32_t weak_value(uint32_t a, uint32_t b) {
+    return (a & 0xFFFF) | (b << 16);
+}
+
+// Slides the checksum window one byte: out leaves, in enters.
+static inline void weak_roll(uint32_t *a, uint32_t *b, uint8_t out, uint8_t in, uint32_t length) {
+    *a = (*a - out + in) & 0xFFFF;
+    *b = (*b - length * out + *a) & 0xFFFF;
+}
+
+#endif // DELTA_H
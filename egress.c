@@ -0,0 +1,211 @@
+#include "egress.h"
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "timing.h"
+
+static Egress *joined = NULL;
+static int joined_slot = -1;
+
+static void egress_lock(Egress *egress) {
+    if (pthread_mutex_lock(&egress->lock) == EOWNERDEAD) {
+        // a child died holding it, every update under it is a few stores
+        pthread_mutex_consistent(&egress->lock);
+    }
+}
+
+static void egress_leave(void) {
+    if (joined == NULL) return;
+    egress_lock(joined);
+    memset(&joined->slots[joined_slot], 0, sizeof(EgressSlot));
+    pthread_mutex_unlock(&joined->lock);
+    joined = NULL;
+}
+
+Egress* egress_create(int max, uint64_t rate) {
+    size_t size = sizeof(Egress) + (size_t)max * sizeof(EgressSlot);
+    Egress *egress = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (egress == MAP_FAILED) return NULL;
+
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&egress->lock, &attr);
+    pthread_mutexattr_destroy(&attr);
+    egress->rate = rate;
+    egress->max = max;
+    egress->refill_ns = clock_ns();
+    return egress;
+}
+
+int egress_join(Egress *egress, uint32_t weight, uint32_t priority) {
+    if (egress == NULL) return -1;
+    if (weight < 1) weight = 1;
+    if (weight > EGRESS_WEIGHT_MAX) weight = EGRESS_WEIGHT_MAX;
+    if (priority >= EGRESS_PRIORITIES) priority = EGRESS_NORMAL;
+    uint32_t requested = weight;
+    if (priority != EGRESS_BULK) weight *= EGRESS_CLASS_WEIGHT;
+    uint64_t now = clock_ns();
+    int slot = -1;
+    int i = 0;
+
+    egress_lock(egress);
+    for (i = 0; i < egress->max && slot < 0; i++) {
+        EgressSlot *s = &egress->slots[i];
+        // a child killed before it could give its slot back
+        if (s->pid == 0 || (now - s->last_ns > EGRESS_IDLE_NS && kill(s->pid, 0) < 0 && errno == ESRCH)) {
+            memset(s, 0, sizeof(*s));
+            s->pid = getpid();
+            s->weight = weight;
+            s->requested = requested;
+            s->priority = priority;
+            s->last_ns = now;
+            slot = i;
+        }
+    }
+    pthread_mutex_unlock(&egress->lock);
+
+    if (slot >= 0) {
+        if (joined == NULL) atexit(egress_leave);
+        joined = egress;
+        joined_slot = slot;
+    }
+    return slot;
+}
+
+static void refill(Egress *egress, uint64_t now) {
+    // deep enough for a full round at the largest weight however low the cap
+    int64_t burst = (int64_t)(egress->rate * EGRESS_BURST_NS / 1000000000ULL);
+    if (burst < 2 * EGRESS_QUANTUM * EGRESS_WEIGHT_MAX * EGRESS_CLASS_WEIGHT) {
+        burst = 2 * EGRESS_QUANTUM * EGRESS_WEIGHT_MAX * EGRESS_CLASS_WEIGHT;
+    }
+    if (now <= egress->refill_ns) return;
+    uint64_t elapsed = now - egress->refill_ns;
+    if (elapsed > EGRESS_IDLE_NS) elapsed = EGRESS_IDLE_NS;
+    int64_t added = (int64_t)(egress->rate * elapsed / 1000000000ULL);
+    if (added == 0) return;     // keep the fraction for next time
+    egress->tokens += added;
+    if (egress->tokens > burst) egress->tokens = burst;
+    egress->strict_tokens += added * EGRESS_STRICT_PERCENT / 100;
+    if (egress->strict_tokens > burst) egress->strict_tokens = burst;
+    egress->refill_ns = now;
+}
+
+static int slot_waiting(const EgressSlot *s, uint64_t now) {
+    return s->pid && s->backlog && now - s->last_ns < EGRESS_IDLE_NS;
+}
+
+static int deal_round(Egress *egress, int strict, uint64_t now) {
+    // one round of whole quanta over the waiting slots of one class, a round
+    // the bucket can not finish picks up at the same slot next time.
+    // 1 if anyone was dealt to and the bucket is not dry yet.
+    int dealt = 0;
+    int i = 0;
+    for (i = 0; i < egress->max; i++) {
+        int index = (egress->cursor[strict] + i) % egress->max;
+        EgressSlot *s = &egress->slots[index];
+        if (!slot_waiting(s, now) || (s->priority == EGRESS_INTERACTIVE) != strict) continue;
+        int64_t quantum = (int64_t)EGRESS_QUANTUM * s->weight;
+        if (egress->tokens < quantum || (strict && egress->strict_tokens < quantum)) {
+            egress->cursor[strict] = index;
+            return 0;
+        }
+        s->deficit += quantum;
+        egress->tokens -= quantum;
+        if (strict) egress->strict_tokens -= quantum;
+        dealt = 1;
+    }
+    return dealt;
+}
+
+static void deal(Egress *egress, EgressSlot *asking, int bytes, uint64_t now) {
+    // rounds until the asking session has enough or the bucket is dry,
+    // interactive sessions first in each. Dealing more would hand tokens to
+    // sessions that may go idle and drop them.
+    while (asking->deficit < bytes) {
+        int strict = deal_round(egress, 1, now);
+        if (asking->deficit >= bytes) break;
+        if (!deal_round(egress, 0, now) && !strict) break;
+    }
+}
+
+uint64_t egress_grant(Egress *egress, int slot, int bytes, uint32_t ready, uint64_t now_ns) {
+    if (egress == NULL || slot < 0) return 0;
+    EgressSlot *s = &egress->slots[slot];
+    if (egress->rate == 0) {
+        s->bytes += bytes;
+        atomic_fetch_add_explicit(&egress->bytes, bytes, memory_order_relaxed);
+        return 0;
+    }
+
+    uint64_t wait = 0;
+    egress_lock(egress);
+    s->last_ns = now_ns;
+    s->backlog = ready;
+    if (ready > s->max_backlog) s->max_backlog = ready;
+    if (s->deficit < bytes) {
+        refill(egress, now_ns);
+        deal(egress, s, bytes, now_ns);
+    }
+    if (s->deficit >= bytes) {
+        s->deficit -= bytes;
+        s->bytes += bytes;
+        atomic_fetch_add_explicit(&egress->bytes, bytes, memory_order_relaxed);
+        if (s->waiting_ns) {
+            s->wait_ns += now_ns - s->waiting_ns;
+            s->waiting_ns = 0;
+        }
+    } else {
+        // our share of the cap among our class decides when enough will
+        // have been dealt, near enough for the weighted ones
+        uint32_t weights = 0;
+        uint32_t depth = 0;
+        int i = 0;
+        for (i = 0; i < egress->max; i++) {
+            if (!slot_waiting(&egress->slots[i], now_ns)) continue;
+            depth += egress->slots[i].backlog;
+            if ((egress->slots[i].priority == EGRESS_INTERACTIVE) == (s->priority == EGRESS_INTERACTIVE)) {
+                weights += egress->slots[i].weight;
+            }
+        }
+        if (depth > egress->max_depth) egress->max_depth = depth;
+        wait = (uint64_t)(bytes - s->deficit) * 1000000000ULL / egress->rate * weights / s->weight;
+        if (wait > EGRESS_WAIT_MAX_NS) wait = EGRESS_WAIT_MAX_NS;
+        if (wait == 0) wait = 1;
+        if (!s->waiting_ns) {
+            s->waiting_ns = now_ns;
+            s->waits++;
+        }
+    }
+    pthread_mutex_unlock(&egress->lock);
+    return wait;
+}
+
+void egress_charge(Egress *egress, int slot, int64_t bytes) {
+    if (egress == NULL || slot < 0) return;
+    EgressSlot *s = &egress->slots[slot];
+    if (egress->rate) {
+        egress_lock(egress);
+        s->deficit -= bytes;
+        pthread_mutex_unlock(&egress->lock);
+    }
+    s->bytes += bytes;
+    atomic_fetch_add_explicit(&egress->bytes, (uint64_t)bytes, memory_order_relaxed);
+}
+
+void egress_idle(Egress *egress, int slot) {
+    if (egress == NULL || slot < 0 || egress->rate == 0) return;
+    EgressSlot *s = &egress->slots[slot];
+    uint64_t now = clock_ns();
+    egress_lock(egress);
+    s->backlog = 0;
+    if (s->deficit > 0) s->deficit = 0;
+    if (s->waiting_ns) {
+        s->wait_ns += now - s->waiting_ns;
+        s->waiting_ns = 0;
+    }
+    pthread_mutex_unlock(&egress->lock);
+}
@@ -0,0 +1,73 @@
+#ifndef EGRESS_H
+#define EGRESS_H
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+// Server wide egress scheduler, deficit round robin across the session
+// children. The parent maps one shared page before it forks and every child
+// takes a slot in it. With a rate cap a global token bucket refills at the
+// cap and the tokens are dealt out in rounds, quantum times weight to every
+// session that has data ready, so a bulk session with a huge window gets its
+// share and no more and a small transfer never queues behind it. Without a
+// cap nothing ever waits, the page only keeps the counters.
+// Strict plus weighted: interactive sessions are dealt to before anyone
+// else, up to EGRESS_STRICT_PERCENT of the cap so bulk still moves, and
+// the rest share what is left by weight, a bulk session at a quarter of
+// the weight a normal one has.
+#define EGRESS_QUANTUM 500              // bytes per round per unit of weight
+#define EGRESS_WEIGHT_MAX 16
+#define EGRESS_NORMAL 0                 // priorities, as carried in the filename PDU
+#define EGRESS_INTERACTIVE 1
+#define EGRESS_BULK 2
+#define EGRESS_PRIORITIES 3
+#define EGRESS_CLASS_WEIGHT 4           // weight multiplier of normal and interactive over bulk
+#define EGRESS_STRICT_PERCENT 90
+#define EGRESS_BURST_NS 4000000ULL      // bucket depth, 4 ms at the cap
+#define EGRESS_WAIT_MAX_NS 10000000ULL  // a waiting session asks again at least this often
+#define EGRESS_IDLE_NS 100000000ULL     // a slot not heard from this long is not dealt to
+
+typedef struct EgressSlot {
+    int32_t pid;                // 0 when the slot is free
+    uint32_t weight;            // with the class multiplier applied
+    uint32_t requested;         // as the client asked for it, clamped to EGRESS_WEIGHT_MAX
+    uint32_t priority;
+    int64_t deficit;            // bytes dealt and not yet sent, negative after retransmissions
+    uint32_t backlog;           // PDUs the window allows that wait for their turn
+    uint32_t max_backlog;
+    uint64_t last_ns;           // last asked for a turn
+    uint64_t waiting_ns;        // told to wait at, 0 while it is sending
+    uint64_t bytes;             // sent, retransmissions included
+    uint64_t waits;             // times it was told to wait
+    uint64_t wait_ns;
+} EgressSlot;
+
+typedef struct Egress {
+    pthread_mutex_t lock;       // process shared and robust, a child may die holding it
+    uint64_t rate;              // bytes per second, 0 for no cap
+    int64_t tokens;
+    int64_t strict_tokens;      // what interactive sessions may still take, refilled at their part of the cap
+    uint64_t refill_ns;
+    int cursor[2];              // next slot dealt to, weighted and strict, rounds resume where they ran dry
+    int max;
+    uint32_t max_depth;         // most PDUs waiting server wide
+    _Atomic uint64_t bytes;     // every session together
+    EgressSlot slots[];
+} Egress;
+
+// In the parent, before the first fork. rate is bytes per second, 0 for none.
+Egress* egress_create(int max, uint64_t rate);
+// In a child, -1 if every slot is taken, then it sends unscheduled. The slot
+// is given back when the process exits.
+int egress_join(Egress *egress, uint32_t weight, uint32_t priority);
+// 0 when bytes may go out now, charged to the slot, otherwise how long to
+// wait before asking again. ready is how many PDUs the window would allow.
+uint64_t egress_grant(Egress *egress, int slot, int bytes, uint32_t ready, uint64_t now_ns);
+// Bytes sent without a grant, retransmissions, or a refund when the PDU
+// came out smaller than granted. Never waits.
+void egress_charge(Egress *egress, int slot, int64_t bytes);
+// Nothing ready, the window is full. Leftover deficit is dropped as in DRR.
+void egress_idle(Egress *egress, int slot);
+
+#endif // EGRESS_H
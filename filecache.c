@@ -0,0 +1,100 @@
+#include "filecache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static void evict_entry(FileCache *cache, CacheEntry *entry);
+static CacheEntry* lru_entry(FileCache *cache);
+
+void init_file_cache(FileCache *cache, size_t budget) {
+    memset(cache, 0, sizeof(FileCache));
+    cache->budget = budget;
+}
+
+const uint8_t* cache_lookup(FileCache *cache, const char *path, int fd, size_t *length) {
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) return NULL;
+
+    cache->clock++;
+    int i = 0;
+    for (i = 0; i < FILE_CACHE_ENTRIES; i++) {
+        CacheEntry *entry = &cache->entries[i];
+        if (!entry->valid || strcmp(entry->path, path) != 0) continue;
+
+        if (entry->dev == st.st_dev && entry->ino == st.st_ino && entry->size == st.st_size &&
+            entry->mtime.tv_sec == st.st_mtim.tv_sec && entry->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+            cache->hits++;
+            entry->last_used = cache->clock;
+            *length = entry->size;
+            return entry->data;
+        }
+        // file changed on disk, the old copy is useless now
+        evict_entry(cache, entry);
+        break;
+    }
+
+    cache->misses++;
+    size_t size = st.st_size;
+    if (size == 0 || size > cache->budget) return NULL;
+
+    // make room: least recently used files go first
+    CacheEntry *slot = NULL;
+    while (1) {
+        slot = NULL;
+        for (i = 0; i < FILE_CACHE_ENTRIES; i++) {
+            if (!cache->entries[i].valid) { slot = &cache->entries[i]; break; }
+        }
+        if (slot && cache->used + size <= cache->budget) break;
+        evict_entry(cache, lru_entry(cache));
+    }
+
+    void *data = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (data == MAP_FAILED) {
+        perror("mmap");
+        return NULL;
+    }
+    // start pulling it in now, sessions stream it front to back
+    madvise(data, size, MADV_WILLNEED);
+    madvise(data, size, MADV_SEQUENTIAL);
+
+    snprintf(slot->path, sizeof(slot->path), "%s", path);
+    slot->dev = st.st_dev;
+    slot->ino = st.st_ino;
+    slot->mtime = st.st_mtim;
+    slot->size = st.st_size;
+    slot->data = data;
+    slot->last_used = cache->clock;
+    slot->valid = 1;
+    cache->used += size;
+
+    *length = size;
+    return slot->data;
+}
+
+void print_cache_stats(FileCache *cache) {
+    printf("File cache: %llu hits %llu misses %llu evictions (%.1f of %.1f MB)\n",
+        (unsigned long long)cache->hits, (unsigned long long)cache->misses,
+        (unsigned long long)cache->evictions,
+        cache->used / 1048576.0, cache->budget / 1048576.0);
+}
+
+static void evict_entry(FileCache *cache, CacheEntry *entry) {
+    // sessions already forked keep their own reference to the mapping
+    munmap((void *)entry->data, entry->size);
+    cache->used -= entry->size;
+    cache->evictions++;
+    entry->valid = 0;
+}
+
+static CacheEntry* lru_entry(FileCache *cache) {
+    CacheEntry *oldest = NULL;
+    int i = 0;
+    for (i = 0; i < FILE_CACHE_ENTRIES; i++) {
+        CacheEntry *entry = &cache->entries[i];
+        if (entry->valid && (oldest == NULL || entry->last_used < oldest->last_used))
+            oldest = entry;
+    }
+    return oldest;
+}
@@ -0,0 +1,38 @@
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#define FILE_CACHE_ENTRIES 64
+#define FILE_CACHE_BUDGET_MB 256
+
+typedef struct CacheEntry {
+    char path[101];
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    off_t size;
+    const uint8_t *data;    // read-only mapping of the whole file
+    uint64_t last_used;
+    int valid;
+} CacheEntry;
+
+// Lives in the parent server. Mappings are inherited by every forked session,
+// so concurrent transfers of the same file all read one copy of its pages.
+typedef struct FileCache {
+    CacheEntry entries[FILE_CACHE_ENTRIES];
+    size_t budget;
+    size_t used;
+    uint64_t clock;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+} FileCache;
+
+void init_file_cache(FileCache *cache, size_t budget);
+const uint8_t* cache_lookup(FileCache *cache, const char *path, int fd, size_t *length);
+void print_cache_stats(FileCache *cache);
+
+#endif // FILE_CACHE_H
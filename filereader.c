@@ -0,0 +1,590 @@
+#define _GNU_SOURCE
+#include "filereader.h"
+#include "sha256.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+
+static FileReader* alloc_reader(int slice_size, int depth, int compress);
+static void start_reader(FileReader *reader);
+static void *reader_thread(void *arg);
+static int claim_block(FileReader *reader);
+static void publish_block(FileReader *reader);
+static void finish_stream(FileReader *reader);
+static int emit(FileReader *reader, const void *data, size_t length);
+static int emit_file(FileReader *reader, int fd, uint64_t limit);
+static int emit_record(FileReader *reader, uint8_t type, const char *path, uint64_t size);
+static int walk_tree(FileReader *reader, char *path, size_t rootLength);
+static int emit_entry(FileReader *reader, char *path, size_t rootLength);
+static int walk_manifest(FileReader *reader, char *path);
+static int safe_relative_path(const char *path);
+static int emit_delta(FileReader *reader);
+static int emit_literal(FileReader *reader, const uint8_t *data, size_t length);
+static int map_source(FileReader *reader);
+static int compress_pending(FileReader *reader);
+static int put_record(FileReader *reader, const uint8_t *payload, int length);
+static uint64_t now_usec(void);
+
+FileReader* create_file_reader(int fd, int slice_size, int depth, int compress) {
+    FileReader *reader = alloc_reader(slice_size, depth, compress);
+    if (!reader) return NULL;
+
+    // tell the kernel we stream the file front to back
+    reader->fd = fd;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    readahead(fd, 0, reader->block_size * reader->depth);
+
+    start_reader(reader);
+    return reader;
+}
+
+FileReader* create_tree_reader(const char *root, int slice_size, int depth, int compress) {
+    FileReader *reader = alloc_reader(slice_size, depth, compress);
+    if (!reader) return NULL;
+
+    reader->fd = -1;
+    snprintf(reader->root, sizeof(reader->root), "%s", root);
+    start_reader(reader);
+    return reader;
+}
+
+FileReader* create_manifest_reader(const char *manifest, int slice_size, int depth, int compress) {
+    FileReader *reader = alloc_reader(slice_size, depth, compress);
+    if (!reader) return NULL;
+
+    reader->fd = -1;
+    reader->manifest = 1;
+    snprintf(reader->root, sizeof(reader->root), "%s", manifest);
+    start_reader(reader);
+    return reader;
+}
+
+FileReader* create_delta_reader(int fd, const uint8_t *data, size_t length, int slice_size, int depth, DeltaIndex *index, int compress) {
+    FileReader *reader = alloc_reader(slice_size, depth, compress);
+    if (!reader) return NULL;
+
+    // data is the file cache's copy when there is one, otherwise the
+    // thread maps the file itself
+    reader->fd = fd;
+    reader->delta = index;
+    reader->source = data;
+    reader->source_length = length;
+    start_reader(reader);
+    return reader;
+}
+
+FileReader* create_mapped_reader(const uint8_t *data, size_t length, int slice_size, int compress) {
+    if (compress) {
+        // the thread compresses straight out of the cached copy
+        FileReader *reader = alloc_reader(slice_size, READAHEAD_DEFAULT, compress);
+        if (!reader) return NULL;
+        reader->fd = -1;
+        reader->source = data;
+        reader->source_length = length;
+        start_reader(reader);
+        return reader;
+    }
+
+    FileReader *reader = calloc(1, sizeof(FileReader));
+    if (!reader) return NULL;
+
+    reader->fd = -1;
+    reader->slice_size = slice_size;
+    reader->send_size = slice_size;
+    reader->mapped = data;
+    reader->mapped_length = length;
+    return reader;
+}
+
+int next_slice(FileReader *reader, const uint8_t **slice) {
+    if (reader->mapped) {
+        size_t length = reader->mapped_length - reader->offset;
+        if (length > (size_t)reader->send_size) length = reader->send_size;
+        *slice = reader->mapped + reader->offset;
+        reader->offset += length;
+        return (int)length;
+    }
+
+    pthread_mutex_lock(&reader->lock);
+
+    // done with the current block, hand it back to the reader thread
+    if (reader->count > 0 && reader->offset >= reader->blocks[reader->tail].length) {
+        reader->tail = (reader->tail + 1) % reader->depth;
+        reader->count--;
+        reader->offset = 0;
+        pthread_cond_signal(&reader->drained);
+    }
+
+    if (reader->count == 0 && !reader->done) {
+        uint64_t start = now_usec();
+        reader->stalls++;
+        while (reader->count == 0 && !reader->done)
+            pthread_cond_wait(&reader->filled, &reader->lock);
+        reader->stall_usec += now_usec() - start;
+    }
+
+    if (reader->count == 0) {
+        pthread_mutex_unlock(&reader->lock);
+        return 0;
+    }
+
+    ReadBlock *block = &reader->blocks[reader->tail];
+    pthread_mutex_unlock(&reader->lock);
+
+    // blocks[tail] belongs to the sender until it is released above
+    if (reader->pool) {
+        uint16_t record = 0;
+        memcpy(&record, block->data + reader->offset, 2);
+        *slice = block->data + reader->offset + 2;
+        reader->offset += 2 + record;
+        return record;
+    }
+    size_t length = block->length - reader->offset;
+    if (length > (size_t)reader->send_size) length = reader->send_size;
+    *slice = block->data + reader->offset;
+    reader->offset += length;
+    return (int)length;
+}
+
+void limit_slices(FileReader *reader, int size) {
+    // only the sender reads send_size, blocks keep their slice_size layout
+    if (size > 0 && size < reader->send_size) reader->send_size = size;
+}
+
+void free_file_reader(FileReader *reader) {
+    if (!reader) return;
+    if (reader->started) {
+        pthread_mutex_lock(&reader->lock);
+        reader->stop = 1;
+        pthread_cond_signal(&reader->drained);
+        pthread_mutex_unlock(&reader->lock);
+        pthread_join(reader->thread, NULL);
+        pthread_mutex_destroy(&reader->lock);
+        pthread_cond_destroy(&reader->filled);
+        pthread_cond_destroy(&reader->drained);
+    }
+    if (reader->source_owned)
+        munmap((void *)reader->source, reader->source_length);
+    free_compress_pool(reader->pool);
+    free(reader->pending);
+    int i = 0;
+    for (i = 0; i < reader->depth; i++)
+        free(reader->blocks[i].data);
+    free(reader->blocks);
+    free(reader);
+}
+
+static FileReader* alloc_reader(int slice_size, int depth, int compress) {
+    FileReader *reader = calloc(1, sizeof(FileReader));
+    if (!reader) return NULL;
+
+    if (depth < 2) depth = 2;
+    int slices = READ_BLOCK_TARGET / slice_size;
+    if (slices < 1) slices = 1;
+
+    reader->depth = depth;
+    reader->slice_size = slice_size;
+    reader->send_size = slice_size;
+    reader->block_size = (size_t)slices * slice_size;
+    reader->blocks = calloc(depth, sizeof(ReadBlock));
+    if (!reader->blocks) { free(reader); return NULL; }
+
+    int i = 0;
+    for (i = 0; i < depth; i++) {
+        if (posix_memalign((void **)&reader->blocks[i].data, READ_BLOCK_ALIGN, reader->block_size)) {
+            reader->depth = i;
+            free_file_reader(reader);
+            return NULL;
+        }
+    }
+
+    if (compress) {
+        reader->pool = create_compress_pool(compress, slice_size);
+        reader->pending_size = (size_t)compress * COMPRESS_SEGMENT;
+        reader->pending = malloc(reader->pending_size);
+        if (!reader->pool || !reader->pending) {
+            free_file_reader(reader);
+            return NULL;
+        }
+    }
+    return reader;
+}
+
+static void start_reader(FileReader *reader) {
+    pthread_mutex_init(&reader->lock, NULL);
+    pthread_cond_init(&reader->filled, NULL);
+    pthread_cond_init(&reader->drained, NULL);
+    if (pthread_create(&reader->thread, NULL, reader_thread, reader)) {
+        perror("pthread_create");
+        exit(-1);
+    }
+    reader->started = 1;
+}
+
+static void *reader_thread(void *arg) {
+    FileReader *reader = arg;
+
+    if (reader->delta) {
+        if (reader->source != NULL || map_source(reader) == 0)
+            emit_delta(reader);
+    } else if (reader->source) {
+        emit(reader, reader->source, reader->source_length);
+    } else if (reader->root[0] == '\0') {
+        emit_file(reader, reader->fd, UINT64_MAX);
+    } else if (reader->manifest) {
+        char path[PATH_MAX];
+        if (walk_manifest(reader, path) == 0)
+            emit_record(reader, TREE_END, NULL, 0);
+    } else {
+        char path[PATH_MAX];
+        snprintf(path, sizeof(path), "%s", reader->root);
+        size_t rootLength = strlen(path);
+        while (rootLength > 1 && path[rootLength - 1] == '/')
+            path[--rootLength] = '\0';
+        if (walk_tree(reader, path, rootLength) == 0)
+            emit_record(reader, TREE_END, NULL, 0);
+    }
+    finish_stream(reader);
+    return NULL;
+}
+
+// The thread owns blocks[head] from claim_block() until publish_block(),
+// the sender never looks past the published blocks.
+static int claim_block(FileReader *reader) {
+    pthread_mutex_lock(&reader->lock);
+    while (reader->count == reader->depth && !reader->stop)
+        pthread_cond_wait(&reader->drained, &reader->lock);
+    int stopped = reader->stop;
+    pthread_mutex_unlock(&reader->lock);
+    if (stopped) return -1;
+
+    reader->blocks[reader->head].length = 0;
+    reader->filling = 1;
+    return 0;
+}
+
+static void publish_block(FileReader *reader) {
+    pthread_mutex_lock(&reader->lock);
+    reader->head = (reader->head + 1) % reader->depth;
+    reader->count++;
+    pthread_cond_signal(&reader->filled);
+    pthread_mutex_unlock(&reader->lock);
+    reader->filling = 0;
+}
+
+static void finish_stream(FileReader *reader) {
+    if (reader->pool && !reader->stop)
+        compress_pending(reader);
+    if (reader->filling && reader->blocks[reader->head].length > 0)
+        publish_block(reader);
+    pthread_mutex_lock(&reader->lock);
+    reader->done = 1;
+    pthread_cond_signal(&reader->filled);
+    pthread_mutex_unlock(&reader->lock);
+}
+
+static int emit(FileReader *reader, const void *data, size_t length) {
+    const uint8_t *bytes = data;
+    while (reader->pool && length > 0) {
+        size_t chunk = reader->pending_size - reader->pending_fill;
+        if (chunk > length) chunk = length;
+        memcpy(reader->pending + reader->pending_fill, bytes, chunk);
+        reader->pending_fill += chunk;
+        bytes += chunk;
+        length -= chunk;
+        if (reader->pending_fill == reader->pending_size && compress_pending(reader)) return -1;
+    }
+    while (length > 0) {
+        if (!reader->filling && claim_block(reader)) return -1;
+        ReadBlock *block = &reader->blocks[reader->head];
+        size_t chunk = reader->block_size - block->length;
+        if (chunk > length) chunk = length;
+        memcpy(block->data + block->length, bytes, chunk);
+        block->length += chunk;
+        bytes += chunk;
+        length -= chunk;
+        if (block->length == reader->block_size) publish_block(reader);
+    }
+    return 0;
+}
+
+// Reads straight into the ring. A file that shrinks under us is padded with
+// zeros so the record framing around it stays intact and 1 is returned, the
+// caller marks it damaged. A read error fails the stream.
+static int emit_file(FileReader *reader, int fd, uint64_t limit) {
+    int padded = 0;
+    while (limit > 0) {
+        // compressed streams read into the pending buffer instead of the ring
+        uint8_t *target = NULL;
+        size_t room = 0;
+        ReadBlock *block = NULL;
+        if (reader->pool) {
+            if (reader->pending_fill == reader->pending_size && compress_pending(reader)) return -1;
+            target = reader->pending + reader->pending_fill;
+            room = reader->pending_size - reader->pending_fill;
+        } else {
+            if (!reader->filling && claim_block(reader)) return -1;
+            block = &reader->blocks[reader->head];
+            target = block->data + block->length;
+            room = reader->block_size - block->length;
+        }
+        if (room > limit) room = limit;
+        ssize_t got = read(fd, target, room);
+        if (got < 0 && errno == EINTR) continue;
+        if (got < 0) {
+            perror("read");
+            reader->failed = 1;     // seen by the sender once done is set
+            return -1;
+        }
+        if (got == 0) {
+            if (limit == UINT64_MAX) return 0;
+            got = room;
+            memset(target, 0, got);
+            padded = 1;
+        }
+        limit -= got;
+        if (reader->pool) {
+            reader->pending_fill += got;
+            continue;
+        }
+        block->length += got;
+        if (block->length == reader->block_size) publish_block(reader);
+    }
+    return padded;
+}
+
+// Packs the pending stream bytes into compressed payloads, all workers at
+// once, and queues the records in stream order.
+static int compress_pending(FileReader *reader) {
+    if (reader->pending_fill == 0) return 0;
+    compress_segments(reader->pool, reader->pending, reader->pending_fill);
+    reader->pending_fill = 0;
+
+    int i = 0;
+    for (i = 0; i < reader->pool->workers; i++) {
+        CompressJob *job = &reader->pool->jobs[i];
+        size_t position = 0;
+        while (position < job->out_fill) {
+            uint16_t length = 0;
+            memcpy(&length, job->out + position, 2);
+            if (put_record(reader, job->out + position + 2, length)) return -1;
+            position += 2 + length;
+        }
+    }
+    return 0;
+}
+
+static int put_record(FileReader *reader, const uint8_t *payload, int length) {
+    // records never straddle blocks, next_slice() hands them out in place
+    if (reader->filling && reader->block_size - reader->blocks[reader->head].length < (size_t)length + 2)
+        publish_block(reader);
+    if (!reader->filling && claim_block(reader)) return -1;
+    ReadBlock *block = &reader->blocks[reader->head];
+    uint16_t record = length;
+    memcpy(block->data + block->length, &record, 2);
+    memcpy(block->data + block->length + 2, payload, length);
+    block->length += 2 + length;
+    return 0;
+}
+
+static int emit_record(FileReader *reader, uint8_t type, const char *path, uint64_t size) {
+    uint8_t header[3];
+    header[0] = type;
+    if (type == TREE_END) return emit(reader, header, 1);
+
+    uint16_t pathLength = htons(strlen(path));
+    memcpy(header + 1, &pathLength, 2);
+    if (emit(reader, header, 3) || emit(reader, path, strlen(path))) return -1;
+    if (type != TREE_FILE) return 0;
+
+    uint32_t sizeNW[2] = { htonl(size >> 32), htonl(size & 0xFFFFFFFF) };
+    return emit(reader, sizeNW, 8);
+}
+
+static int walk_tree(FileReader *reader, char *path, size_t rootLength) {
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        perror(path);
+        return 0;
+    }
+
+    size_t length = strlen(path);
+    struct dirent *entry;
+    int result = 0;
+    while (result == 0 && (entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) continue;
+        if (length + 1 + strlen(entry->d_name) >= PATH_MAX) continue;
+        snprintf(path + length, PATH_MAX - length, "/%s", entry->d_name);
+        result = emit_entry(reader, path, rootLength);
+        path[length] = '\0';
+    }
+    closedir(dir);
+    return result;
+}
+
+// Sends one file, or one directory and everything below it. Names on the
+// wire are relative to the requested directory, what follows rootLength + 1.
+static int emit_entry(FileReader *reader, char *path, size_t rootLength) {
+    const char *relative = path + rootLength + 1;
+    struct stat st;
+    int result = 0;
+    if (lstat(path, &st) < 0) {
+        perror(path);
+    } else if (S_ISDIR(st.st_mode)) {
+        result = emit_record(reader, TREE_DIR, relative, 0);
+        if (result == 0) result = walk_tree(reader, path, rootLength);
+    } else if (S_ISREG(st.st_mode)) {
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            perror(path);
+        } else {
+            posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+            result = emit_record(reader, TREE_FILE, relative, st.st_size);
+            if (result == 0) result = emit_file(reader, fd, st.st_size);
+            if (result == 1) {
+                fprintf(stderr, "%s: shrank while it was sent\n", path);
+                result = emit_record(reader, TREE_DAMAGED, relative, 0);
+            }
+            close(fd);
+            reader->files++;
+        }
+    }
+    return result;
+}
+
+// The manifest names one path per line, relative to the server's working
+// directory, and each goes out under that name. Empty lines and lines
+// starting with # are skipped.
+static int walk_manifest(FileReader *reader, char *path) {
+    FILE *list = fopen(reader->root, "r");
+    if (list == NULL) {
+        perror(reader->root);
+        return 0;
+    }
+    char line[PATH_MAX];
+    int result = 0;
+    while (result == 0 && fgets(line, sizeof(line), list) != NULL) {
+        size_t length = strcspn(line, "\r\n");
+        while (length > 1 && line[length - 1] == '/') length--;
+        line[length] = '\0';
+        if (length == 0 || line[0] == '#') continue;
+        if (length + 2 >= PATH_MAX || !safe_relative_path(line)) {
+            fprintf(stderr, "%s: not a relative path, skipped\n", line);
+            continue;
+        }
+        // "./" stands in for the root a directory walk strips off
+        memcpy(path, "./", 2);
+        memcpy(path + 2, line, length + 1);
+        result = emit_entry(reader, path, 1);
+    }
+    fclose(list);
+    return result;
+}
+
+// The receiver refuses these, must match filewriter.c
+static int safe_relative_path(const char *path) {
+    if (path[0] == '/') return 0;
+    const char *part = path;
+    while (part != NULL) {
+        if (strncmp(part, "..", 2) == 0 && (part[2] == '/' || part[2] == '\0')) return 0;
+        part = strchr(part, '/');
+        if (part != NULL) part++;
+    }
+    return 1;
+}
+
+// Slides a block sized window over the file one byte at a time. Windows the
+// receiver already has go out as block references, everything between them
+// as literals.
+static int emit_delta(FileReader *reader) {
+    DeltaIndex *index = reader->delta;
+    const uint8_t *data = reader->source;
+    size_t length = reader->source_length;
+    size_t block = index->block_size;
+    size_t position = 0;
+    size_t literal = 0;     // start of bytes not yet covered by a record
+    uint32_t a = 0, b = 0;
+    int primed = 0;
+
+    while (index->count > 0 && position + block <= length) {
+        if (!primed) {
+            weak_sums(data + position, block, &a, &b);
+            primed = 1;
+        }
+        int32_t match = find_block(index, weak_value(a, b), data + position);
+        if (match >= 0) {
+            uint8_t record[5];
+            uint32_t matchNW = htonl(match);
+            record[0] = DELTA_COPY;
+            memcpy(record + 1, &matchNW, 4);
+            if (emit_literal(reader, data + literal, position - literal) || emit(reader, record, 5))
+                return -1;
+            reader->matched++;
+            position += block;
+            literal = position;
+            primed = 0;
+            continue;
+        }
+        if (position + block < length)
+            weak_roll(&a, &b, data[position], data[position + block], block);
+        position++;
+    }
+
+    // the weak and strong sums only pick blocks, the digest vouches for the result
+    uint8_t end[1 + DELTA_DIGEST_SIZE];
+    end[0] = DELTA_END;
+    sha256(data, length, end + 1);
+    if (emit_literal(reader, data + literal, length - literal)) return -1;
+    return emit(reader, end, sizeof(end));
+}
+
+static int emit_literal(FileReader *reader, const uint8_t *data, size_t length) {
+    while (length > 0) {
+        uint32_t chunk = (length > (1u << 30)) ? (1u << 30) : length;
+        uint8_t record[5];
+        uint32_t chunkNW = htonl(chunk);
+        record[0] = DELTA_LITERAL;
+        memcpy(record + 1, &chunkNW, 4);
+        if (emit(reader, record, 5) || emit(reader, data, chunk)) return -1;
+        reader->literal += chunk;
+        data += chunk;
+        length -= chunk;
+    }
+    return 0;
+}
+
+static int map_source(FileReader *reader) {
+    struct stat st;
+    if (fstat(reader->fd, &st) < 0) {
+        perror("fstat");
+        return -1;
+    }
+    reader->source_length = st.st_size;
+    if (st.st_size == 0) {
+        reader->source = (const uint8_t *)"";
+        return 0;
+    }
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, reader->fd, 0);
+    if (data == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    reader->source = data;
+    reader->source_owned = 1;
+    return 0;
+}
+
+static uint64_t now_usec(void) {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
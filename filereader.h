@@ -0,0 +1,81 @@
+#ifndef FILE_READER_H
+#define FILE_READER_H
+#include <stdlib.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <limits.h>
+#include "delta.h"
+#include "compress.h"
+
+#define READ_BLOCK_TARGET (256 * 1024)   // bytes per block, rounded to whole slices
+#define READ_BLOCK_ALIGN 4096
+#define READAHEAD_DEFAULT 4              // blocks in the ring (2 = double buffered)
+
+// Record types of a directory tree stream:
+//   'D' len(2) path          directory
+//   'F' len(2) path size(8)  file, followed by exactly size bytes
+//   'X' len(2) path          the file before it shrank while it was read
+//   'E'                      end of the tree
+#define TREE_DIR 'D'
+#define TREE_FILE 'F'
+#define TREE_END 'E'
+#define TREE_DAMAGED 'X'
+
+typedef struct ReadBlock {
+    uint8_t *data;
+    size_t length;
+} ReadBlock;
+
+// A reader thread fills a ring of blocks ahead of the sender, which takes
+// payload sized slices out of them in place.
+typedef struct FileReader {
+    int fd;
+    ReadBlock *blocks;
+    int depth;
+    size_t block_size;
+    int slice_size;
+    int send_size;      // slices handed out, below slice_size once the path MTU drops
+    int head;           // next block the reader thread fills
+    int tail;           // block the sender is slicing
+    int count;          // filled blocks not yet released by the sender
+    size_t offset;      // sender position inside blocks[tail]
+    int done;           // reader thread hit end of file (or an error)
+    int failed;         // a read error cut the stream short, it must not end in an EOF
+    int filling;        // reader thread owns blocks[head] and is filling it
+    int stop;
+    int started;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t filled;
+    pthread_cond_t drained;
+    uint64_t stalls;        // times the sender found the ring empty
+    uint64_t stall_usec;    // and how long it waited on the disk
+    const uint8_t *mapped;  // whole file already in memory (file cache), no thread
+    size_t mapped_length;
+    char root[PATH_MAX];    // directory streamed as a tree of records
+    int manifest;           // root is a file listing the paths to stream instead
+    uint64_t files;
+    DeltaIndex *delta;      // file streamed as a delta against these blocks
+    const uint8_t *source;  // file contents the delta is computed from
+    size_t source_length;
+    int source_owned;       // source was mapped by the reader thread
+    uint64_t matched;       // blocks the receiver already had
+    uint64_t literal;       // bytes that still had to be sent
+    CompressPool *pool;     // blocks hold len(2) payload records, not raw bytes
+    uint8_t *pending;       // stream bytes waiting to be compressed
+    size_t pending_fill;
+    size_t pending_size;
+} FileReader;
+
+// compress is the number of compression workers, 0 sends the stream raw
+FileReader* create_file_reader(int fd, int slice_size, int depth, int compress);
+FileReader* create_tree_reader(const char *root, int slice_size, int depth, int compress);
+FileReader* create_manifest_reader(const char *manifest, int slice_size, int depth, int compress);
+FileReader* create_delta_reader(int fd, const uint8_t *data, size_t length, int slice_size, int depth, DeltaIndex *index, int compress);
+FileReader* create_mapped_reader(const uint8_t *data, size_t length, int slice_size, int compress);
+int next_slice(FileReader *reader, const uint8_t **slice);
+// compressed records are packed ahead at slice_size and can not shrink
+void limit_slices(FileReader *reader, int size);
+void free_file_reader(FileReader *reader);
+
+#endif // FILE_READER_H
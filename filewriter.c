@@ -0,0 +1,496 @@
+#define _GNU_SOURCE
+#include "filewriter.h"
+#include "delta.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include <arpa/inet.h>
+
+#define SLOT_CLOSE -1   // slot length that tells the writer to flush and exit
+#define SLOT_PACKED 0x40000000  // length bit of a payload to decompress first
+
+static FileWriter* alloc_writer(int slot_size);
+static void start_writer(FileWriter *writer);
+static void *writer_thread(void *arg);
+static void stage_bytes(FileWriter *writer, const uint8_t *data, size_t length);
+static void flush_stage(FileWriter *writer);
+static void write_block(FileWriter *writer, size_t length);
+static void put_slot(FileWriter *writer, const uint8_t *data, int length);
+static void consume_slot(FileWriter *writer, const uint8_t *data, int length);
+static void consume_bytes(FileWriter *writer, const uint8_t *data, size_t length);
+static void parse_records(FileWriter *writer, const uint8_t *data, size_t length);
+static void tree_record(FileWriter *writer);
+static void delta_record(FileWriter *writer);
+static void next_record(FileWriter *writer);
+static int safe_relative_path(const char *path);
+static void make_parents(char *path);
+
+FileWriter* create_file_writer(int fd, int slot_size, int direct, int sync_range) {
+    FileWriter *writer = alloc_writer(slot_size);
+    if (!writer) return NULL;
+
+    writer->fd = fd;
+    writer->sync_range = sync_range;
+    if (direct) {
+        int flags = fcntl(fd, F_GETFL);
+        if (fcntl(fd, F_SETFL, flags | O_DIRECT) == 0) {
+            writer->direct = 1;
+        } else {
+            perror("O_DIRECT not available, using buffered writes");
+        }
+    }
+
+    start_writer(writer);
+    return writer;
+}
+
+FileWriter* create_tree_writer(const char *root, int slot_size, int sync_range) {
+    FileWriter *writer = alloc_writer(slot_size);
+    if (!writer) return NULL;
+
+    if (mkdir(root, 0755) < 0 && errno != EEXIST) {
+        perror(root);
+        free(writer->block);
+        free(writer->slots);
+        free(writer);
+        return NULL;
+    }
+    writer->fd = -1;
+    writer->sync_range = sync_range;
+    writer->tree = 1;
+    writer->record_need = 1;
+    snprintf(writer->root, sizeof(writer->root), "%s", root);
+
+    start_writer(writer);
+    return writer;
+}
+
+FileWriter* create_delta_writer(int fd, int basis_fd, uint32_t block_size, int slot_size, int sync_range) {
+    FileWriter *writer = alloc_writer(slot_size);
+    if (!writer) return NULL;
+
+    writer->basis_buffer = malloc(block_size);
+    if (!writer->basis_buffer) {
+        free(writer->block);
+        free(writer->slots);
+        free(writer);
+        return NULL;
+    }
+    writer->fd = fd;
+    writer->basis_fd = basis_fd;
+    writer->basis_block = block_size;
+    writer->sync_range = sync_range;
+    writer->delta = 1;
+    writer->record_need = 1;
+    sha256_init(&writer->digest);
+
+    start_writer(writer);
+    return writer;
+}
+
+// Must be called before the first queue_packed().
+int enable_decompression(FileWriter *writer) {
+    writer->codec = create_decompressor(writer->slot_size - sizeof(int));
+    return writer->codec ? 0 : -1;
+}
+
+void queue_write(FileWriter *writer, const uint8_t *data, int length) {
+    if (length > 0)
+        put_slot(writer, data, length);
+}
+
+void queue_packed(FileWriter *writer, const uint8_t *data, int length) {
+    if (length > 0)
+        put_slot(writer, data, length | SLOT_PACKED);
+}
+
+int close_file_writer(FileWriter *writer, WriterStats *stats) {
+    if (!writer) return 0;
+    put_slot(writer, NULL, SLOT_CLOSE);
+    pthread_join(writer->thread, NULL);
+    if (stats) {
+        stats->files = writer->files;
+        stats->bytes = writer->bytes;
+        stats->reused = writer->reused;
+    }
+
+    // a record stream that stopped early did not arrive complete
+    int error = writer->error || ((writer->tree || writer->delta) && !writer->stream_done);
+    sem_destroy(&writer->items);
+    sem_destroy(&writer->spaces);
+    free_decompressor(writer->codec);
+    free(writer->basis_buffer);
+    free(writer->block);
+    free(writer->slots);
+    free(writer);
+    return error;
+}
+
+static FileWriter* alloc_writer(int slot_size) {
+    FileWriter *writer = calloc(1, sizeof(FileWriter));
+    if (!writer) return NULL;
+
+    // each slot holds its length followed by up to slot_size bytes
+    writer->slot_size = sizeof(int) + slot_size;
+    writer->slots = malloc((size_t)WRITE_QUEUE_SLOTS * writer->slot_size);
+    if (!writer->slots) { free(writer); return NULL; }
+    if (posix_memalign((void **)&writer->block, WRITE_BLOCK_ALIGN, WRITE_BLOCK_SIZE)) {
+        free(writer->slots);
+        free(writer);
+        return NULL;
+    }
+    return writer;
+}
+
+static void start_writer(FileWriter *writer) {
+    atomic_init(&writer->head, 0);
+    atomic_init(&writer->tail, 0);
+    sem_init(&writer->items, 0, 0);
+    sem_init(&writer->spaces, 0, WRITE_QUEUE_SLOTS);
+    if (pthread_create(&writer->thread, NULL, writer_thread, writer)) {
+        perror("pthread_create");
+        exit(-1);
+    }
+}
+
+static void put_slot(FileWriter *writer, const uint8_t *data, int length) {
+    // blocks only when the writer is a full queue behind
+    sem_wait(&writer->spaces);
+    unsigned head = atomic_load_explicit(&writer->head, memory_order_relaxed);
+    uint8_t *slot = writer->slots + (size_t)(head % WRITE_QUEUE_SLOTS) * writer->slot_size;
+    memcpy(slot, &length, sizeof(int));
+    if (length > 0)
+        memcpy(slot + sizeof(int), data, length & ~SLOT_PACKED);
+    atomic_store_explicit(&writer->head, head + 1, memory_order_release);
+    sem_post(&writer->items);
+}
+
+static void *writer_thread(void *arg) {
+    FileWriter *writer = arg;
+
+    while (1) {
+        sem_wait(&writer->items);
+        unsigned tail = atomic_load_explicit(&writer->tail, memory_order_relaxed);
+        unsigned head = atomic_load_explicit(&writer->head, memory_order_acquire);
+
+        // drain everything published so far before waiting again
+        int closing = 0;
+        unsigned taken = 0;
+        while (tail != head) {
+            uint8_t *slot = writer->slots + (size_t)(tail % WRITE_QUEUE_SLOTS) * writer->slot_size;
+            int length = 0;
+            memcpy(&length, slot, sizeof(int));
+            if (length == SLOT_CLOSE) {
+                closing = 1;
+            } else {
+                consume_slot(writer, slot + sizeof(int), length);
+            }
+            tail++;
+            taken++;
+            atomic_store_explicit(&writer->tail, tail, memory_order_release);
+            sem_post(&writer->spaces);
+        }
+        // items was decremented once above, account for the rest we drained
+        while (taken > 1) {
+            sem_wait(&writer->items);
+            taken--;
+        }
+        if (closing) break;
+    }
+
+    flush_stage(writer);
+    if (writer->tree && writer->fd >= 0) {
+        close(writer->fd);
+        writer->fd = -1;
+    }
+    return NULL;
+}
+
+static void consume_slot(FileWriter *writer, const uint8_t *data, int length) {
+    if (!(length & SLOT_PACKED)) {
+        consume_bytes(writer, data, length);
+        return;
+    }
+    length &= ~SLOT_PACKED;
+    if (!writer->codec) {
+        printf("Compressed payload without a decompressor\n");
+        writer->error = 1;
+        return;
+    }
+    size_t rawLength = 0;
+    const uint8_t *raw = decompress_payload(writer->codec, data, length, &rawLength);
+    if (raw == NULL) {
+        printf("Corrupt compressed payload\n");
+        writer->error = 1;
+        return;
+    }
+    consume_bytes(writer, raw, rawLength);
+}
+
+static void consume_bytes(FileWriter *writer, const uint8_t *data, size_t length) {
+    if (writer->tree || writer->delta)
+        parse_records(writer, data, length);
+    else
+        stage_bytes(writer, data, length);
+}
+
+static void stage_bytes(FileWriter *writer, const uint8_t *data, size_t length) {
+    writer->bytes += length;
+    if (writer->delta) sha256_update(&writer->digest, data, length);
+    while (length > 0) {
+        size_t room = WRITE_BLOCK_SIZE - writer->fill;
+        size_t chunk = (length < room) ? length : room;
+        memcpy(writer->block + writer->fill, data, chunk);
+        writer->fill += chunk;
+        data += chunk;
+        length -= chunk;
+        if (writer->fill == WRITE_BLOCK_SIZE)
+            write_block(writer, WRITE_BLOCK_SIZE);
+    }
+}
+
+static void flush_stage(FileWriter *writer) {
+    if (writer->fill == 0) return;
+
+    // the tail is not block aligned, so it cannot go out O_DIRECT
+    if (writer->direct) {
+        int flags = fcntl(writer->fd, F_GETFL);
+        fcntl(writer->fd, F_SETFL, flags & ~O_DIRECT);
+        writer->direct = 0;
+    }
+    write_block(writer, writer->fill);
+}
+
+static void write_block(FileWriter *writer, size_t length) {
+    size_t done = 0;
+    while (writer->fd >= 0 && done < length) {
+        ssize_t put = write(writer->fd, writer->block + done, length - done);
+        if (put < 0 && errno == EINTR) continue;
+        if (put < 0) {
+            perror("write");
+            writer->error = 1;
+            break;
+        }
+        done += put;
+    }
+
+    if (writer->sync_range && done > 0) {
+        // start writeback of this block and wait for the one before it, so
+        // at most two blocks of dirty pages are outstanding
+        sync_file_range(writer->fd, writer->written, done, SYNC_FILE_RANGE_WRITE);
+        if (writer->written >= WRITE_BLOCK_SIZE) {
+            sync_file_range(writer->fd, writer->written - WRITE_BLOCK_SIZE, WRITE_BLOCK_SIZE,
+                SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+        }
+    }
+    writer->written += done;
+    writer->fill = 0;
+}
+
+// Tree and delta streams interleave record headers and file bytes (see
+// filereader.h, delta.h). Headers are collected in record[] until complete,
+// file bytes are staged.
+static void parse_records(FileWriter *writer, const uint8_t *data, size_t length) {
+    while (length > 0 && !writer->stream_done) {
+        if (writer->remaining > 0) {
+            size_t chunk = (length < writer->remaining) ? length : writer->remaining;
+            stage_bytes(writer, data, chunk);
+            data += chunk;
+            length -= chunk;
+            writer->remaining -= chunk;
+            if (writer->remaining == 0) next_record(writer);
+            continue;
+        }
+
+        size_t chunk = writer->record_need - writer->record_fill;
+        if (chunk > length) chunk = length;
+        memcpy(writer->record + writer->record_fill, data, chunk);
+        writer->record_fill += chunk;
+        data += chunk;
+        length -= chunk;
+        if (writer->record_fill == writer->record_need) next_record(writer);
+    }
+}
+
+static void next_record(FileWriter *writer) {
+    if (writer->delta)
+        delta_record(writer);
+    else
+        tree_record(writer);
+}
+
+// Called whenever the current piece of the record is complete.
+static void tree_record(FileWriter *writer) {
+    uint8_t type = writer->record[0];
+    char path[2 * PATH_MAX + 1];
+
+    if (writer->record_need == 0) {
+        // end of a file's bytes
+        flush_stage(writer);
+        close(writer->fd);
+        writer->fd = -1;
+        writer->record_need = 1;
+        return;
+    }
+
+    if (writer->record_need == 1) {
+        if (type == TREE_END) {
+            writer->stream_done = 1;
+        } else if (type == TREE_DIR || type == TREE_FILE || type == TREE_DAMAGED) {
+            writer->record_need = 3;
+        } else {
+            printf("Corrupt tree stream (record %d)\n", type);
+            writer->error = 1;
+            writer->stream_done = 1;
+        }
+        return;
+    }
+
+    uint16_t pathLength = 0;
+    memcpy(&pathLength, writer->record + 1, 2);
+    pathLength = ntohs(pathLength);
+    if (writer->record_need == 3) {
+        if (pathLength == 0 || pathLength >= PATH_MAX || 3 + pathLength + 8 > sizeof(writer->record)) {
+            printf("Corrupt tree stream (path length %u)\n", pathLength);
+            writer->error = 1;
+            writer->stream_done = 1;
+            return;
+        }
+        writer->record_need = 3 + pathLength + ((type == TREE_FILE) ? 8 : 0);
+        return;
+    }
+
+    char name[PATH_MAX];
+    memcpy(name, writer->record + 3, pathLength);
+    name[pathLength] = '\0';
+    snprintf(path, sizeof(path), "%s/%s", writer->root, name);
+    writer->record_fill = 0;
+    writer->record_need = 1;
+
+    int safe = safe_relative_path(name);
+    if (!safe) {
+        printf("Skipping unsafe path in tree: %s\n", name);
+        writer->error = 1;
+    }
+
+    if (type == TREE_DAMAGED) {
+        // the zero padded copy before this record is not the file
+        printf("Source file changed while it was sent: %s\n", name);
+        if (safe && unlink(path) == 0) writer->files--;
+        writer->error = 1;
+        return;
+    }
+
+    if (type == TREE_DIR) {
+        if (safe) {
+            make_parents(path);
+            if (mkdir(path, 0755) < 0 && errno != EEXIST) perror(path);
+        }
+        return;
+    }
+
+    uint32_t sizeNW[2];
+    memcpy(sizeNW, writer->record + 3 + pathLength, 8);
+    writer->remaining = ((uint64_t)ntohl(sizeNW[0]) << 32) | ntohl(sizeNW[1]);
+    writer->written = 0;
+    writer->fd = -1;
+    if (safe) {
+        make_parents(path);
+        writer->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (writer->fd < 0) {
+            perror(path);
+            writer->error = 1;
+        }
+    }
+    writer->files++;
+
+    // file bytes follow, an empty file is already complete
+    writer->record_need = 0;
+    if (writer->remaining == 0) tree_record(writer);
+}
+
+// Same calling convention as tree_record().
+static void delta_record(FileWriter *writer) {
+    uint8_t type = writer->record[0];
+
+    if (writer->record_need == 0) {
+        // end of a literal
+        writer->record_need = 1;
+        return;
+    }
+
+    if (writer->record_need == 1) {
+        if (type == DELTA_END) {
+            writer->record_need = 1 + DELTA_DIGEST_SIZE;
+        } else if (type == DELTA_LITERAL || type == DELTA_COPY) {
+            writer->record_need = 5;
+        } else {
+            printf("Corrupt delta stream (record %d)\n", type);
+            writer->error = 1;
+            writer->stream_done = 1;
+        }
+        return;
+    }
+
+    if (type == DELTA_END) {
+        // old blocks and literals must add up to exactly the file that was sent
+        uint8_t digest[SHA256_SIZE];
+        sha256_final(&writer->digest, digest);
+        if (memcmp(digest, writer->record + 1, DELTA_DIGEST_SIZE) != 0) {
+            printf("Delta result does not match the sent file, the old file is kept\n");
+            writer->error = 1;
+        }
+        writer->stream_done = 1;
+        return;
+    }
+
+    uint32_t valueNW = 0;
+    memcpy(&valueNW, writer->record + 1, 4);
+    uint32_t value = ntohl(valueNW);
+    writer->record_fill = 0;
+    writer->record_need = 1;
+
+    if (type == DELTA_LITERAL) {
+        writer->remaining = value;
+        writer->record_need = 0;
+        if (writer->remaining == 0) delta_record(writer);
+        return;
+    }
+
+    // block the receiver already has, copy it over from the old file
+    ssize_t got = pread(writer->basis_fd, writer->basis_buffer, writer->basis_block,
+        (off_t)value * writer->basis_block);
+    if (got != (ssize_t)writer->basis_block) {
+        printf("Old file changed during delta (block %u)\n", value);
+        writer->error = 1;
+        return;
+    }
+    stage_bytes(writer, writer->basis_buffer, writer->basis_block);
+    writer->reused += writer->basis_block;
+}
+
+static int safe_relative_path(const char *path) {
+    if (path[0] == '/') return 0;
+    const char *part = path;
+    while (part != NULL) {
+        if (strncmp(part, "..", 2) == 0 && (part[2] == '/' || part[2] == '\0')) return 0;
+        part = strchr(part, '/');
+        if (part != NULL) part++;
+    }
+    return 1;
+}
+
+static void make_parents(char *path) {
+    char *slash = strchr(path + 1, '/');
+    while (slash != NULL) {
+        *slash = '\0';
+        mkdir(path, 0755);
+        *slash = '/';
+        slash = strchr(slash + 1, '/');
+    }
+}
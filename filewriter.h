@@ -0,0 +1,73 @@
+#ifndef FILE_WRITER_H
+#define FILE_WRITER_H
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/types.h>
+#include <limits.h>
+#include "compress.h"
+#include "sha256.h"
+
+#define WRITE_QUEUE_SLOTS 1024          // payloads in flight to the writer thread
+#define WRITE_BLOCK_SIZE (1024 * 1024)  // bytes per write() to the file
+#define WRITE_BLOCK_ALIGN 4096
+
+// Record types of a directory tree stream, must match filereader.h
+#define TREE_DIR 'D'
+#define TREE_FILE 'F'
+#define TREE_END 'E'
+#define TREE_DAMAGED 'X'
+
+typedef struct WriterStats {
+    uint64_t files;     // files created from a tree stream
+    uint64_t bytes;     // bytes written out
+    uint64_t reused;    // of those, bytes copied from the old file by a delta
+} WriterStats;
+
+// Single producer (receive loop) / single consumer (writer thread) ring of
+// payload slots. The writer coalesces them into large aligned writes.
+typedef struct FileWriter {
+    int fd;
+    uint8_t *slots;
+    int slot_size;
+    atomic_uint head;   // next slot the receive loop fills
+    atomic_uint tail;   // next slot the writer drains
+    sem_t items;        // filled slots, only used to block the writer
+    sem_t spaces;       // free slots, only used to block the receive loop
+    uint8_t *block;     // aligned staging block
+    size_t fill;
+    int direct;         // file is open O_DIRECT
+    int sync_range;     // keep dirty pages bounded with sync_file_range()
+    off_t written;
+    int error;
+    pthread_t thread;
+    int tree;               // stream is a directory tree unpacked under root
+    char root[PATH_MAX];
+    uint8_t record[3 + PATH_MAX + 8];
+    size_t record_fill;
+    size_t record_need;     // bytes of the record piece being collected, 0 = file bytes
+    uint64_t remaining;     // bytes left of the current file
+    uint64_t files;
+    int stream_done;        // end record of a tree or delta stream seen
+    int delta;              // stream is a delta against basis_fd
+    int basis_fd;
+    uint32_t basis_block;
+    uint8_t *basis_buffer;
+    uint64_t bytes;
+    uint64_t reused;
+    Sha256 digest;          // of the bytes a delta stream has produced so far
+    Decompressor *codec;    // for the slots queued packed
+} FileWriter;
+
+FileWriter* create_file_writer(int fd, int slot_size, int direct, int sync_range);
+FileWriter* create_tree_writer(const char *root, int slot_size, int sync_range);
+FileWriter* create_delta_writer(int fd, int basis_fd, uint32_t block_size, int slot_size, int sync_range);
+int enable_decompression(FileWriter *writer);
+void queue_write(FileWriter *writer, const uint8_t *data, int length);
+// A payload in compress.h's framing, unpacked by the writer thread.
+void queue_packed(FileWriter *writer, const uint8_t *data, int length);
+int close_file_writer(FileWriter *writer, WriterStats *stats);
+
+#endif // FILE_WRITER_H
@@ -15,6 +15,7 @@
 #include <stdint.h>
 
 #include "../utils/dbg_print.h"
+#include "../utils/Xoshiro256.h"
 // ============================================================================
 #define MSG_PRINT_LEVEL DBG_LEVEL_INFO
 #define MSG_PRINT(FMT, ...) DBG_PRINT(MSG_PRINT_LEVEL, FMT , ##__VA_ARGS__);
@@ -36,8 +37,12 @@ class IMsgEvent
      *    0  No change
      *    1  Change
      *    2  Drop Completely
+     *
+     * random is the sending session's stream, events that need chance draw
+     * from it (drand48() when NULL).
      */
-    virtual int run(void** pBuf, size_t* pLen, uint32_t msgNo, bool isSend = true) = 0;
+    virtual int run(void** pBuf, size_t* pLen, uint32_t msgNo, bool isSend = true,
+                    Xoshiro256* random = NULL) = 0;
 
     virtual int report(void) = 0;
 
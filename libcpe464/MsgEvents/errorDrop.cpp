@@ -3,11 +3,13 @@
 
 #include <stdio.h>
 #include <arpa/inet.h>
+#include <algorithm>
 // ============================================================================
 static const char * __classname = "errorDrop";
 // ============================================================================
 errorDrop::errorDrop() :
-    m_DropAll(true)
+    m_DropAll(true),
+    m_Cursor(0)
 {
 }
 // ============================================================================
@@ -19,14 +21,108 @@ int errorDrop::setDropAll(bool dropAll)
 }
 // ============================================================================
 int errorDrop::setDropSpecific(DropList_t& dropList)
+{
+    DropSpans_t dropSpans;
+    for (DropList_t::iterator it = dropList.begin(); it != dropList.end(); ++it)
+    {
+        DropSpan_t span = {*it, *it, 1};
+        dropSpans.push_back(span);
+    }
+
+    return setDropSpans(dropSpans);
+}
+// ============================================================================
+static bool spanStartsFirst(const errorDrop::DropSpan_t& a, const errorDrop::DropSpan_t& b)
+{
+    return a.first < b.first;
+}
+// ============================================================================
+int errorDrop::setDropSpans(DropSpans_t& dropSpans)
 {
     m_DropAll = false;
-    m_DropList = dropList;
+    m_DropSpans.clear();
+    m_Cursor = 0;
+
+    DropSpans_t sorted = dropSpans;
+    std::stable_sort(sorted.begin(), sorted.end(), spanStartsFirst);
+
+    // every place a span starts or ends, the pieces between them are
+    // covered by the same spans from end to end
+    std::vector<uint32_t> cuts;
+    for (size_t i = 0; i < sorted.size(); ++i)
+    {
+        cuts.push_back(sorted[i].first);
+        if (sorted[i].last != UINT32_MAX)
+        {
+            cuts.push_back(sorted[i].last + 1);
+        }
+    }
+    std::sort(cuts.begin(), cuts.end());
+    cuts.erase(std::unique(cuts.begin(), cuts.end()), cuts.end());
+
+    DropSpans_t active;
+    size_t next = 0;
+    for (size_t k = 0; k < cuts.size(); ++k)
+    {
+        uint32_t from = cuts[k];
+        uint32_t to = (k + 1 < cuts.size()) ? cuts[k + 1] - 1 : UINT32_MAX;
+
+        for (size_t i = 0; i < active.size(); )
+        {
+            if (active[i].last < from)
+            {
+                active.erase(active.begin() + i);
+            }
+            else
+            {
+                ++i;
+            }
+        }
+        while ((next < sorted.size()) && (sorted[next].first == from))
+        {
+            active.push_back(sorted[next++]);
+        }
+
+        bool all = false;
+        for (size_t i = 0; i < active.size(); ++i)
+        {
+            all = all || (active[i].stride == 1);
+        }
+
+        if (all)
+        {
+            DropSpan_t* prev = m_DropSpans.empty() ? NULL : &m_DropSpans.back();
+            if ((prev != NULL) && (prev->stride == 1) && (prev->last + 1 == from))
+            {
+                prev->last = to;
+            }
+            else
+            {
+                DropSpan_t piece = {from, to, 1};
+                m_DropSpans.push_back(piece);
+            }
+            continue;
+        }
+
+        // each strided span from its first drop in the piece on
+        size_t group = m_DropSpans.size();
+        for (size_t i = 0; i < active.size(); ++i)
+        {
+            const DropSpan_t& span = active[i];
+            uint64_t hit = span.first + ((uint64_t)from - span.first + span.stride - 1) / span.stride * span.stride;
+            if (hit <= to)
+            {
+                DropSpan_t piece = {(uint32_t)hit, to, span.stride};
+                m_DropSpans.push_back(piece);
+            }
+        }
+        std::stable_sort(m_DropSpans.begin() + group, m_DropSpans.end(), spanStartsFirst);
+    }
 
     return 0;
 }
 // ============================================================================
-int errorDrop::run(void** pBuf, size_t* pLen, uint32_t msgNo, bool isSend)
+int errorDrop::run(void** pBuf, size_t* pLen, uint32_t msgNo, bool isSend, Xoshiro256* random)
 {
     if ((pBuf == NULL) || (*pBuf == NULL))
     {
@@ -36,15 +132,16 @@ int errorDrop::run(void** pBuf, size_t* pLen, uint32_t msgNo, bool isSend)
 
     bool toDrop = m_DropAll;
 
-    DropList_t::iterator it = m_DropList.begin();
-    while (it != m_DropList.end())
+    // msgNo only grows, a span that ended before it never matches again
+    while ((m_Cursor < m_DropSpans.size()) && (m_DropSpans[m_Cursor].last < msgNo))
     {
-        if (*it == msgNo)
-        {
-            toDrop = true;
-            break;
-        }
-        ++it;
+        ++m_Cursor;
+    }
+
+    for (size_t i = m_Cursor; !toDrop && (i < m_DropSpans.size()) && (m_DropSpans[i].first <= msgNo); ++i)
+    {
+        const DropSpan_t& span = m_DropSpans[i];
+        toDrop = (msgNo <= span.last) && ((msgNo - span.first) % span.stride == 0);
     }
 
     if (toDrop)
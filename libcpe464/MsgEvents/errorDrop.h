@@ -4,6 +4,14 @@
  * General use would have a errorDrop with DropAll for random cases
  * and a drop list should a specific sequence of drops to occur using
  * the standard list within the PacketManager
+ *
+ * The drop list is kept as spans of message numbers (first, last, stride)
+ * sorted by their first message. Overlapping spans are merged when the list
+ * is set, so no span reaches past the start of a later one and the ends
+ * grow along with the starts. Strided spans that overlap stay side by side
+ * over the same range. Message numbers only grow, so a cursor skips the
+ * spans that are over and a lookup only looks at the spans that are under
+ * way, however long the list is.
  */
 
 #ifndef __MSGERROR_DROP_H
@@ -14,12 +22,21 @@
 
 #include <stdint.h>
 #include <list>
+#include <vector>
 // ============================================================================
 class errorDrop : public IMsgEvent
 {
 	public:
     typedef std::list<uint32_t> DropList_t;
 
+    typedef struct _DropSpan
+    {
+        uint32_t first;
+        uint32_t last;      // UINT32_MAX for open ended
+        uint32_t stride;    // 1 drops every message in [first, last]
+    } DropSpan_t;
+    typedef std::vector<DropSpan_t> DropSpans_t;
+
     errorDrop();
     virtual ~errorDrop() {};
 
@@ -27,6 +44,8 @@ class errorDrop : public IMsgEvent
 
     int setDropSpecific(DropList_t& dropList);
 
+    int setDropSpans(DropSpans_t& dropSpans);
+
     /**
      * Function to be called when running the event case.
      *
@@ -40,15 +59,17 @@ class errorDrop : public IMsgEvent
      *    1  Change
      *    2  Drop Completely
      */
-    virtual int run(void** pBuf, size_t* pLen, uint32_t seqno, bool isSend);
+    virtual int run(void** pBuf, size_t* pLen, uint32_t seqno, bool isSend,
+                    Xoshiro256* random = NULL);
 
     virtual int report(void);
 
     virtual const char* getName(void);
 
   private:
-    bool       m_DropAll;
-    DropList_t m_DropList;
+    bool        m_DropAll;
+    DropSpans_t m_DropSpans;
+    size_t      m_Cursor;       // first span that has not ended yet
 };
 
 #endif
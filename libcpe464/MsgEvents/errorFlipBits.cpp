@@ -6,7 +6,7 @@
 // ============================================================================
 static const char * __classname = "errorFlipBits";
 // ============================================================================
-int errorFlipBits::run(void** pBuf, size_t* pLen, uint32_t msgNo, bool isSend)
+int errorFlipBits::run(void** pBuf, size_t* pLen, uint32_t msgNo, bool isSend, Xoshiro256* random)
 {
     if ((pBuf == NULL) || (*pBuf == NULL))
     {
@@ -19,7 +19,7 @@ int errorFlipBits::run(void** pBuf, size_t* pLen, uint32_t msgNo, bool isSend)
     MSG_PRINT(" - FLIPPED BITS ");
     
     double d_len = *pLen;
-    int byte_to_flip = (int)(d_len * drand48());
+    int byte_to_flip = (int)(d_len * (random ? random->nextDouble() : drand48()));
 
     ((uint8_t*)*pBuf)[byte_to_flip] ^= 0xFF;
 
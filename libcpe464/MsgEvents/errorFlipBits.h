@@ -29,7 +29,8 @@ class errorFlipBits : public IMsgEvent
      *    1  Change
      *    2  Drop Completely
      */
-    virtual int run(void** pBuf, size_t* pLen, uint32_t seqno, bool isSend);
+    virtual int run(void** pBuf, size_t* pLen, uint32_t seqno, bool isSend,
+                    Xoshiro256* random = NULL);
 
     virtual int report(void);
 
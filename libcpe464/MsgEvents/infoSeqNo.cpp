@@ -2,13 +2,23 @@
 #include "infoSeqNo.h"
 
 #include <stdio.h>
+#include <string.h>
 #include <arpa/inet.h>
 // ============================================================================
 static const char * __classname = "infoSeqNo";
 // ============================================================================
 infoSeqNo::infoSeqNo() :
-    m_ValidEndian(true)
+    m_ValidEndian(true),
+    m_Total(0),
+    m_Unique(0),
+    m_Resent(0),
+    m_Outliers(0),
+    m_Highest(0),
+    m_Jump(0),
+    m_Jumped(false)
 {
+    memset(m_Seen, 0, sizeof(m_Seen));
+    memset(m_Repeated, 0, sizeof(m_Repeated));
 }
 // ============================================================================
 infoSeqNo::~infoSeqNo()
@@ -16,7 +26,7 @@ infoSeqNo::~infoSeqNo()
     this->report();
 }
 // ============================================================================
-int infoSeqNo::run(void** pBuf, size_t* pLen, uint32_t msgNo, bool isSend)
+int infoSeqNo::run(void** pBuf, size_t* pLen, uint32_t msgNo, bool isSend, Xoshiro256* random)
 {
     if ((pBuf == NULL) || (*pBuf == NULL))
     {
@@ -30,18 +40,101 @@ int infoSeqNo::run(void** pBuf, size_t* pLen, uint32_t msgNo, bool isSend)
     
     //MSG_PRINT("MSG# %u SEQ# %u\n", msgNo, seqNo); 
 
-    m_History.push_back(seqNo);
+    ++m_Total;
 
-    ++m_Count[seqNo];
+    if (seqNo > m_Highest && (seqNo / 64) - (m_Highest / 64) >= SEQNO_TRACKED_WORDS)
+    {
+        // a jump past the window, only a higher one near it moves the window
+        bool confirmed = m_Jumped && seqNo > m_Jump &&
+            (seqNo / 64) - (m_Jump / 64) < SEQNO_TRACKED_WORDS;
+        if (!confirmed)
+        {
+            m_Jump = seqNo;
+            m_Jumped = true;
+            ++m_Outliers;
+            return 0;
+        }
+        advance(seqNo);
+        m_Jumped = false;
+        // the jump that went first is inside the window now
+        if (mark(m_Jump))
+        {
+            --m_Outliers;
+        }
+    }
+    else if (seqNo > m_Highest)
+    {
+        advance(seqNo);
+    }
+    else if ((m_Highest / 64) - (seqNo / 64) >= SEQNO_TRACKED_WORDS)
+    {
+        ++m_Outliers;
+        return 0;
+    }
 
+    mark(seqNo);
     return 0;
 }
 // ============================================================================
+bool infoSeqNo::mark(uint32_t seqNo)
+{
+    // true the first time seqNo is seen
+    uint32_t word = (seqNo / 64) % SEQNO_TRACKED_WORDS;
+    uint64_t bit = 1ULL << (seqNo % 64);
+
+    if (!(m_Seen[word] & bit))
+    {
+        m_Seen[word] |= bit;
+        ++m_Unique;
+        return true;
+    }
+    if (!(m_Repeated[word] & bit))
+    {
+        m_Repeated[word] |= bit;
+        ++m_Resent;
+    }
+    return false;
+}
+// ============================================================================
+void infoSeqNo::advance(uint32_t seqNo)
+{
+    // clear the words the window slides onto, they still hold old numbers
+    uint32_t from = m_Highest / 64 + 1;
+    uint32_t to = seqNo / 64;
+
+    if (to >= from && to - from >= SEQNO_TRACKED_WORDS)
+    {
+        memset(m_Seen, 0, sizeof(m_Seen));
+        memset(m_Repeated, 0, sizeof(m_Repeated));
+    }
+    else
+    {
+        for (uint32_t i = from; i <= to; ++i)
+        {
+            m_Seen[i % SEQNO_TRACKED_WORDS] = 0;
+            m_Repeated[i % SEQNO_TRACKED_WORDS] = 0;
+        }
+    }
+
+    m_Highest = seqNo;
+}
+// ============================================================================
 int infoSeqNo::report(void)
 {
     fprintf(stderr, "======== SeqNo Report ========\n");
-    fprintf(stderr, "  Msgs (Total)       : %5lu\n", m_History.size());
-    fprintf(stderr, "  Msgs (Unique SeqNo): %5lu\n", m_Count.size());
+    uint64_t repeats = m_Total - m_Unique - m_Outliers;
+
+    fprintf(stderr, "  Msgs (Total)       : %5llu\n", (unsigned long long)m_Total);
+    fprintf(stderr, "  Msgs (Unique SeqNo): %5llu\n", (unsigned long long)m_Unique);
+    fprintf(stderr, "  Msgs (Duplicates)  : %5llu  %6.2f%% of total\n",
+        (unsigned long long)repeats, m_Total ? 100.0 * repeats / m_Total : 0.0);
+    fprintf(stderr, "  SeqNo (Resent)     : %5llu  %6.2f%% of unique\n",
+        (unsigned long long)m_Resent, m_Unique ? 100.0 * m_Resent / m_Unique : 0.0);
+    if (m_Outliers)
+    {
+        fprintf(stderr, "  Msgs (Outliers)    : %5llu  more than %u away, not counted above\n",
+            (unsigned long long)m_Outliers, SEQNO_TRACKED_WORDS * 64);
+    }
     fprintf(stderr, "==============================\n");
 
     return 0;
@@ -1,13 +1,18 @@
 /**
- * infoSeqNo - maintains a log of all sequence numbers passed in
+ * infoSeqNo - counts the sequence numbers passed in
  *
  * No changes will be made to the buffers passed to this class, just count
  * the sequence numbers (which are assumed to be in the first 4-bytes of each
  * packet in network order.)
  *
- * Upon destruction, this class will call it's own report function in order.
+ * Memory is fixed: two bitmaps (seen, seen more than once) cover the
+ * SEQNO_TRACKED_WORDS * 64 sequence numbers up to the highest one so far
+ * and slide forward with it. A number outside of that, far behind or a jump
+ * far ahead, is an outlier: counted on its own, never as a duplicate, and a
+ * lone jump does not move the window. A second, higher number out there
+ * confirms the sender really moved on and the window starts over at it.
  *
- * TODO: Report better details about the history instead of unique + count
+ * Upon destruction, this class will call it's own report function in order.
  */
 
 #ifndef __IMSGEVENT_SEQNO_H
@@ -16,15 +21,13 @@
 // ============================================================================
 #include "IMsgEvent.h"
 
-#include <vector>
-#include <map>
+#include <stdint.h>
+// ============================================================================
+#define SEQNO_TRACKED_WORDS 1024    // 65536 sequence numbers, 16 KB
 // ============================================================================
 class infoSeqNo : public IMsgEvent
 {
 	public:
-    typedef std::map<uint32_t, uint32_t> No2Count_t;
-    typedef std::vector<uint32_t> NoJournal_t;
-
     infoSeqNo();
 		virtual ~infoSeqNo();
 
@@ -41,17 +44,28 @@ class infoSeqNo : public IMsgEvent
      *    1  Change
      *    2  Drop Completely
      */
-    virtual int run(void** pBuf, size_t* pLen, uint32_t seqno, bool isSend);
+    virtual int run(void** pBuf, size_t* pLen, uint32_t seqno, bool isSend,
+                    Xoshiro256* random = NULL);
 
     virtual int report(void);
 
     virtual const char* getName(void);
 
   private:
+    void advance(uint32_t seqNo);
+    bool mark(uint32_t seqNo);
+
     bool        m_ValidEndian;
 
-    No2Count_t  m_Count;
-    NoJournal_t m_History;
+    uint64_t    m_Total;
+    uint64_t    m_Unique;
+    uint64_t    m_Resent;       // sequence numbers sent more than once
+    uint64_t    m_Outliers;     // outside the window, in either direction
+    uint32_t    m_Highest;
+    uint32_t    m_Jump;         // last number far ahead of the window
+    bool        m_Jumped;
+    uint64_t    m_Seen[SEQNO_TRACKED_WORDS];
+    uint64_t    m_Repeated[SEQNO_TRACKED_WORDS];
 };
 // ============================================================================
 
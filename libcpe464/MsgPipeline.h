@@ -0,0 +1,175 @@
+/**
+ * MsgPipeline - a fixed set of MsgEvents, chosen at compile time
+ *
+ * PacketManager keeps its events in vectors of IMsgEvent pointers so they
+ * can be picked from the environment at run time, at the price of a virtual
+ * call per event per packet. When the set is known up front, list the event
+ * types instead:
+ *
+ *   MsgPipeline<infoSeqNo, ChanceEvents<errorDrop, errorFlipBits> > pipe;
+ *   pipe.event<ChanceEvents<errorDrop, errorFlipBits> >().setErrorRate(.1);
+ *   pipe.sendto(s, buf, len, 0, to, tolen);
+ *
+ * Events run in order with the same return codes as IMsgEvent::run. The
+ * calls are qualified, direct instead of through the vtable, so an event
+ * defined inline is inlined into the send. An empty pipeline,
+ * MsgPipeline<>, is the passthrough: sendto() is the bare ::sendto with no
+ * message count and no copy. C programs get the same with CPE464_PASSTHROUGH
+ * (see network-hooks.h).
+ *
+ * A pipeline is one sending session: it draws chance from its own
+ * Xoshiro256 stream, seeded by setRandSeed(seed, session).
+ */
+
+#ifndef __MSGPIPELINE_H
+#define __MSGPIPELINE_H
+
+// ============================================================================
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/socket.h>
+
+#include <tuple>
+
+#include "utils/Xoshiro256.h"
+// ============================================================================
+/**
+ * ChanceEvents - at the error rate, runs one of its events picked at random
+ *
+ * Draws the same way PacketManager::processEvents does for its random list,
+ * from drand48() when given no stream.
+ */
+template <class... Events>
+class ChanceEvents
+{
+  public:
+    ChanceEvents() : m_ErrorRate(0.0f) {}
+
+    void setErrorRate(float rate) { m_ErrorRate = rate; }
+
+    template <class Event>
+    Event& event(void) { return std::get<Event>(m_Events); }
+
+    int run(void** pBuf, size_t* pLen, uint32_t msgNo, bool isSend = true,
+            Xoshiro256* random = NULL)
+    {
+        float randNum = random ? random->nextDouble() : drand48();
+        if ((sizeof...(Events) == 0) || (randNum > m_ErrorRate))
+        {
+            return 0;
+        }
+
+        double pick = random ? random->nextDouble() : drand48();
+        int randCase = (int)((float)sizeof...(Events) * pick);
+        return runCase<0>(randCase, pBuf, pLen, msgNo, isSend, random);
+    }
+
+  private:
+    template <size_t I>
+    int runCase(int randCase, void** pBuf, size_t* pLen, uint32_t msgNo, bool isSend,
+                Xoshiro256* random)
+    {
+        if constexpr (I == sizeof...(Events))
+        {
+            return 0;
+        }
+        else
+        {
+            typedef typename std::tuple_element<I, std::tuple<Events...> >::type Event_t;
+            if ((int)I == randCase)
+            {
+                return std::get<I>(m_Events).Event_t::run(pBuf, pLen, msgNo, isSend, random);
+            }
+            return runCase<I + 1>(randCase, pBuf, pLen, msgNo, isSend, random);
+        }
+    }
+
+    float                 m_ErrorRate;
+    std::tuple<Events...> m_Events;
+};
+// ============================================================================
+template <class... Events>
+class MsgPipeline
+{
+  public:
+    static const bool isPassthrough = (sizeof...(Events) == 0);
+
+    MsgPipeline() : m_MsgNo(0), m_Random(time(NULL)) {}
+
+    void setRandSeed(uint64_t seed, uint64_t session = 0) { m_Random.seed(seed, session); }
+
+    template <class Event>
+    Event& event(void) { return std::get<Event>(m_Events); }
+
+    /**
+     * Same contract as PacketManager::processEvents:
+     *   <0 Error, 0 No change, 1 Change, 2 Drop
+     */
+    int process(void** pBuf, size_t* pLen, uint32_t msgNo)
+    {
+        return runFrom<0>(pBuf, pLen, msgNo, false);
+    }
+
+    ssize_t sendto(int s, const void* buf, size_t len, int flags,
+                   const struct sockaddr* to, socklen_t tolen)
+    {
+        // (::sendto) is the socket call even where cpe464.h has sendto() hooked
+        if constexpr (isPassthrough)
+        {
+            return (::sendto)(s, buf, len, flags, to, tolen);
+        }
+        else
+        {
+            ++m_MsgNo;
+
+            // events may change the packet, never the caller's buffer
+            size_t lenTmp = len;
+            unsigned char bufTmp[len];
+            memcpy(bufTmp, buf, lenTmp);
+            void* pBuf = bufTmp;
+
+            int nResult = process(&pBuf, &lenTmp, m_MsgNo);
+            if (nResult < 0)
+            {
+                return nResult;
+            }
+            else if (nResult == 2)
+            {
+                // dropped, the caller sees it as sent
+                return len;
+            }
+
+            ssize_t lenSent = (::sendto)(s, pBuf, lenTmp, flags, to, tolen);
+            return (lenSent == (ssize_t)lenTmp) ? (ssize_t)len : lenSent;
+        }
+    }
+
+  private:
+    template <size_t I>
+    int runFrom(void** pBuf, size_t* pLen, uint32_t msgNo, bool hasChanged)
+    {
+        if constexpr (I == sizeof...(Events))
+        {
+            return hasChanged;
+        }
+        else
+        {
+            typedef typename std::tuple_element<I, std::tuple<Events...> >::type Event_t;
+            int nResult = std::get<I>(m_Events).Event_t::run(pBuf, pLen, msgNo, true, &m_Random);
+            if ((nResult < 0) || (nResult == 2))
+            {
+                return nResult;
+            }
+            return runFrom<I + 1>(pBuf, pLen, msgNo, hasChanged || (nResult == 1));
+        }
+    }
+
+    uint32_t              m_MsgNo;
+    Xoshiro256            m_Random;
+    std::tuple<Events...> m_Events;
+};
+// ============================================================================
+
+#endif
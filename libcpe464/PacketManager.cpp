@@ -33,9 +33,14 @@ extern "C" {
 #include <arpa/inet.h>
 // ============================================================================
 PacketManager::PacketManager() :
-    m_ErrorRate(0.0f), m_MsgNo(0)
+    m_ErrorRate(0.0f), m_MsgNo(0), m_Seed(time(NULL)), m_Generation(1)
 {
-    srand48(time(NULL));
+    for (int i = 0; i < PKTMGR_STREAMS; ++i)
+    {
+        m_Streams[i].session = 0;
+        m_Streams[i].generation = 0;
+        m_Streams[i].named = false;
+    }
 }
 // ============================================================================
 PacketManager::~PacketManager()
@@ -61,11 +66,38 @@ int PacketManager::clearMsgEvents(listMsgEvents_t& ErrVec)
 // ============================================================================
 int PacketManager::setRandSeed(long seed)
 {
-    srand48(seed);
+    m_Seed = seed;
+    ++m_Generation;
 
     return 0;
 }
 // ============================================================================
+int PacketManager::setSession(int s, uint64_t sessionId)
+{
+    Stream_t& entry = m_Streams[(s < 0) ? 0 : (s % PKTMGR_STREAMS)];
+    entry.session = sessionId;
+    entry.named = true;
+    entry.generation = 0;
+
+    return 0;
+}
+// ============================================================================
+Xoshiro256& PacketManager::stream(int s)
+{
+    Stream_t& entry = m_Streams[(s < 0) ? 0 : (s % PKTMGR_STREAMS)];
+    if (entry.generation != m_Generation)
+    {
+        if (!entry.named)
+        {
+            entry.session = (s < 0) ? 0 : s;
+        }
+        entry.random.seed(m_Seed, entry.session);
+        entry.generation = m_Generation;
+    }
+
+    return entry.random;
+}
+// ============================================================================
 int PacketManager::setErrorRate(float rate)
 {
     m_ErrorRate = rate;
@@ -97,7 +129,8 @@ int PacketManager::addMsgEvent_Random(IMsgEvent* msgErr)
     return 0;
 }
 // ============================================================================
-int PacketManager::runMsgEvents(listMsgEvents_t& ErrVec, void** pBuf, size_t* pLen, uint32_t msgNo)
+int PacketManager::runMsgEvents(listMsgEvents_t& ErrVec, void** pBuf, size_t* pLen, uint32_t msgNo,
+                                Xoshiro256& random)
 {
     if ((pBuf == NULL) || (*pBuf == NULL))
     {
@@ -110,7 +143,7 @@ int PacketManager::runMsgEvents(listMsgEvents_t& ErrVec, void** pBuf, size_t* pL
 
     for (uint i = 0; i < ErrVec.size(); ++i)
     {
-        nResult = ErrVec[i]->run(pBuf, pLen, msgNo);
+        nResult = ErrVec[i]->run(pBuf, pLen, msgNo, true, &random);
         if (nResult < 0)
         {
             ERR_PRINT("ErrorCase Run '%s' Failed", ErrVec[i]->getName());
@@ -129,7 +162,7 @@ int PacketManager::runMsgEvents(listMsgEvents_t& ErrVec, void** pBuf, size_t* pL
     return hasChanged;
 }
 // ============================================================================
-int PacketManager::processEvents(void** pBuf, size_t* pLen, uint32_t msgNo)
+int PacketManager::processEvents(void** pBuf, size_t* pLen, uint32_t msgNo, int s)
 {
     if ((pBuf == NULL) || (*pBuf == NULL))
     {
@@ -141,7 +174,9 @@ int PacketManager::processEvents(void** pBuf, size_t* pLen, uint32_t msgNo)
     bool hasChanged = false;
     bool hasDropped = false;
 
-    nResult = runMsgEvents(m_ErrorCase_Constant, pBuf, pLen, msgNo);
+    Xoshiro256& random = stream(s);
+
+    nResult = runMsgEvents(m_ErrorCase_Constant, pBuf, pLen, msgNo, random);
     if (nResult < 0)
     {
         return nResult;
@@ -157,12 +192,12 @@ int PacketManager::processEvents(void** pBuf, size_t* pLen, uint32_t msgNo)
 
  
   // Decide (based on error rate) if we should produce an error
-  float randNum = drand48();
+  float randNum = random.nextDouble();
   if ((m_ErrorCase_Chance.size() > 0) && (randNum <= m_ErrorRate))
   {
 	  // Chose which one to run
-	  int randCase = (int)((float)m_ErrorCase_Chance.size() * drand48());
-	  nResult = m_ErrorCase_Chance[randCase]->run(pBuf, pLen, msgNo);
+	  int randCase = (int)((float)m_ErrorCase_Chance.size() * random.nextDouble());
+	  nResult = m_ErrorCase_Chance[randCase]->run(pBuf, pLen, msgNo, true, &random);
 	  if (nResult < 0)
 	  {
 		  return nResult;
@@ -216,7 +251,7 @@ ssize_t PacketManager::send_Err(int s, void *buf, size_t len, int flags)
     memcpy(bufTmp, buf, lenTmp);
     void* pBuf = bufTmp;
 
-    nResult = processEvents((void**)&pBuf, &lenTmp, m_MsgNo);
+    nResult = processEvents((void**)&pBuf, &lenTmp, m_MsgNo, s);
     // Error Case
     if (nResult < 0)
     {
@@ -378,7 +413,7 @@ ssize_t PacketManager::sendto_Err(int s, void *buf, size_t len, int flags,
     memcpy(bufTmp, buf, lenTmp);
     void* pBuf = bufTmp;
 
-    nResult = processEvents((void**)&pBuf, &lenTmp, m_MsgNo);
+    nResult = processEvents((void**)&pBuf, &lenTmp, m_MsgNo, s);
     		
 
 	MSG_PRINT("\n");
@@ -411,7 +446,137 @@ ssize_t PacketManager::recvfrom_Mod(int s, void *buf, size_t len, int flags,
                    struct sockaddr *from, socklen_t *fromlen)
 {
     ssize_t ret = ::recvfrom(s, buf, len, flags, from, fromlen);
+    if (ret < 0)
+    {
+        // nothing received (e.g. MSG_DONTWAIT and an empty queue)
+        return ret;
+    }
 
+    printRecv(buf, ret);
+    return ret;
+}
+// ============================================================================
+ssize_t PacketManager::recvmsg_Mod(int s, struct msghdr *msg, int flags)
+{
+    ssize_t ret = ::recvmsg(s, msg, flags);
+    if (ret < 0 || msg->msg_iovlen < 1)
+    {
+        return ret;
+    }
+
+    printRecv(msg->msg_iov[0].iov_base, ret);
+    return ret;
+}
+// ============================================================================
+/*
+ * Each message goes through the events as if it were passed to sendto_Err,
+ * in order and numbered the same way, then the ones not dropped leave in a
+ * single sendmmsg(). Returns how many of the caller's messages are done,
+ * dropped ones included, so a short count points at the first one the
+ * kernel refused; -1 if that is the first.
+ */
+int PacketManager::sendmmsg_Err(int s, struct mmsghdr *msgs, unsigned int vlen, int flags)
+{
+    if (msgs == NULL)
+    {
+        ERR_PRINT("msgs pointer == NULL\n");
+        exit(1);
+    }
+
+    size_t total = 0;
+    unsigned int i = 0;
+    for (i = 0; i < vlen; i++)
+    {
+        total += msgs[i].msg_hdr.msg_iov[0].iov_len;
+    }
+    m_BatchData.resize(total);
+    m_BatchMsgs.resize(vlen);
+    m_BatchIov.resize(vlen);
+    m_BatchIndex.resize(vlen);
+
+    unsigned char* copy = m_BatchData.data();
+    unsigned int kept = 0;
+    unsigned int done = vlen;
+    for (i = 0; i < vlen; i++)
+    {
+        struct msghdr* hdr = &msgs[i].msg_hdr;
+        void* buf = hdr->msg_iov[0].iov_base;
+        size_t len = hdr->msg_iov[0].iov_len;
+        if ((buf == NULL) || (len == 0) || (hdr->msg_name == NULL))
+        {
+            ERR_PRINT("message %u: NULL pointer or len == 0\n", i);
+            exit(1);
+        }
+
+        ++m_MsgNo;
+
+        uint32_t seqNo = ntohl(*(uint32_t*)(buf));
+        uint8_t packetFlags = ((char *) buf)[6];
+        MSG_PRINT("SEND MSG# %3u SEQ# %3u LEN %4u FLAGS %2d ", m_MsgNo, seqNo, len, packetFlags);
+        printType(packetFlags, (char *)buf);
+
+        size_t lenTmp = len;
+        memcpy(copy, buf, lenTmp);
+        void* pBuf = copy;
+        copy += len;
+
+        int nResult = processEvents((void**)&pBuf, &lenTmp, m_MsgNo, s);
+
+        MSG_PRINT("\n");
+        msgs[i].msg_len = len;
+        if (nResult < 0)
+        {
+            ERR_PRINT("prcoessEvents\n");
+            done = i;
+            break;
+        }
+        else if (nResult == 2)
+        {
+            continue;
+        }
+
+        m_BatchIov[kept].iov_base = pBuf;
+        m_BatchIov[kept].iov_len = lenTmp;
+        m_BatchMsgs[kept].msg_hdr = *hdr;
+        m_BatchMsgs[kept].msg_hdr.msg_iov = &m_BatchIov[kept];
+        m_BatchMsgs[kept].msg_hdr.msg_iovlen = 1;
+        m_BatchIndex[kept] = i;
+        kept++;
+    }
+
+    unsigned int sent = 0;
+    while (sent < kept)
+    {
+        int nSent = ::sendmmsg(s, &m_BatchMsgs[sent], kept - sent, flags);
+        if (nSent < 0)
+        {
+            // errno is the kernel's for the caller's message m_BatchIndex[sent]
+            return (m_BatchIndex[sent] > 0) ? (int)m_BatchIndex[sent] : -1;
+        }
+        sent += nSent;
+    }
+
+    return (done > 0 || vlen == 0) ? (int)done : -1;
+}
+// ============================================================================
+int PacketManager::recvmmsg_Mod(int s, struct mmsghdr *msgs, unsigned int vlen, int flags,
+                                struct timespec *timeout)
+{
+    int ret = ::recvmmsg(s, msgs, vlen, flags, timeout);
+
+    int i = 0;
+    for (i = 0; i < ret; i++)
+    {
+        if (msgs[i].msg_hdr.msg_iovlen >= 1)
+        {
+            printRecv(msgs[i].msg_hdr.msg_iov[0].iov_base, msgs[i].msg_len);
+        }
+    }
+    return ret;
+}
+// ============================================================================
+void PacketManager::printRecv(void *buf, ssize_t ret)
+{
     uint32_t seqNo = ntohl(*(uint32_t*)(buf));
     uint8_t packetFlags = ((char *) buf)[6];
     MSG_PRINT("RECV          SEQ# %3u LEN %4u FLAGS %2d ", seqNo, ret, packetFlags);
@@ -424,8 +589,6 @@ ssize_t PacketManager::recvfrom_Mod(int s, void *buf, size_t len, int flags,
 	
 
 	MSG_PRINT("\n");
-
-    return ret;
 }
 // ============================================================================
 // ============================================================================
@@ -10,16 +10,26 @@
  * processed through this class. Currently MsgEvents have no affect on the
  * receive functions (however, this may be added later to provide info event
  * processing.)
+ *
+ * Chance is drawn from a random stream per socket, seeded from the base seed
+ * (setRandSeed) plus a session id: the socket number unless setSession names
+ * one. Sessions on different sockets never draw from the same state, so each
+ * sees the same losses on every run with the same seed, however their sends
+ * interleave, and threads need no lock. Sockets numbered PKTMGR_STREAMS and
+ * up share the streams below them.
  */
 
 #ifndef __PACKETMANAGER_H
 #define __PACKETMANAGER_H
 
 #include "MsgEvents/IMsgEvent.h"
+#include "utils/Xoshiro256.h"
 
 #include <sys/socket.h>
 #include <vector>
 
+#define PKTMGR_STREAMS 1024
+
 class PacketManager
 {
   public:
@@ -29,12 +39,13 @@ class PacketManager
     ~PacketManager();
 
     int setRandSeed(long seed);
+    int setSession(int s, uint64_t sessionId);
     int setErrorRate(float rate);
 
     int addMsgEvent_Standard(IMsgEvent* errorCase);
     int addMsgEvent_Random(IMsgEvent* errorCase);
 
-    int processEvents(void** pBuf, size_t* pLen, uint32_t msgNo);
+    int processEvents(void** pBuf, size_t* pLen, uint32_t msgNo, int s = -1);
 	
 	void printType(int flag, char * buf);
 	
@@ -48,16 +59,45 @@ class PacketManager
     ssize_t recvfrom_Mod(int s, void *buf, size_t len, int flags,
                     struct sockaddr *from, socklen_t *fromlen);
 
+    ssize_t recvmsg_Mod(int s, struct msghdr *msg, int flags);
+
+    int sendmmsg_Err(int s, struct mmsghdr *msgs, unsigned int vlen, int flags);
+
+    int recvmmsg_Mod(int s, struct mmsghdr *msgs, unsigned int vlen, int flags,
+                     struct timespec *timeout);
+
   private:
+    typedef struct _Stream
+    {
+        Xoshiro256 random;
+        uint64_t   session;
+        uint32_t   generation;  // m_Generation it was seeded for, 0 = not yet
+        bool       named;       // session set by setSession, not the socket
+    } Stream_t;
+
     float      m_ErrorRate;
     uint32_t   m_MsgNo;
+    uint64_t   m_Seed;
+    uint32_t   m_Generation;    // bumped by setRandSeed, streams reseed lazily
+    Stream_t   m_Streams[PKTMGR_STREAMS];
 
     listMsgEvents_t m_ErrorCase_Constant;
     listMsgEvents_t m_ErrorCase_Chance;
+
+    // sendmmsg_Err's copies of the messages that survived their events
+    std::vector<unsigned char> m_BatchData;
+    std::vector<struct mmsghdr> m_BatchMsgs;
+    std::vector<struct iovec>   m_BatchIov;
+    std::vector<unsigned int>   m_BatchIndex;   // caller's index of each copy
   
-    int runMsgEvents(listMsgEvents_t& ErrVec, void** pBuf, size_t* pLen, uint32_t msgNo);
+    Xoshiro256& stream(int s);
+
+    int runMsgEvents(listMsgEvents_t& ErrVec, void** pBuf, size_t* pLen, uint32_t msgNo,
+                     Xoshiro256& random);
 
     int clearMsgEvents(listMsgEvents_t& ErrVec);
+
+    void printRecv(void *buf, ssize_t len);
 };
 
 #endif
@@ -6,6 +6,7 @@
 #include "MsgEvents/errorFlipBits.h"
 
 #include <errno.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 // ============================================================================
@@ -15,7 +16,7 @@ static sEnvKeyInfo_t g_EnvKeys[] = {
     {EDK_OVERRIDE_DEBUG,    "CPE464_OVERRIDE_DEBUG",    EDT_LONG},
     {EDK_OVERRIDE_SEEDRAND, "CPE464_OVERRIDE_SEEDRAND", EDT_LONG},
     {EDK_OVERRIDE_ERR_RATE, "CPE464_OVERRIDE_ERR_RATE", EDT_FLOAT},
-    {EDK_OVERRIDE_ERR_DROP, "CPE464_OVERRIDE_ERR_DROP", EDT_LIST_LONG},
+    {EDK_OVERRIDE_ERR_DROP, "CPE464_OVERRIDE_ERR_DROP", EDT_LIST_SPAN},
     {EDK_OVERRIDE_ERR_FLIP, "CPE464_OVERRIDE_ERR_FLIP", EDT_LIST_LONG}
 };
 // ============================================================================
@@ -117,6 +118,16 @@ int SettingsManager::loadEnvData(void)
                     }
                     break;
                 }
+                case EDT_LIST_SPAN:
+                {
+                    entry.data.vLong = parser2ListSpan(entry.lSpan, tmpStr);
+                    if (entry.data.vLong < 0)
+                    {
+                        entry.isSet = false;
+                        continue;
+                    }
+                    break;
+                }
                 default:
                 {
                     continue;
@@ -195,10 +206,8 @@ int SettingsManager::loadEnvData_ErrDrop(void)
     if (entry.isSet)
     {
         errorDrop* errClass = new errorDrop();
-        std::list<uint32_t> lUint32;
-        parserLong2Uint32(entry.lLong, lUint32);
 
-        if (lUint32.size() == 0)
+        if (entry.lSpan.size() == 0)
         {
             DBG_PRINT(DBG_LEVEL_WARN, "** ENV - OVERRIDE ERROR DROP: ENABLED **\n");
 
@@ -207,12 +216,19 @@ int SettingsManager::loadEnvData_ErrDrop(void)
         else
         {
             DBG_PRINT(DBG_LEVEL_WARN, "** ENV - OVERRIDE ERROR DROP: __List__ **\n");
-            for (std::list<uint32_t>::iterator it = lUint32.begin(); it != lUint32.end(); ++it)
+            for (errorDrop::DropSpans_t::iterator it = entry.lSpan.begin(); it != entry.lSpan.end(); ++it)
             {
-                DBG_PRINT(DBG_LEVEL_WARN, "%u\n", *it);
+                if (it->first == it->last)
+                {
+                    DBG_PRINT(DBG_LEVEL_WARN, "%u\n", it->first);
+                }
+                else
+                {
+                    DBG_PRINT(DBG_LEVEL_WARN, "%u-%u:%u\n", it->first, it->last, it->stride);
+                }
             }
 
-            errClass->setDropSpecific(lUint32);
+            errClass->setDropSpans(entry.lSpan);
             m_pPktMgr->addMsgEvent_Standard(errClass);
         }
     }
@@ -293,6 +309,62 @@ int SettingsManager::parser2ListLong(ListLong_t& lLong, const char* str)
     return count;
 }
 // ============================================================================
+int SettingsManager::parser2ListSpan(errorDrop::DropSpans_t& lSpan, const char* str)
+{
+    // walks the string instead of strtok_r, the environment copy that
+    // forked children and exec'd programs see stays intact
+    const char* pos = str;
+    char* strEnd = NULL;
+
+    int count = 0;
+
+    while (*pos != '\0')
+    {
+        long first = strtol(pos, &strEnd, 10);
+        long last = first;
+        long stride = 1;
+        bool valid = (strEnd != pos);
+
+        if (valid && (first >= 0) && (*strEnd == '-'))
+        {
+            pos = strEnd + 1;
+            last = strtol(pos, &strEnd, 10);
+            valid = (strEnd != pos) && (last >= first);
+        }
+        if (valid && (first >= 0) && (*strEnd == ':'))
+        {
+            if (last == first)
+            {
+                last = UINT32_MAX;
+            }
+            pos = strEnd + 1;
+            stride = strtol(pos, &strEnd, 10);
+            valid = (strEnd != pos) && (stride > 0);
+        }
+        if (!valid || ((*strEnd != ',') && (*strEnd != '\0')))
+        {
+            ERR_PRINT("Invalid Value in String\n");
+            break;
+        }
+
+        ++count;
+
+        // negative values only mark the list as set, see -1 above
+        if (first >= 0)
+        {
+            errorDrop::DropSpan_t span;
+            span.first = (first > (long)UINT32_MAX) ? UINT32_MAX : first;
+            span.last = (last > (long)UINT32_MAX) ? UINT32_MAX : last;
+            span.stride = (stride > (long)UINT32_MAX) ? UINT32_MAX : stride;
+            lSpan.push_back(span);
+        }
+
+        pos = (*strEnd == ',') ? strEnd + 1 : strEnd;
+    }
+
+    return count;
+}
+// ============================================================================
 int SettingsManager::setUserMode_Debug(int debugLevel)
 {
     if (m_EnvData[EDK_OVERRIDE_DEBUG].isSet)
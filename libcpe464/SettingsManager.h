@@ -17,6 +17,11 @@
  * List Options:
  *   Provide a comma-separated list of MsgEvents to perform an event. Since no
  *   parameter undefines an environmental variable, use -1 to set random events
+ *
+ *   The drop list also takes spans of message numbers:
+ *     100-200       every message from 100 to 200
+ *     1000:50       1000, 1050, 1100, ... to the end of the run
+ *     100-200:10    100, 110, ... 200
  */
 
 #ifndef __SETTINGSMANAGER_H_
@@ -24,6 +29,7 @@
 
 // ============================================================================
 #include "PacketManager.h"
+#include "MsgEvents/errorDrop.h"
 #include <list>
 #include <map>
 // ============================================================================
@@ -37,7 +43,8 @@ enum eEnvData_t
     EDT_FLOAT,
     EDT_BOOL,
     EDT_CHARPTR,
-    EDT_LIST_LONG
+    EDT_LIST_LONG,
+    EDT_LIST_SPAN
 };
 
 enum eEnvDataKey_t
@@ -67,6 +74,7 @@ typedef struct _EnvDataEntry
         char* vCharPtr;
     } data;
     ListLong_t lLong;
+    errorDrop::DropSpans_t lSpan;
 
     _EnvDataEntry() {
         isSet = false;
@@ -100,6 +108,7 @@ class SettingsManager
         // ===== Helper Functions =============================================
         int parser2ListLong(ListLong_t& lLong, const char* str);
         int parserLong2Uint32(ListLong_t& lLong, std::list<uint32_t>& lUint32);
+        int parser2ListSpan(errorDrop::DropSpans_t& lSpan, const char* str);
 
         // ====================================================================
         int loadEnvData(void);
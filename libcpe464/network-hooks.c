@@ -21,10 +21,13 @@
 #undef select
 #undef send
 #undef sendto
+#undef sendmmsg
 
 #ifdef CPE464_OVERRIDE_RECV
     #undef recv
     #undef recvfrom
+    #undef recvmsg
+    #undef recvmmsg
 #endif
 // ============================================================================
 #include <sys/types.h>
@@ -206,6 +209,11 @@ int sendErr_init(double error_rate,
     return 0;
 }
 // ============================================================================
+int sendErr_setSession(int s, unsigned long session)
+{
+    return g_PktMgr.setSession(s, session);
+}
+// ============================================================================
 ssize_t sendErr  (int s, void *msg, int len, unsigned int flags)
 {
     //DBG_PRINT(DBG_LEVEL_VDEBUG, "\n");
@@ -236,4 +244,20 @@ ssize_t recvfromErr(int s, void *buf, size_t len, int flags,
     return g_PktMgr.recvfrom_Mod(s, buf, len, flags, from, fromlen);
 }
 // ============================================================================
+ssize_t recvmsgErr(int s, struct msghdr *msg, int flags)
+{
+    return g_PktMgr.recvmsg_Mod(s, msg, flags);
+}
+// ============================================================================
+int sendmmsgErr(int s, struct mmsghdr *msgs, unsigned int vlen, int flags)
+{
+    return g_PktMgr.sendmmsg_Err(s, msgs, vlen, flags);
+}
+// ============================================================================
+int recvmmsgErr(int s, struct mmsghdr *msgs, unsigned int vlen, int flags,
+                struct timespec *timeout)
+{
+    return g_PktMgr.recvmmsg_Mod(s, msgs, vlen, flags, timeout);
+}
+// ============================================================================
 // ============================================================================
@@ -0,0 +1,69 @@
+/**
+ * Xoshiro256 - small, fast PRNG for error injection (xoshiro256**)
+ *
+ * Each sending session owns one, seeded from the base seed plus a session
+ * id, so sessions never share or disturb each other's stream and a run with
+ * the same seeds drops and flips the same messages again. The state is four
+ * words and next() touches nothing else, no locks needed.
+ */
+
+#ifndef __XOSHIRO256_H
+#define __XOSHIRO256_H
+
+// ============================================================================
+#include <stdint.h>
+// ============================================================================
+class Xoshiro256
+{
+  public:
+    Xoshiro256(uint64_t seed = 0, uint64_t session = 0)
+    {
+        this->seed(seed, session);
+    }
+
+    void seed(uint64_t seed, uint64_t session)
+    {
+        // splitmix64 from a start that differs per session, never all zero
+        uint64_t x = seed ^ (session * 0xD1B54A32D192ED03ULL);
+        for (int i = 0; i < 4; ++i)
+        {
+            x += 0x9E3779B97F4A7C15ULL;
+            uint64_t z = x;
+            z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+            z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+            m_State[i] = z ^ (z >> 31);
+        }
+    }
+
+    uint64_t next(void)
+    {
+        uint64_t result = rotl(m_State[1] * 5, 7) * 9;
+        uint64_t t = m_State[1] << 17;
+
+        m_State[2] ^= m_State[0];
+        m_State[3] ^= m_State[1];
+        m_State[1] ^= m_State[2];
+        m_State[0] ^= m_State[3];
+        m_State[2] ^= t;
+        m_State[3] = rotl(m_State[3], 45);
+
+        return result;
+    }
+
+    // [0, 1), the drand48() replacement
+    double nextDouble(void)
+    {
+        return (next() >> 11) * (1.0 / 9007199254740992.0);
+    }
+
+  private:
+    static uint64_t rotl(uint64_t x, int k)
+    {
+        return (x << k) | (x >> (64 - k));
+    }
+
+    uint64_t m_State[4];
+};
+// ============================================================================
+
+#endif
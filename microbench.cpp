@@ -0,0 +1,529 @@
+// Microbenchmarks for the per-packet primitives
+//
+// Times build_pdu, in_cksum, the sender window, the retransmit timer wheel,
+// the receiver buffer, PacketManager::processEvents and errorDrop in
+// isolation, across payload and window sizes, and the send paths against a
+// bare sendto(). Reports ns/op and allocations/op (malloc is wrapped below)
+// and, where perf_event_open is allowed, cycles, instructions and cache
+// misses per op.
+//
+//   ./microbench [--filter TEXT] [--time MS] [--csv FILE]
+//
+// Every case is run as 5 samples of at least MS/5 milliseconds each and
+// the median sample by ns/op is reported.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+extern "C" {
+#include "buffer.h"
+#include "pdu.h"
+#include "timerwheel.h"
+#include "cpe464.h"
+}
+
+#include "PacketManager.h"
+#include "MsgPipeline.h"
+#include "MsgEvents/errorDrop.h"
+#include "MsgEvents/errorFlipBits.h"
+#include "MsgEvents/infoSeqNo.h"
+
+// Counts every allocation made through malloc, including operator new.
+static uint64_t allocations = 0;
+
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *pointer, size_t size);
+
+void *malloc(size_t size) {
+    allocations++;
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    allocations++;
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *pointer, size_t size) {
+    allocations++;
+    return __libc_realloc(pointer, size);
+}
+}
+
+namespace {
+
+const uint8_t DPACK = 16;
+
+// Cycles, instructions and cache misses of this thread in user mode, read
+// as one group. Silently absent when perf_event_paranoid says no.
+class Counters {
+  public:
+    static const int COUNT = 3;
+
+    Counters() {
+        const uint64_t events[COUNT] = {PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+                                        PERF_COUNT_HW_CACHE_MISSES};
+        for (int i = 0; i < COUNT; i++) {
+            struct perf_event_attr attr;
+            memset(&attr, 0, sizeof(attr));
+            attr.size = sizeof(attr);
+            attr.type = PERF_TYPE_HARDWARE;
+            attr.config = events[i];
+            attr.exclude_kernel = 1;
+            attr.exclude_hv = 1;
+            attr.read_format = PERF_FORMAT_GROUP;
+            attr.disabled = (i == 0);
+            fds_[i] = syscall(SYS_perf_event_open, &attr, 0, -1, i == 0 ? -1 : fds_[0], 0);
+            if (fds_[i] < 0) {
+                close_all();
+                return;
+            }
+        }
+        ioctl(fds_[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+        available_ = true;
+    }
+
+    ~Counters() { close_all(); }
+
+    bool available() const { return available_; }
+
+    void read_into(uint64_t values[COUNT]) const {
+        struct {
+            uint64_t count;
+            uint64_t values[COUNT];
+        } group = {};
+        if (available_ && read(fds_[0], &group, sizeof(group)) == (ssize_t)sizeof(group)) {
+            memcpy(values, group.values, sizeof(group.values));
+        } else {
+            memset(values, 0, sizeof(uint64_t) * COUNT);
+        }
+    }
+
+  private:
+    int fds_[COUNT] = {-1, -1, -1};
+    bool available_ = false;
+
+    void close_all() {
+        for (int i = 0; i < COUNT; i++) {
+            if (fds_[i] >= 0) close(fds_[i]);
+            fds_[i] = -1;
+        }
+        available_ = false;
+    }
+};
+
+Counters *counters = nullptr;
+
+// Accumulates only the regions a case brackets with start()/stop(), so
+// setup such as filling a window before acking it stays out of the numbers.
+class Meter {
+  public:
+    void start() {
+        counters->read_into(counter_start_);
+        allocations_start_ = allocations;
+        time_start_ = std::chrono::steady_clock::now();
+    }
+
+    void stop(uint64_t ops) {
+        auto now = std::chrono::steady_clock::now();
+        uint64_t allocated = allocations - allocations_start_;
+        uint64_t values[Counters::COUNT];
+        counters->read_into(values);
+        ns += std::chrono::duration<double, std::nano>(now - time_start_).count();
+        allocs += allocated;
+        for (int i = 0; i < Counters::COUNT; i++) events[i] += values[i] - counter_start_[i];
+        this->ops += ops;
+    }
+
+    double ns = 0;
+    uint64_t allocs = 0;
+    uint64_t events[Counters::COUNT] = {};
+    uint64_t ops = 0;
+
+  private:
+    uint64_t counter_start_[Counters::COUNT] = {};
+    uint64_t allocations_start_ = 0;
+    std::chrono::steady_clock::time_point time_start_;
+};
+
+struct Case {
+    std::string name;
+    std::string param;
+    std::function<void(Meter &)> round;     // runs one batch, brackets what it measures
+    std::function<void()> cleanup;
+};
+
+volatile unsigned sink;
+
+std::vector<uint8_t> payload(size_t size) {
+    std::vector<uint8_t> data(size);
+    for (size_t i = 0; i < size; i++) data[i] = (uint8_t)(i * 131 + 7);
+    return data;
+}
+
+void add_checksum_cases(std::vector<Case> &cases) {
+    for (int length : {8, 64, 512, 1407, 9007, 65535}) {
+        auto data = std::make_shared<std::vector<uint8_t>>(payload(length + 1));
+        cases.push_back({"in_cksum", std::to_string(length) + "B", [data, length](Meter &meter) {
+            meter.start();
+            for (int i = 0; i < 1000; i++) sink = in_cksum((unsigned short *)data->data(), length);
+            meter.stop(1000);
+        }, nullptr});
+    }
+}
+
+void add_pdu_cases(std::vector<Case> &cases) {
+    for (int length : {4, 100, 1400, 9000, 65500}) {
+        auto data = std::make_shared<std::vector<uint8_t>>(payload(length));
+        auto pdu = std::make_shared<std::vector<uint8_t>>(length + PDU_HEADER + 1);
+        auto sequence = std::make_shared<uint32_t>(0);
+        cases.push_back({"build_pdu", std::to_string(length) + "B", [data, pdu, sequence, length](Meter &meter) {
+            meter.start();
+            for (int i = 0; i < 1000; i++) build_pdu(pdu->data(), (*sequence)++, DPACK, data->data(), length);
+            meter.stop(1000);
+            sink = (*pdu)[4];
+        }, nullptr});
+    }
+}
+
+// A full window goes out, then RRs come back for every 4th packet the way
+// rcopy coalesces them.
+void add_window_cases(std::vector<Case> &cases) {
+    const int length = 1400 + PDU_HEADER;
+    auto pdu = std::make_shared<std::vector<uint8_t>>(payload(length));
+    for (int window : {16, 256, 4096}) {
+        SenderWindow *sender = create_sender_window(window, 1400);
+        auto sequence = std::make_shared<int>(0);
+        cases.push_back({"add_packet_to_window", "w" + std::to_string(window), [=](Meter &meter) {
+            meter.start();
+            for (int i = 0; i < window; i++) add_packet_to_window(sender, *sequence + i, (const char *)pdu->data(), length);
+            meter.stop(window);
+            *sequence += window;
+            acknowledge_packet(sender, *sequence - 1);
+        }, [sender] { free_sender_window(sender); }});
+
+        SenderWindow *acked = create_sender_window(window, 1400);
+        auto acked_sequence = std::make_shared<int>(0);
+        cases.push_back({"acknowledge_packet", "w" + std::to_string(window), [=](Meter &meter) {
+            int base = *acked_sequence;
+            for (int i = 0; i < window; i++) add_packet_to_window(acked, base + i, (const char *)pdu->data(), length);
+            meter.start();
+            for (int i = 3; i < window; i += 4) acknowledge_packet(acked, base + i);
+            meter.stop(window / 4);
+            acknowledge_packet(acked, base + window - 1);
+            *acked_sequence += window;
+        }, [acked] { free_sender_window(acked); }});
+    }
+}
+
+// Every packet of a window gets a retransmit deadline one rto out as it
+// is sent, then the RRs cancel them, the way the server drives the wheel.
+void add_wheel_cases(std::vector<Case> &cases) {
+    for (int window : {16, 256, 4096}) {
+        auto wheel = std::make_shared<TimerWheel>();
+        auto timers = std::make_shared<std::vector<WheelTimer>>(window);
+        auto now = std::make_shared<uint64_t>(1000000000ULL);
+        wheel_init(wheel.get(), *now);
+        cases.push_back({"wheel_arm+cancel", "w" + std::to_string(window), [=](Meter &meter) {
+            meter.start();
+            for (int i = 0; i < window; i++) wheel_arm(wheel.get(), &(*timers)[i], *now + i * 10000 + 40000000);
+            for (int i = 0; i < window; i++) wheel_cancel(wheel.get(), &(*timers)[i]);
+            meter.stop(window);
+            *now += 1000000;
+            sink = wheel_expire(wheel.get(), *now) != NULL;
+        }, nullptr});
+    }
+}
+
+// The first packet of each window is late, everything behind it is
+// buffered and then flushed in order once it arrives.
+void add_receiver_cases(std::vector<Case> &cases) {
+    const int length = 1400;
+    auto data = std::make_shared<std::vector<uint8_t>>(payload(length));
+    for (int window : {16, 256, 4096}) {
+        ReceiverBuffer *receiver = create_receiver_buffer(window, length);
+        cases.push_back({"add_packet_to_buffer", "w" + std::to_string(window), [=](Meter &meter) {
+            int base = receiver->expected;
+            meter.start();
+            for (int i = 1; i < window; i++) add_packet_to_buffer(receiver, base + i, (const char *)data->data(), length);
+            add_packet_to_buffer(receiver, base, (const char *)data->data(), length);
+            meter.stop(window);
+            int size = 0;
+            while (fetch_data_from_buffer(receiver, &size)) receiver->expected++;
+        }, [receiver] { free_receiver_buffer(receiver); }});
+
+        ReceiverBuffer *flushed = create_receiver_buffer(window, length);
+        cases.push_back({"fetch_data_from_buffer", "w" + std::to_string(window), [=](Meter &meter) {
+            int base = flushed->expected;
+            for (int i = 0; i < window; i++) add_packet_to_buffer(flushed, base + i, (const char *)data->data(), length);
+            int size = 0;
+            unsigned total = 0;
+            meter.start();
+            while (const char *out = fetch_data_from_buffer(flushed, &size)) {
+                total += (uint8_t)out[0];
+                flushed->expected++;
+            }
+            meter.stop(window);
+            sink = total;
+        }, [flushed] { free_receiver_buffer(flushed); }});
+    }
+}
+
+// What sendtoErr runs on every PDU before the real sendto: the seqno
+// journal always, a drop or a bit flip at the error rate.
+void add_event_cases(std::vector<Case> &cases) {
+    struct Setup {
+        const char *param;
+        bool journal;
+        float rate;
+    };
+    const Setup setups[] = {{"none", false, 0.0f}, {"seqno", true, 0.0f}, {"seqno+err10%", true, 0.1f}};
+    for (const Setup &setup : setups) {
+        PacketManager *manager = new PacketManager();
+        manager->setRandSeed(1);
+        if (setup.journal) manager->addMsgEvent_Standard(new infoSeqNo());
+        if (setup.rate > 0) {
+            manager->addMsgEvent_Random(new errorDrop());
+            manager->addMsgEvent_Random(new errorFlipBits());
+            manager->setErrorRate(setup.rate);
+        }
+        auto pdu = std::make_shared<std::vector<uint8_t>>(payload(1400 + PDU_HEADER));
+        auto message = std::make_shared<uint32_t>(0);
+        cases.push_back({"processEvents", setup.param, [=](Meter &meter) {
+            meter.start();
+            for (int i = 0; i < 1000; i++) {
+                uint32_t sequence = htonl(*message);
+                memcpy(pdu->data(), &sequence, 4);
+                void *buffer = pdu->data();
+                size_t length = pdu->size();
+                sink = manager->processEvents(&buffer, &length, ++*message);
+            }
+            meter.stop(1000);
+        }, [manager] { delete manager; }});
+    }
+}
+
+// A scripted CPE464_OVERRIDE_ERR_DROP list, checked on every PDU. The
+// entries are spread out so the message counter stays inside the list.
+void add_drop_list_cases(std::vector<Case> &cases) {
+    for (int entries : {10, 5000}) {
+        errorDrop::DropList_t list;
+        for (int i = 0; i < entries; i++) list.push_back(i * (50000000 / entries));
+        errorDrop *drop = new errorDrop();
+        drop->setDropSpecific(list);
+        auto pdu = std::make_shared<std::vector<uint8_t>>(payload(1400 + PDU_HEADER));
+        auto message = std::make_shared<uint32_t>(0);
+        cases.push_back({"errorDrop", std::to_string(entries) + " listed", [=](Meter &meter) {
+            meter.start();
+            for (int i = 0; i < 1000; i++) {
+                void *buffer = pdu->data();
+                size_t length = pdu->size();
+                sink = drop->run(&buffer, &length, ++*message, true);
+            }
+            meter.stop(1000);
+        }, [drop] { delete drop; }});
+    }
+}
+
+// A UDP socket sending to a loopback one nobody reads. Once the receive
+// queue is full the kernel drops what arrives, every path pays the same.
+// (socket)(...) and friends skip the cpe464.h hooks.
+struct Loopback {
+    int sender;
+    sockaddr_in to;
+    int receiver;
+
+    Loopback() {
+        receiver = (socket)(AF_INET, SOCK_DGRAM, 0);
+        sender = (socket)(AF_INET, SOCK_DGRAM, 0);
+        memset(&to, 0, sizeof(to));
+        to.sin_family = AF_INET;
+        to.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t length = sizeof(to);
+        if (receiver < 0 || sender < 0 || (bind)(receiver, (sockaddr *)&to, sizeof(to)) < 0 ||
+            getsockname(receiver, (sockaddr *)&to, &length) < 0) {
+            perror("loopback socket");
+            exit(1);
+        }
+    }
+    ~Loopback() {
+        close(sender);
+        close(receiver);
+    }
+};
+
+// One PDU per send: the bare syscall, the passthrough pipeline that
+// CPE464_PASSTHROUGH stands for, a compile-time pipeline with the seqno
+// journal, and PacketManager with the same journal registered at run time.
+void add_send_cases(std::vector<Case> &cases) {
+    auto pdu = std::make_shared<std::vector<uint8_t>>(payload(1400 + PDU_HEADER));
+
+    auto raw = std::make_shared<Loopback>();
+    cases.push_back({"send", "bare sendto", [=](Meter &meter) {
+        meter.start();
+        for (int i = 0; i < 1000; i++) {
+            sink = (sendto)(raw->sender, pdu->data(), pdu->size(), 0, (sockaddr *)&raw->to, sizeof(raw->to));
+        }
+        meter.stop(1000);
+    }, [] {}});
+
+    auto bare = std::make_shared<Loopback>();
+    auto passthrough = std::make_shared<MsgPipeline<>>();
+    cases.push_back({"send", "passthrough", [=](Meter &meter) {
+        meter.start();
+        for (int i = 0; i < 1000; i++) {
+            sink = passthrough->sendto(bare->sender, pdu->data(), pdu->size(), 0, (sockaddr *)&bare->to,
+                                       sizeof(bare->to));
+        }
+        meter.stop(1000);
+    }, [] {}});
+
+    auto fixed = std::make_shared<Loopback>();
+    auto journal = std::make_shared<MsgPipeline<infoSeqNo>>();
+    cases.push_back({"send", "fixed seqno", [=](Meter &meter) {
+        meter.start();
+        for (int i = 0; i < 1000; i++) {
+            sink = journal->sendto(fixed->sender, pdu->data(), pdu->size(), 0, (sockaddr *)&fixed->to,
+                                   sizeof(fixed->to));
+        }
+        meter.stop(1000);
+    }, [] {}});
+
+    auto dynamic = std::make_shared<Loopback>();
+    PacketManager *manager = new PacketManager();
+    manager->addMsgEvent_Standard(new infoSeqNo());
+    cases.push_back({"send", "dynamic seqno", [=](Meter &meter) {
+        meter.start();
+        for (int i = 0; i < 1000; i++) {
+            sink = manager->sendto_Err(dynamic->sender, pdu->data(), pdu->size(), 0, (sockaddr *)&dynamic->to,
+                                       sizeof(dynamic->to));
+        }
+        meter.stop(1000);
+    }, [manager] { delete manager; }});
+}
+
+struct Sample {
+    double ns_per_op;
+    double allocs_per_op;
+    double events_per_op[Counters::COUNT];
+};
+
+Sample run_case(Case &test, double budget_ms) {
+    Meter warm;
+    test.round(warm);
+
+    std::vector<Sample> samples;
+    for (int s = 0; s < 5; s++) {
+        Meter meter;
+        auto begin = std::chrono::steady_clock::now();
+        do {
+            test.round(meter);
+        } while (std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count() <
+                 budget_ms / 5);
+        Sample sample;
+        sample.ns_per_op = meter.ns / meter.ops;
+        sample.allocs_per_op = (double)meter.allocs / meter.ops;
+        for (int i = 0; i < Counters::COUNT; i++) sample.events_per_op[i] = (double)meter.events[i] / meter.ops;
+        samples.push_back(sample);
+    }
+    std::sort(samples.begin(), samples.end(),
+              [](const Sample &a, const Sample &b) { return a.ns_per_op < b.ns_per_op; });
+    return samples[samples.size() / 2];
+}
+
+void usage(const char *name) {
+    fprintf(stderr, "usage: %s [--filter TEXT] [--time MS] [--csv FILE]\n", name);
+    exit(2);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    std::string filter;
+    std::string csv;
+    double budget_ms = 250;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) usage(argv[0]);
+        if (arg == "--filter") {
+            filter = argv[++i];
+        } else if (arg == "--time") {
+            budget_ms = atof(argv[++i]);
+        } else if (arg == "--csv") {
+            csv = argv[++i];
+        } else {
+            usage(argv[0]);
+        }
+    }
+
+    // the journal and error events print through the library's debug level
+    dbg_setlevel(DBG_LEVEL_WARN);
+
+    Counters perf;
+    counters = &perf;
+    if (!perf.available()) fprintf(stderr, "perf_event_open not permitted, hardware counters omitted\n");
+
+    std::vector<Case> cases;
+    add_checksum_cases(cases);
+    add_pdu_cases(cases);
+    add_window_cases(cases);
+    add_wheel_cases(cases);
+    add_receiver_cases(cases);
+    add_event_cases(cases);
+    add_drop_list_cases(cases);
+    add_send_cases(cases);
+
+    FILE *out = csv.empty() ? nullptr : fopen(csv.c_str(), "w");
+    if (!csv.empty() && !out) {
+        perror(csv.c_str());
+        return 1;
+    }
+    if (out) fprintf(out, "case,param,ns_per_op,allocs_per_op,cycles_per_op,instructions_per_op,cache_misses_per_op\n");
+
+    printf("%-24s %-14s %10s %10s %10s %10s %10s\n", "case", "param", "ns/op", "allocs/op", "cycles/op", "instr/op",
+           "misses/op");
+    for (Case &test : cases) {
+        std::string label = test.name + "/" + test.param;
+        if (!filter.empty() && label.find(filter) == std::string::npos) continue;
+        Sample sample = run_case(test, budget_ms);
+        if (perf.available()) {
+            printf("%-24s %-14s %10.1f %10.3f %10.1f %10.1f %10.3f\n", test.name.c_str(), test.param.c_str(),
+                   sample.ns_per_op, sample.allocs_per_op, sample.events_per_op[0], sample.events_per_op[1],
+                   sample.events_per_op[2]);
+        } else {
+            printf("%-24s %-14s %10.1f %10.3f %10s %10s %10s\n", test.name.c_str(), test.param.c_str(),
+                   sample.ns_per_op, sample.allocs_per_op, "-", "-", "-");
+        }
+        fflush(stdout);
+        if (out) {
+            fprintf(out, "%s,%s,%.3f,%.4f", test.name.c_str(), test.param.c_str(), sample.ns_per_op,
+                    sample.allocs_per_op);
+            for (int i = 0; i < Counters::COUNT; i++) {
+                if (perf.available()) fprintf(out, ",%.3f", sample.events_per_op[i]);
+                else fprintf(out, ",");
+            }
+            fprintf(out, "\n");
+        }
+    }
+    for (Case &test : cases)
+        if (test.cleanup) test.cleanup();
+    if (out) fclose(out);
+    return 0;
+}
@@ -15,6 +15,8 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netdb.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
 
 #include "networks.h"
 #include "gethostbyname.h"
@@ -210,3 +212,183 @@ int setupUdpClientToServer(struct sockaddr_in6 *serverAddress, char * hostName,
 }
 
 
+// Turns path MTU discovery on (or off) for a UDP socket.  While it is on the
+// kernel never fragments our datagrams, a send larger than the known path
+// MTU fails with EMSGSIZE instead.
+
+int udpPathMtuDiscovery(int socketNum, int on)
+{
+	int v6 = on ? IPV6_PMTUDISC_DO : IPV6_PMTUDISC_DONT;
+	int v4 = on ? IP_PMTUDISC_DO : IP_PMTUDISC_DONT;
+
+	// IPv4 mapped peers go by the IPv4 setting
+	setsockopt(socketNum, IPPROTO_IP, IP_MTU_DISCOVER, &v4, sizeof(v4));
+	return setsockopt(socketNum, IPPROTO_IPV6, IPV6_MTU_DISCOVER, &v6, sizeof(v6));
+}
+
+// Returns the largest UDP payload the path to peer carries without
+// fragmenting, or 0 if the kernel can not tell.  This includes any lower
+// MTU already learned from an ICMP too big message.
+
+int udpPathMtu(struct sockaddr_in6 *peer)
+{
+	int mapped = IN6_IS_ADDR_V4MAPPED(&peer->sin6_addr);
+	int mtu = 0;
+	socklen_t mtuLen = sizeof(mtu);
+	int probe = 0;
+
+	// IP_MTU only answers on a connected socket, connecting a scratch one
+	// looks up the route without sending anything
+	if ((probe = socket(AF_INET6, SOCK_DGRAM, 0)) < 0)
+	{
+		return 0;
+	}
+	if (connect(probe, (struct sockaddr *) peer, sizeof(*peer)) < 0 ||
+		getsockopt(probe, mapped ? IPPROTO_IP : IPPROTO_IPV6, mapped ? IP_MTU : IPV6_MTU, &mtu, &mtuLen) < 0)
+	{
+		mtu = 0;
+	}
+	close(probe);
+
+	if (mtu <= 0)
+	{
+		return 0;
+	}
+	mtu -= (mapped ? UDP_IPV4_HEADERS : UDP_IPV6_HEADERS);
+	if (mapped && mtu > UDP_IPV4_MAX_PAYLOAD)
+	{
+		mtu = UDP_IPV4_MAX_PAYLOAD;
+	}
+	return mtu;
+}
+
+// Bytes of socket buffer a window of PDUs needs.  The kernel charges each
+// queued datagram its whole allocation, which is rounded up to a power of
+// two below 32 KB, so a 1007 byte PDU really costs about 2.3 KB.
+
+int udpWindowBytes(uint32_t window, int pduSize)
+{
+	uint64_t datagram = pduSize + UDP_IPV6_HEADERS + UDP_SKB_SHARED;
+	uint64_t rounded = 1024;
+
+	if (datagram <= 32768)
+	{
+		while (rounded < datagram)
+		{
+			rounded <<= 1;
+		}
+	}
+	else
+	{
+		rounded = (datagram + 4095) & ~(uint64_t) 4095;
+	}
+	uint64_t bytes = (uint64_t) window * (rounded + UDP_SKB_OVERHEAD);
+	return (bytes > UDP_BUFFER_MAX) ? UDP_BUFFER_MAX : (int) bytes;
+}
+
+// Grows the receive and send buffers of a UDP socket to at least the given
+// sizes (0 leaves one alone).  SO_RCVBUFFORCE gets past net.core.rmem_max
+// when we have CAP_NET_ADMIN, otherwise plain SO_RCVBUF is capped there.
+// Returns the receive buffer the kernel actually granted.
+
+int udpSetBufferSize(int socketNum, int rcvBytes, int sndBytes)
+{
+	int current = 0;
+	socklen_t optLen = sizeof(current);
+
+	getsockopt(socketNum, SOL_SOCKET, SO_RCVBUF, &current, &optLen);
+	if (rcvBytes > current &&
+		setsockopt(socketNum, SOL_SOCKET, SO_RCVBUFFORCE, &rcvBytes, sizeof(rcvBytes)) < 0)
+	{
+		setsockopt(socketNum, SOL_SOCKET, SO_RCVBUF, &rcvBytes, sizeof(rcvBytes));
+	}
+
+	optLen = sizeof(current);
+	getsockopt(socketNum, SOL_SOCKET, SO_SNDBUF, &current, &optLen);
+	if (sndBytes > current &&
+		setsockopt(socketNum, SOL_SOCKET, SO_SNDBUFFORCE, &sndBytes, sizeof(sndBytes)) < 0)
+	{
+		setsockopt(socketNum, SOL_SOCKET, SO_SNDBUF, &sndBytes, sizeof(sndBytes));
+	}
+
+	optLen = sizeof(current);
+	getsockopt(socketNum, SOL_SOCKET, SO_RCVBUF, &current, &optLen);
+	return current;
+}
+
+// Has the kernel stamp every queued datagram with the number of datagrams
+// it dropped so far because this socket's receive queue was full.
+
+int udpTrackDrops(int socketNum)
+{
+	int on = 1;
+	return setsockopt(socketNum, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on));
+}
+
+// Marks everything the socket sends with a DSCP code point.  The socket is
+// IPv6 but may talk to IPv4 peers through mapped addresses, so both the
+// traffic class and the IPv4 TOS byte are set.  -1 if neither took.
+
+int udpSetTrafficClass(int socketNum, int dscp)
+{
+	int tos = dscp << 2;
+	int v6 = setsockopt(socketNum, IPPROTO_IPV6, IPV6_TCLASS, &tos, sizeof(tos));
+	int v4 = setsockopt(socketNum, IPPROTO_IP, IP_TOS, &tos, sizeof(tos));
+	return (v6 < 0 && v4 < 0) ? -1 : 0;
+}
+
+// Has the kernel stamp every datagram with the time it arrived, in
+// software and, where the NIC supports it, in hardware as well.
+
+int udpEnableTimestamps(int socketNum)
+{
+	int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE |
+		SOF_TIMESTAMPING_RX_HARDWARE | SOF_TIMESTAMPING_RAW_HARDWARE;
+	return setsockopt(socketNum, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags));
+}
+
+// Points a recvmsg() at buf, with from taking the sender's address and
+// room for the drop count and arrival stamps.
+
+void udpPacketSetup(UdpPacket *packet, void *buf, size_t len, struct sockaddr_in6 *from)
+{
+	memset(&packet->msg, 0, sizeof(packet->msg));
+	packet->iov.iov_base = buf;
+	packet->iov.iov_len = len;
+	packet->msg.msg_iov = &packet->iov;
+	packet->msg.msg_iovlen = 1;
+	packet->msg.msg_name = from;
+	packet->msg.msg_namelen = from ? sizeof(*from) : 0;
+	packet->msg.msg_control = packet->control;
+	packet->msg.msg_controllen = sizeof(packet->control);
+}
+
+// Reads the drop count and arrival stamps off a datagram just received
+// through udpPacketSetup().
+
+void udpPacketInfo(UdpPacket *packet, UdpPacketInfo *info)
+{
+	struct cmsghdr *cmsg = NULL;
+	struct scm_timestamping stamps;
+
+	// no drop stamp at all means nothing was dropped yet
+	memset(info, 0, sizeof(UdpPacketInfo));
+	for (cmsg = CMSG_FIRSTHDR(&packet->msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&packet->msg, cmsg))
+	{
+		if (cmsg->cmsg_level != SOL_SOCKET)
+		{
+			continue;
+		}
+		if (cmsg->cmsg_type == SO_RXQ_OVFL)
+		{
+			memcpy(&info->drops, CMSG_DATA(cmsg), sizeof(uint32_t));
+		}
+		else if (cmsg->cmsg_type == SO_TIMESTAMPING)
+		{
+			memcpy(&stamps, CMSG_DATA(cmsg), sizeof(stamps));
+			info->software_ns = (uint64_t)stamps.ts[0].tv_sec * 1000000000ULL + stamps.ts[0].tv_nsec;
+			info->hardware_ns = (uint64_t)stamps.ts[2].tv_sec * 1000000000ULL + stamps.ts[2].tv_nsec;
+		}
+	}
+}
+
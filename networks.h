@@ -15,9 +15,32 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <stdint.h>
 
 #define LISTEN_BACKLOG 10
 
+#define UDP_IPV4_HEADERS 28         // IPv4 + UDP header bytes
+#define UDP_IPV6_HEADERS 48         // IPv6 + UDP header bytes
+#define UDP_IPV4_MAX_PAYLOAD 65507
+#define UDP_SKB_SHARED 320          // shared info at the end of every datagram buffer
+#define UDP_SKB_OVERHEAD 256        // struct sk_buff charged on top of it
+#define UDP_BUFFER_MAX (64 * 1024 * 1024)
+
+// What the kernel attached to a received datagram, 0 where it had nothing.
+typedef struct UdpPacketInfo {
+	uint64_t software_ns;	// arrival, CLOCK_REALTIME
+	uint64_t hardware_ns;	// arrival, NIC clock
+	uint32_t drops;		// datagrams dropped on a full queue so far
+} UdpPacketInfo;
+
+// One recvmsg() that takes the datagram and what the kernel attached to it,
+// set up by udpPacketSetup() and read back with udpPacketInfo().
+typedef struct UdpPacket {
+	struct msghdr msg;
+	struct iovec iov;
+	char control[CMSG_SPACE(sizeof(uint32_t)) + CMSG_SPACE(3 * sizeof(struct timespec))];
+} UdpPacket;
+
 // for the TCP server side
 int tcpServerSetup(int serverPort);
 int tcpAccept(int mainServerSocket, int debugFlag);
@@ -28,5 +51,14 @@ int tcpClientSetup(char * serverName, char * serverPort, int debugFlag);
 // For UDP Server and Client
 int udpServerSetup(int serverPort);
 int setupUdpClientToServer(struct sockaddr_in6 *serverAddress, char * hostName, int serverPort);
+int udpPathMtuDiscovery(int socketNum, int on);
+int udpPathMtu(struct sockaddr_in6 *peer);
+int udpWindowBytes(uint32_t window, int pduSize);
+int udpSetBufferSize(int socketNum, int rcvBytes, int sndBytes);
+int udpTrackDrops(int socketNum);
+int udpSetTrafficClass(int socketNum, int dscp);
+int udpEnableTimestamps(int socketNum);
+void udpPacketSetup(UdpPacket *packet, void *buf, size_t len, struct sockaddr_in6 *from);
+void udpPacketInfo(UdpPacket *packet, UdpPacketInfo *info);
 
 #endif
@@ -0,0 +1,14 @@
+#include "pdu.h"
+#include <string.h>
+#include <arpa/inet.h>
+#include "cpe464.h"
+
+void build_pdu(uint8_t *pdu, uint32_t sequence, uint8_t flag, const uint8_t *payload, uint16_t length) {
+    uint32_t sequenceNW = htonl(sequence);
+    memcpy(pdu, &sequenceNW, 4);
+    memset(pdu + 4, 0, 2);
+    pdu[6] = flag;
+    memcpy(pdu + PDU_HEADER, payload, length);
+    uint16_t checksum = in_cksum((unsigned short *)pdu, length + PDU_HEADER);
+    memcpy(pdu + 4, &checksum, 2);
+}
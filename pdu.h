@@ -0,0 +1,13 @@
+#ifndef PDU_H
+#define PDU_H
+#include <stdlib.h>
+#include <stdint.h>
+
+// Every PDU starts with seq(4, network order) checksum(2) flag(1).
+#define PDU_HEADER 7
+
+// Lays out the header and payload at pdu, then fills in the checksum
+// over all length + PDU_HEADER bytes.
+void build_pdu(uint8_t *pdu, uint32_t sequence, uint8_t flag, const uint8_t *payload, uint16_t length);
+
+#endif // PDU_H
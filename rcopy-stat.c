@@ -0,0 +1,165 @@
+// rcopy-stat - live counters of running server sessions and rcopy clients
+//
+// Reads the pages under /dev/shm that stats.c keeps up to date. Without
+// -i it prints one snapshot with rates averaged since each transfer
+// started; with -i it prints every interval with rates over the interval.
+// -l adds the latency percentiles of each transfer below its row.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <poll.h>
+#include <dirent.h>
+
+#include "stats.h"
+#include "timing.h"
+
+#define MAX_PAGES 256
+
+typedef struct Watched {
+    char path[300];
+    const TransferStats *stats;
+    uint64_t last_bytes;
+    uint64_t last_ns;
+} Watched;
+
+Watched watched[MAX_PAGES];
+int watchedCount = 0;
+int showLatency = 0;
+
+void usage(char *name) {
+    printf("Usage: %s [-i interval-ms] [-n count] [-l] [pid]\n", name);
+    exit(1);
+}
+
+int isWatched(const char *path) {
+    int i = 0;
+    for (i = 0; i < watchedCount; i++) {
+        if (strcmp(watched[i].path, path) == 0) return 1;
+    }
+    return 0;
+}
+
+void findPages(int pid) {
+    DIR *dir = opendir(STATS_DIR);
+    struct dirent *entry = NULL;
+    if (dir == NULL) {
+        perror(STATS_DIR);
+        exit(1);
+    }
+    while ((entry = readdir(dir)) != NULL && watchedCount < MAX_PAGES) {
+        char path[300];
+        if (strncmp(entry->d_name, STATS_PREFIX, strlen(STATS_PREFIX)) != 0) continue;
+        snprintf(path, sizeof(path), "%s/%s", STATS_DIR, entry->d_name);
+        if (isWatched(path)) continue;
+
+        const TransferStats *stats = stats_map(path);
+        if (stats == NULL) continue;
+        if (kill(stats->pid, 0) < 0 && errno == ESRCH) {
+            // left behind by a process that was killed
+            stats_unmap(stats);
+            unlink(path);
+            continue;
+        }
+        if (pid && stats->pid != pid) {
+            stats_unmap(stats);
+            continue;
+        }
+        Watched *page = &watched[watchedCount++];
+        snprintf(page->path, sizeof(page->path), "%s", path);
+        page->stats = stats;
+        page->last_bytes = 0;
+        page->last_ns = stats->start_ns;
+    }
+    closedir(dir);
+}
+
+void printPage(Watched *page, uint64_t now) {
+    const TransferStats *stats = page->stats;
+    uint64_t bytes = stats_get(&stats->bytes);
+    double seconds = (now > page->last_ns) ? (now - page->last_ns) / 1e9 : 0;
+    double rate = (seconds > 0) ? (bytes - page->last_bytes) / 1e6 / seconds : 0;
+    page->last_bytes = bytes;
+    page->last_ns = now;
+
+    printf("%-6s %7d %-5s %12llu %9.2f %9llu %7llu %7llu %6llu %6llu %6llu %5llu/%-5llu",
+        stats->role == STATS_SERVER ? "server" : "rcopy", stats->pid,
+        atomic_load(&stats->state) == STATS_DONE ? "done" : "run",
+        (unsigned long long)bytes, rate,
+        (unsigned long long)stats_get(&stats->packets),
+        (unsigned long long)stats_get(&stats->retransmit_srej),
+        (unsigned long long)stats_get(&stats->retransmit_timeout),
+        (unsigned long long)stats_get(&stats->checksum_failures),
+        (unsigned long long)stats_get(&stats->duplicates),
+        (unsigned long long)stats_get(&stats->kernel_drops),
+        (unsigned long long)stats_get(&stats->window_used),
+        (unsigned long long)stats_get(&stats->window_size));
+    if (stats->role == STATS_SERVER) {
+        printf(" %8.1f %8.1f %6llu", stats_get(&stats->rto_us) / 1000.0, stats_get(&stats->srtt_us) / 1000.0,
+            (unsigned long long)stats_get(&stats->egress_queue));
+    } else {
+        printf(" %8s %8s %6s", "-", "-", "-");
+    }
+    printf("  %s\n", stats->file);
+    if (showLatency) stats_print_latency(stdout, stats, "    ");
+}
+
+void printHeader(void) {
+    printf("%-6s %7s %-5s %12s %9s %9s %7s %7s %6s %6s %6s %11s %8s %8s %6s  %s\n",
+        "role", "pid", "state", "bytes", "MB/s", "packets", "srej", "timeout",
+        "cksum", "dups", "kdrop", "window", "rto ms", "srtt ms", "queue", "file");
+}
+
+int main(int argc, char *argv[]) {
+    int interval = 0;
+    int count = 0;
+    int pid = 0;
+    int option = 0;
+
+    while ((option = getopt(argc, argv, "i:n:lh")) != -1) {
+        switch (option) {
+            case 'i': interval = atoi(optarg); break;
+            case 'n': count = atoi(optarg); break;
+            case 'l': showLatency = 1; break;
+            default: usage(argv[0]);
+        }
+    }
+    if (optind < argc) pid = atoi(argv[optind]);
+    if (interval < 0) usage(argv[0]);
+
+    int rounds = 0;
+    int i = 0;
+    while (1) {
+        findPages(pid);
+        uint64_t now = clock_ns();
+        if (rounds == 0 || interval) printHeader();
+        for (i = 0; i < watchedCount; i++) {
+            printPage(&watched[i], now);
+        }
+        if (watchedCount == 0 && rounds == 0) {
+            printf("no transfers running\n");
+        }
+        fflush(stdout);
+
+        // pages of finished transfers are gone from /dev/shm, let go of them
+        int kept = 0;
+        for (i = 0; i < watchedCount; i++) {
+            if (atomic_load(&watched[i].stats->state) == STATS_DONE ||
+                (kill(watched[i].stats->pid, 0) < 0 && errno == ESRCH)) {
+                stats_unmap(watched[i].stats);
+            } else {
+                watched[kept++] = watched[i];
+            }
+        }
+        watchedCount = kept;
+
+        rounds++;
+        if (interval == 0 || (count && rounds >= count)) break;
+        poll(NULL, 0, interval);
+    }
+    for (i = 0; i < watchedCount; i++) stats_unmap(watched[i].stats);
+    return 0;
+}
@@ -1,6 +1,7 @@
 // Client side - UDP Code				    
 // By Hugh Smith	4/1/2017		
 
+#define _GNU_SOURCE     // recvmmsg
 #include <stdio.h>
 #include <stdlib.h>
 #include <sys/types.h>
@@ -14,6 +15,8 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <netdb.h>
+#include <errno.h>
+#include <limits.h>
 
 #include "gethostbyname.h"
 #include "networks.h"
@@ -21,20 +24,45 @@
 #include "cpe464.h"
 #include "pollLib.h"
 #include "buffer.h"
+#include "filewriter.h"
+#include "delta.h"
+#include "timing.h"
+#include "pdu.h"
+#include "stats.h"
 
-#define MAXBUF 1407
+#define MAXBUF (PAYLOAD_MAX + 7)
 #define RR 5
 #define SREJ 6
 #define SFLNM 8
 #define RFLNM 9
 #define EOFF 10
 #define DPACK 16
+#define DPACK_PACKED 19     // data in compress.h's framing, only sent when we asked for it
+#define SIG 18
+#define FNAME_MISSING 33
+#define BUSY 34             // server at its session limit, ask again later
 #define ST_RECVDATA 0
 #define ST_FILENAME 1
 #define ST_INORDER 2
 #define ST_BUFFER 3
 #define ST_FLUSH 4
 #define ST_EOF 5
+#define ACK_COALESCE 4      // ack every Nth in-order packet
+#define ACK_DELAY_MS 10     // or once the line has been quiet this long
+#define RECV_BATCH 16       // datagrams taken in one recvmmsg
+#define FNAME_OPT_TREE 0x01 // filename packet option: send the whole directory
+#define FNAME_OPT_DELTA 0x02 // send a delta against our signatures
+#define FNAME_OPT_COMPRESS 0x04 // data payloads may come compressed
+#define FNAME_OPT_PMTU 0x08 // buffer size follows the path MTU, shrink it if the path shrinks
+#define FNAME_OPT_WEIGHT 0x10 // our share when the server caps its egress, a byte after the rest
+#define FNAME_OPT_PRIORITY 0x20 // a priority byte after the weight
+#define FNAME_OPT_NONCE 0x40 // 4 bytes after the priority, the same in every retry of this request
+#define FNAME_OPT_MANIFEST 0x80 // with FNAME_OPT_TREE, send the paths listed in the file
+#define PRIORITY_NORMAL 0   // RCOPY_PRIORITY=normal, interactive or bulk
+#define PRIORITY_INTERACTIVE 1
+#define PRIORITY_BULK 2
+#define PAYLOAD_LIMIT 1400  // largest buffer-size taken by hand
+#define PAYLOAD_MAX 65528   // buffer-size is 16 bits and counts the 7 byte header too
 
 
 void talkToServer(int socketNum, struct sockaddr_in6 * server, char * argv[]);
@@ -44,14 +72,27 @@ int readFromStdin(char * buffer);
 int checkArgs(int argc, char * argv[]);
 int check_window_size(char * size);
 int check_buffer_size(char * size);
+uint16_t choosePayload(char * size, int socketNum, struct sockaddr_in6 * server, uint32_t window_size);
 int check_filename_length(char * filename, char * fromORto);
 int check_error_rate(char * rate);
 FILE * check_filename(char * filename);
+int closeOutput(int complete);
+int envFlag(char * name);
+int requestPriority(void);
+int treeRequest(char * from_filename);
+int manifestRequest(char * from_filename);
+void prepareDelta(char * to_name);
+void dropDelta(void);
+int deltaAccepted(uint8_t recvBuffer[], int messageLen);
+int uploadSignatures(int socketNum, struct sockaddr_in6 * server, socklen_t servAddrLen, uint8_t recvBuffer[], int *messageLen);
+void sendSignatures(int socketNum, struct sockaddr_in6 * server, uint32_t chunk);
+FileWriter * openDeltaOutput(char * to_name, uint16_t buffer_size);
 void printBufferInHex(const uint8_t *buffer, size_t length);
 void inOrderData(int socketNum, struct sockaddr_in6 * server, uint8_t * writingBuffer, uint16_t messageLen);
 void flushingBuffer(int socketNum, struct sockaddr_in6 *server, uint8_t recvDataBuffer[], int messageLen);
 uint32_t inOrderPacketCheck(uint8_t recvDataBuffer[]);
-void receivingData(uint8_t recvDataBuffer[], int *messageLen, struct sockaddr_in6 *server, socklen_t servAddrLen);
+void receivingData(int socketNum, uint8_t recvDataBuffer[], int *messageLen, struct sockaddr_in6 *server, socklen_t servAddrLen);
+int receiveBatch(int socketNum, struct sockaddr_in6 *server);
 void bufferingData(int socketNum, struct sockaddr_in6 * server, uint8_t recvDataBuffer[], uint16_t messageLen);
 uint8_t filenameExchange(char* argv[], int socketNum, struct sockaddr_in6 * server, socklen_t servAddrLen);
 void handleEOF(int socketNum, struct sockaddr_in6 * server, uint8_t * recvDataBuffer, uint16_t messageLen);
@@ -60,6 +101,28 @@ void handleEOF(int socketNum, struct sockaddr_in6 * server, uint8_t * recvDataBu
 uint32_t seq_num = 0;
 ReceiverBuffer* receiverBuffer = NULL;
 FILE * to_filename = NULL;
+FileWriter * fileWriter = NULL;
+uint32_t ack_every = 1;
+uint32_t acks_pending = 0;
+BlockSig * delta_sigs = NULL;  // signatures of the existing to-filename
+uint32_t delta_count = 0;
+uint32_t delta_block = 0;
+int basis_fd = -1;
+char delta_temp[PATH_MAX];     // delta is rebuilt here, then renamed over the old file
+char * delta_target = NULL;
+uint16_t payload_size = 0;     // data bytes per PDU, buffer-size or picked from the path MTU
+int auto_payload = 0;
+uint32_t kernel_drops = 0;     // datagrams our full receive queue made the kernel discard
+ArrivalStats arrivals = {0};    // gaps between data packets, kernel stamped
+TransferStats * stats = NULL;   // live counters rcopy-stat can read
+uint64_t handshakeNs = 0;       // first filename PDU went out, 0 once data arrived
+uint64_t srejNs = 0;            // SREJ for the current hole went out, 0 when none
+uint32_t requestNonce = 0;      // carried by every filename PDU, retries included
+struct mmsghdr recvBatch[RECV_BATCH];   // read ahead by one recvmmsg(), handed out one at a time
+UdpPacket recvPackets[RECV_BATCH];
+uint8_t * recvBatchData = NULL;
+int recvBatched = 0;
+int recvTaken = 0;
 
 
 
@@ -84,7 +147,14 @@ int main(int argc, char *argv[])
 	return 0;
 }
 
-void sendRRorSREJ(int socketNum, struct sockaddr_in6 * server, uint8_t flag) {uint32_t net_expected = htonl(receiverBuffer->expected);uint8_t sendDataBuffer[11];createPDU(sendDataBuffer, flag, (uint8_t *)&net_expected, 4);int sent = sendtoErr(socketNum, sendDataBuffer, 11, 0, (struct sockaddr *)server, sizeof(*server));if (sent == -1) {perror("Send error");exit(1);}return;}
+void sendRRorSREJ(int socketNum, struct sockaddr_in6 * server, uint8_t flag) {uint32_t net_expected = htonl(receiverBuffer->expected);uint8_t sendDataBuffer[11];createPDU(sendDataBuffer, flag, (uint8_t *)&net_expected, 4);if (flag == RR) acks_pending = 0;if (flag == SREJ && !srejNs) srejNs = clock_ns();stats_add((flag == RR) ? &stats->rr : &stats->srej, 1);int sent = sendtoErr(socketNum, sendDataBuffer, 11, 0, (struct sockaddr *)server, sizeof(*server));if (sent == -1) {perror("Send error");exit(1);}return;}
+
+void flushPendingAck(int socketNum, struct sockaddr_in6 * server) {
+	// RRs are cumulative, so one covers every in-order packet since the last
+	if (acks_pending) {
+		sendRRorSREJ(socketNum, server, RR);
+	}
+}
 
 void talkToServer(int socketNum, struct sockaddr_in6 * server, char* argv[]) {
     sendtoErr_init(atof(argv[5]), DROP_ON, FLIP_ON, DEBUG_ON, RSEED_ON);
@@ -92,7 +162,9 @@ void talkToServer(int socketNum, struct sockaddr_in6 * server, char* argv[]) {
     addToPollSet(socketNum);
     socklen_t servAddrLen = sizeof(server);
     uint32_t state = ST_FILENAME;
-    uint32_t buffer_size = atoi(argv[4]) + 7;
+    payload_size = choosePayload(argv[4], socketNum, server, atoi(argv[3]));
+    stats = stats_open(STATS_CLIENT, argv[1], atoi(argv[3]));
+    uint32_t buffer_size = payload_size + 7;
     uint8_t recvDataBuffer[buffer_size];
     int messageLen = 0;
 
@@ -101,7 +173,7 @@ void talkToServer(int socketNum, struct sockaddr_in6 * server, char* argv[]) {
             case ST_FILENAME: // filename exchange
                 state = filenameExchange(argv, socketNum, server, servAddrLen);
             case ST_RECVDATA: // receiving data
-                receivingData(recvDataBuffer, &messageLen, server, servAddrLen);
+                receivingData(socketNum, recvDataBuffer, &messageLen, server, servAddrLen);
 
                 // Process regular data packet
                 state = inOrderPacketCheck(recvDataBuffer);
@@ -109,7 +181,7 @@ void talkToServer(int socketNum, struct sockaddr_in6 * server, char* argv[]) {
 					if (receiverBuffer->highest > receiverBuffer->expected) {state = ST_FLUSH; break;}
                     state = ST_INORDER;
                 } else {
-					uint32_t actualNW = 0; memcpy(&actualNW, recvDataBuffer, 4); uint32_t actualHOST = ntohl(actualNW); if (actualHOST < receiverBuffer->expected) { sendRRorSREJ(socketNum, server, RR); state = ST_RECVDATA; break;} sendRRorSREJ(socketNum, server, SREJ);
+					uint32_t actualNW = 0; memcpy(&actualNW, recvDataBuffer, 4); uint32_t actualHOST = ntohl(actualNW); if (actualHOST < receiverBuffer->expected) { stats_add(&stats->duplicates, 1); sendRRorSREJ(socketNum, server, RR); state = ST_RECVDATA; break;} flushPendingAck(socketNum, server); sendRRorSREJ(socketNum, server, SREJ);
                     state = ST_BUFFER;
                 }
                 break;
@@ -121,12 +193,12 @@ void talkToServer(int socketNum, struct sockaddr_in6 * server, char* argv[]) {
 
             case ST_BUFFER: // buffering
                 bufferingData(socketNum, server, recvDataBuffer, messageLen);
-                receivingData(recvDataBuffer, &messageLen, server, servAddrLen);
+                receivingData(socketNum, recvDataBuffer, &messageLen, server, servAddrLen);
                 state = inOrderPacketCheck(recvDataBuffer);
                 if (state == 0) {
                     state = ST_FLUSH;
                 } else {
-					uint32_t actualNW = 0; memcpy(&actualNW, recvDataBuffer, 4); uint32_t actualHOST = ntohl(actualNW); if (actualHOST < receiverBuffer->expected){ sendRRorSREJ(socketNum, server, RR);}
+					uint32_t actualNW = 0; memcpy(&actualNW, recvDataBuffer, 4); uint32_t actualHOST = ntohl(actualNW); if (actualHOST < receiverBuffer->expected){ stats_add(&stats->duplicates, 1); sendRRorSREJ(socketNum, server, RR);}
                     state = ST_BUFFER;
                 }
                 break;
@@ -149,26 +221,36 @@ void handleEOF(int socketNum, struct sockaddr_in6 * server, uint8_t * recvDataBu
     uint8_t sendDataBuffer[11];
     createPDU(sendDataBuffer, EOFF, (uint8_t *)&net_expected, 4);
     
-    // Send the EOF ACK 
-	int sent = sendtoErr(socketNum, sendDataBuffer, 11, 0, (struct sockaddr *)server, sizeof(*server));
-	if (sent == -1) {
-		perror("Failed to send EOF ACK");
+    // Send the EOF ACK, twice, we are gone before a lost one could be asked for again
+	int i = 0;
+	for (i = 0; i < 2; i++) {
+		int sent = sendtoErr(socketNum, sendDataBuffer, 11, 0, (struct sockaddr *)server, sizeof(*server));
+		if (sent == -1) {
+			perror("Failed to send EOF ACK");
+		}
 	}
 
-	if (to_filename) {
-		fclose(to_filename);
-		to_filename = NULL;
-	}
+	int error = closeOutput(1);
 	if (receiverBuffer) {
 		free_receiver_buffer(receiverBuffer);
 		receiverBuffer = NULL;
 	}
+	if (error) {
+		// every packet arrived, but the file on disk is not the one that was sent
+		printf("File transfer failed.\n");
+		exit(1);
+	}
 	printf("File transfer completed successfully.\n");
 	exit(0);
 
 }
 
 void flushingBuffer(int socketNum, struct sockaddr_in6 *server, uint8_t recvDataBuffer[], int messageLen) {
+	if (srejNs) {
+		// the packet that just arrived is the one the SREJ asked for
+		if (arrivals.last_ns > srejNs) stats_latency(stats, LATENCY_REPAIR, arrivals.last_ns - srejNs);
+		srejNs = 0;
+	}
 	// Write the received in-order data to disk
     inOrderData(socketNum, server, recvDataBuffer, messageLen);
 
@@ -184,6 +266,8 @@ void flushingBuffer(int socketNum, struct sockaddr_in6 *server, uint8_t recvData
 			inOrderData(socketNum, server, (uint8_t *)fetched_data, data_size);
 		}
 	}
+	// hole repaired, let the server slide its window right away
+	flushPendingAck(socketNum, server);
 }
 
 uint32_t inOrderPacketCheck(uint8_t recvDataBuffer[]) {
@@ -191,40 +275,68 @@ uint32_t inOrderPacketCheck(uint8_t recvDataBuffer[]) {
     memcpy(&actualNW, recvDataBuffer, 4);
     uint32_t actualHOST = ntohl(actualNW);
 
+    // not the sequence number itself, a late duplicate of packet 0 would look in order
     if (actualHOST == receiverBuffer->expected) {
         return 0;
     } else {
-        return actualHOST;
+        return 1;
     }
 }
 
-void receivingData(uint8_t recvDataBuffer[], int *messageLen, struct sockaddr_in6 *server, socklen_t servAddrLen) {
+void receivingData(int socketNum, uint8_t recvDataBuffer[], int *messageLen, struct sockaddr_in6 *server, socklen_t servAddrLen) {
     uint8_t count = 0;
     *messageLen = 0;
 
     do {
-        int serverSocket = pollCall(10000); // 10 seconds IG
-        if (serverSocket == -1) {
-            count++;
-
-            continue;
-        } else {
-			//printf("buffer size: %d\n", receiverBuffer->buffer_size);
-
-            memset(recvDataBuffer, 0, receiverBuffer->buffer_size);
-
-            if ((*messageLen = recvfrom(serverSocket, recvDataBuffer, receiverBuffer->buffer_size, 0, (struct sockaddr *)server, &servAddrLen)) < 0) {
+        // take whatever is already queued first, poll() only when the socket
+        // is empty. One read brings up to RECV_BATCH datagrams and the
+        // kernel's stamps along with them.
+        if (recvTaken == recvBatched && receiveBatch(socketNum, server) < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
                 perror("recv call");
                 exit(-1);
             }
-
+            // short wait while an ack is being held back, 10 seconds otherwise
+            if (pollCall(acks_pending ? ACK_DELAY_MS : 10000) == -1) {
+                if (acks_pending) {
+                    flushPendingAck(socketNum, server);
+                    continue;
+                }
+                count++;
+            }
+            continue;
+        } else {
+            UdpPacketInfo info;
+            *messageLen = recvBatch[recvTaken].msg_len;
+            memcpy(recvDataBuffer, recvPackets[recvTaken].iov.iov_base, *messageLen);
+
+            // the kernel's running drop count and arrival time
+            udpPacketInfo(&recvPackets[recvTaken], &info);
+            recvTaken++;
+            kernel_drops = info.drops;
+            stats_set(&stats->kernel_drops, kernel_drops);
+            stats_add(&stats->packets, 1);
+            if (info.hardware_ns) {
+                arrival_sample(&arrivals, info.hardware_ns);
+            } else {
+                arrival_sample(&arrivals, info.software_ns ? stamp_clock_ns(info.software_ns) : clock_ns());
+            }
 
             uint16_t calculatedChecksum = in_cksum((unsigned short *)recvDataBuffer, *messageLen);
             if (calculatedChecksum) {
                 //printf("Checksum mismatch. Discarding packet.\n");
+                stats_add(&stats->checksum_failures, 1);
                 count++;
                 continue;
             } 
+            if (recvDataBuffer[6] != DPACK && recvDataBuffer[6] != DPACK_PACKED && recvDataBuffer[6] != EOFF) {
+                // a late answer to the filename PDU, RFLNM or BUSY, is no data
+                continue;
+            }
+            if (handshakeNs) {
+                if (arrivals.last_ns > handshakeNs) stats_latency(stats, LATENCY_HANDSHAKE, arrivals.last_ns - handshakeNs);
+                handshakeNs = 0;
+            }
 
             break;
         }
@@ -233,9 +345,7 @@ void receivingData(uint8_t recvDataBuffer[], int *messageLen, struct sockaddr_in
 
     if (count >= 10) {
         printf("Data receiving timed out. Terminating.\n");
-        if (to_filename) {
-            fclose(to_filename);
-        }
+        closeOutput(0);
         if (receiverBuffer) {
             free_receiver_buffer(receiverBuffer);
         }
@@ -244,6 +354,33 @@ void receivingData(uint8_t recvDataBuffer[], int *messageLen, struct sockaddr_in
     return;
 }
 
+int receiveBatch(int socketNum, struct sockaddr_in6 *server) {
+    // refills the batch, the number of datagrams read or -1 with errno set
+    size_t slot = receiverBuffer->buffer_size;
+    if (recvBatchData == NULL) {
+        recvBatchData = malloc(RECV_BATCH * slot);
+        if (recvBatchData == NULL) {
+            perror("malloc");
+            exit(1);
+        }
+    }
+    int i = 0;
+    for (i = 0; i < RECV_BATCH; i++) {
+        udpPacketSetup(&recvPackets[i], recvBatchData + i * slot, slot, server);
+        recvBatch[i].msg_hdr = recvPackets[i].msg;
+    }
+    recvTaken = 0;
+    recvBatched = recvmmsg(socketNum, recvBatch, RECV_BATCH, MSG_DONTWAIT, NULL);
+    if (recvBatched < 0) {
+        recvBatched = 0;
+        return -1;
+    }
+    for (i = 0; i < recvBatched; i++) {
+        recvPackets[i].msg = recvBatch[i].msg_hdr;     // the kernel filled in the copy
+    }
+    return recvBatched;
+}
+
 void bufferingData(int socketNum, struct sockaddr_in6 * server, uint8_t recvDataBuffer[], uint16_t messageLen) {
 	// send SREJ for expected
 	uint32_t net_expected = htonl(receiverBuffer->expected);
@@ -262,6 +399,7 @@ void bufferingData(int socketNum, struct sockaddr_in6 * server, uint8_t recvData
 	uint32_t actualHOST = ntohl(actualNW);
 
 	add_packet_to_buffer(receiverBuffer, actualHOST, (const char *)recvDataBuffer, messageLen);
+	stats_set(&stats->window_used, receiverBuffer->highest - receiverBuffer->expected + 1);
 	return;
 }
 
@@ -275,19 +413,21 @@ void inOrderData(int socketNum, struct sockaddr_in6 * server, uint8_t * writingB
 		handleEOF(socketNum, server, writingBuffer, messageLen);
 	}
 	
-	// Write data to file
-	fwrite((const void *)(writingBuffer + 7), 1, messageLen - 7, to_filename);
+	// Hand the data to the writer thread
+	if (flag == DPACK_PACKED) {
+		queue_packed(fileWriter, writingBuffer + 7, messageLen - 7);
+	} else {
+		queue_write(fileWriter, writingBuffer + 7, messageLen - 7);
+	}
 	
-	// Update expected sequence number
+	// Update expected sequence number, RR is sent every ack_every packets
 	(receiverBuffer->expected)++;
-	uint32_t net_expected = htonl(receiverBuffer->expected);
-	uint8_t sendDataBuffer[11];
-	createPDU(sendDataBuffer, RR, (uint8_t *)&net_expected, 4);
-
-	int sent = sendtoErr(socketNum, sendDataBuffer, 11, 0, (struct sockaddr *)server, sizeof(*server));
-	if (sent == -1) {
-		perror("Send error");
-		exit(1);
+	stats_add(&stats->bytes, messageLen - 7);
+	stats_set(&stats->window_used, (receiverBuffer->highest >= receiverBuffer->expected) ?
+		receiverBuffer->highest - receiverBuffer->expected + 1 : 0);
+	acks_pending++;
+	if (acks_pending >= ack_every) {
+		sendRRorSREJ(socketNum, server, RR);
 	}
 
 	return;
@@ -300,6 +440,14 @@ uint8_t filenameExchange(char* argv[], int socketNum, struct sockaddr_in6 * serv
     //int serverSocket = 0;
     int messageLen = 0;
 
+    if (envFlag("RCOPY_DELTA") && !treeRequest(argv[1])) {
+        prepareDelta(argv[2]);
+    }
+
+    handshakeNs = clock_ns();
+    // the server knows a retry of a request it already started by this
+    requestNonce = (uint32_t)(handshakeNs ^ (handshakeNs >> 32) ^ ((uint32_t)getpid() << 16));
+    int busy = 0;
     do {
         filenameExchangePacket(argv, server, socketNum);
         
@@ -323,6 +471,12 @@ uint8_t filenameExchange(char* argv[], int socketNum, struct sockaddr_in6 * serv
                 count++;
                 continue;
             }
+            if (recvBuffer[6] == BUSY) {
+                // not a failure, the server answered, just not yet
+                if (!busy++) printf("Server busy, waiting for a session\n");
+                pollCall(1000);
+                continue;
+            }
             break;
         } else {
             // Error in poll
@@ -339,19 +493,45 @@ uint8_t filenameExchange(char* argv[], int socketNum, struct sockaddr_in6 * serv
     uint8_t flag = 0;
     memcpy(&flag, recvBuffer + 6, 1);
 	    // response to filename packet
+	// the first data PDU is the answer, only an accepted delta gets an RFLNM
+	// first. Whether the server compresses shows in each data PDU's flag.
 
-	if (flag == 33) {
+	if (flag == FNAME_MISSING) {
 		printf("Error: file %s not found.\n", argv[1]);
         exit(1);
 	} else {
-		to_filename = check_filename(argv[2]);
-        uint16_t buffer_size = atoi(argv[4]) + 7;
+        uint16_t buffer_size = payload_size + 7;
         uint32_t window_size = atoi(argv[3]);
 		receiverBuffer = create_receiver_buffer(window_size, buffer_size);
+		if (flag == RFLNM && delta_sigs != NULL && deltaAccepted(recvBuffer, messageLen)) {
+			if (uploadSignatures(socketNum, server, servAddrLen, recvBuffer, &messageLen)) {
+				// the server already started sending, handle that packet below
+				flag = recvBuffer[6];
+			}
+			fileWriter = openDeltaOutput(argv[2], buffer_size);
+		} else if (treeRequest(argv[1])) {
+			fileWriter = create_tree_writer(argv[2], buffer_size, envFlag("RCOPY_SYNC_RANGE"));
+		} else {
+			dropDelta();
+			to_filename = check_filename(argv[2]);
+			fileWriter = create_file_writer(fileno(to_filename), buffer_size, envFlag("RCOPY_ODIRECT"), envFlag("RCOPY_SYNC_RANGE"));
+		}
+		if (fileWriter == NULL) {
+			perror("Failed to create file writer");
+			exit(1);
+		}
+		if (envFlag("RCOPY_COMPRESS") && enable_decompression(fileWriter)) {
+			perror("Failed to set up decompression");
+			exit(1);
+		}
+		// coalesce acks only when the window has room for several of them
+		ack_every = (window_size >= 2 * ACK_COALESCE) ? ACK_COALESCE : 1;
 		if (flag == 9) {
 			//printf("File OK!\n");
 			return ST_RECVDATA;
 		} else {
+		stats_latency(stats, LATENCY_HANDSHAKE, clock_ns() - handshakeNs);
+		handshakeNs = 0;
 		uint8_t inOrder = inOrderPacketCheck(recvBuffer);
 		if (inOrder == 0) {
 			inOrderData(socketNum, server, recvBuffer, messageLen);
@@ -366,17 +546,48 @@ uint8_t filenameExchange(char* argv[], int socketNum, struct sockaddr_in6 * serv
 
 void filenameExchangePacket(char* argv[], struct sockaddr_in6 * server, int socketNum) {
 	uint32_t window_size = atoi(argv[3]);
-	uint16_t buffer_size = atoi(argv[4]);
+	uint16_t buffer_size = payload_size;
 	char from_filename[101];
-	strcpy(from_filename, argv[1]);
+	strcpy(from_filename, argv[1] + manifestRequest(argv[1]));
 	uint8_t filename_size = strlen(from_filename);
-	uint8_t filenamePacket[107];
+	uint8_t filenamePacket[122];
 	memcpy(filenamePacket, &window_size, 4);
 	memcpy(filenamePacket+4, &buffer_size, 2);
 	memcpy(filenamePacket+6, from_filename, filename_size + 1);
+	// options byte after the filename, older servers stop reading at the NUL
+	filenamePacket[filename_size + 7] = treeRequest(argv[1]) ? FNAME_OPT_TREE : 0;
+	if (manifestRequest(argv[1])) {
+		filenamePacket[filename_size + 7] |= FNAME_OPT_MANIFEST;
+	}
+	if (envFlag("RCOPY_COMPRESS")) {
+		filenamePacket[filename_size + 7] |= FNAME_OPT_COMPRESS;
+	}
+	if (auto_payload) {
+		filenamePacket[filename_size + 7] |= FNAME_OPT_PMTU;
+	}
 
 	uint8_t sendBuf[MAXBUF];
-	filename_size += 7;
+	filename_size += 8;
+	uint8_t *options = &filenamePacket[filename_size - 1];
+	if (delta_sigs != NULL) {
+		// block size and count of the signatures we will upload
+		uint32_t deltaNW[2] = { htonl(delta_block), htonl(delta_count) };
+		*options |= FNAME_OPT_DELTA;
+		memcpy(filenamePacket + filename_size, deltaNW, 8);
+		filename_size += 8;
+	}
+	if (getenv("RCOPY_WEIGHT") && atoi(getenv("RCOPY_WEIGHT")) > 0) {
+		// the server clamps it to its own maximum
+		*options |= FNAME_OPT_WEIGHT;
+		filenamePacket[filename_size++] = (atoi(getenv("RCOPY_WEIGHT")) > 255) ? 255 : atoi(getenv("RCOPY_WEIGHT"));
+	}
+	if (requestPriority() >= 0) {
+		*options |= FNAME_OPT_PRIORITY;
+		filenamePacket[filename_size++] = requestPriority();
+	}
+	*options |= FNAME_OPT_NONCE;
+	memcpy(filenamePacket + filename_size, &requestNonce, 4);
+	filename_size += 4;
 
 	createPDU(sendBuf, SFLNM, filenamePacket, filename_size);
 	//printBufferInHex(sendBuf, filename_size+7);
@@ -401,13 +612,7 @@ void printBufferInHex(const uint8_t *buffer, size_t length) {
 }
 
 void createPDU(uint8_t sendBuf[], uint8_t flag, uint8_t buffer[], uint16_t bufSize) {
-    uint32_t seq_num_NW = htonl(seq_num);
-    memcpy(sendBuf, &seq_num_NW, 4);
-    memset(sendBuf + 4, 0, 2);
-    sendBuf[6] = flag;
-    memcpy(sendBuf+7, buffer, bufSize);
-    uint16_t checksum = in_cksum((unsigned short *)sendBuf, bufSize + 7);
-    memcpy(sendBuf + 4, &checksum, 2);
+    build_pdu(sendBuf, seq_num, flag, buffer, bufSize);
     seq_num++;
 }
 
@@ -429,6 +634,192 @@ FILE * check_filename(char * filename) {
 	
 }
 
+int closeOutput(int complete) {
+	// let the writer thread finish its queue before the file goes away
+	WriterStats written = {0};
+	int error = 0;
+	int tree = 0;
+	if (fileWriter) {
+		tree = fileWriter->tree;
+		error = close_file_writer(fileWriter, &written);
+		fileWriter = NULL;
+		if (error) {
+			printf("Error writing output file\n");
+		}
+		if (tree) {
+			printf("Received %llu files\n", (unsigned long long)written.files);
+		}
+	}
+	if (kernel_drops) {
+		// these never left the machine, a bigger window needs a bigger buffer
+		printf("Kernel dropped %u packets on a full receive queue\n", kernel_drops);
+	}
+	if (arrivals.count) {
+		printf("Inter-arrival: %llu gaps, mean %.1f us, stddev %.1f us, max %.1f us\n",
+			(unsigned long long)arrivals.count, arrivals.mean_ns / 1000.0,
+			arrival_stddev_ns(&arrivals) / 1000.0, arrivals.max_ns / 1000.0);
+	}
+	stats_print_latency(stdout, stats, "");
+	if (to_filename) {
+		fclose(to_filename);
+		to_filename = NULL;
+	}
+	if (delta_temp[0] != '\0') {
+		// the old file stays untouched unless the new one is complete
+		if (complete && !error && rename(delta_temp, delta_target) != 0) {
+			perror("Error renaming output file");
+			error = 1;
+		} else if (complete && !error) {
+			printf("Delta: reused %llu of %llu bytes\n",
+				(unsigned long long)written.reused, (unsigned long long)written.bytes);
+		}
+		if (error || !complete) {
+			unlink(delta_temp);
+		}
+		delta_temp[0] = '\0';
+		dropDelta();
+	}
+	return error;
+}
+
+int treeRequest(char * from_filename) {
+	// a trailing slash asks for the directory and everything below it
+	size_t length = strlen(from_filename);
+	return manifestRequest(from_filename) || (length > 0 && from_filename[length - 1] == '/');
+}
+
+int manifestRequest(char * from_filename) {
+	// @list asks for the paths listed in the server's file list, as a tree
+	return from_filename[0] == '@';
+}
+
+void prepareDelta(char * to_name) {
+	basis_fd = open(to_name, O_RDONLY);
+	if (basis_fd < 0) {
+		return;
+	}
+	struct stat st;
+	if (fstat(basis_fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+		dropDelta();
+		return;
+	}
+	delta_block = delta_block_size(st.st_size);
+	delta_sigs = compute_signatures(basis_fd, delta_block, &delta_count);
+	if (delta_count == 0) {
+		// nothing to reuse, a plain transfer is cheaper
+		dropDelta();
+	}
+}
+
+void dropDelta(void) {
+	free(delta_sigs);
+	delta_sigs = NULL;
+	delta_count = 0;
+	if (basis_fd >= 0) {
+		close(basis_fd);
+		basis_fd = -1;
+	}
+}
+
+int deltaAccepted(uint8_t recvBuffer[], int messageLen) {
+	// servers that ignore the delta option answer plain "file OK"
+	return messageLen >= 16 && memcmp(recvBuffer + 7, "delta OK", 9) == 0;
+}
+
+int uploadSignatures(int socketNum, struct sockaddr_in6 * server, socklen_t servAddrLen, uint8_t recvBuffer[], int *messageLen) {
+	// stop and wait, the server acks each chunk with an RR for the next one
+	uint32_t chunks = (delta_count + SIGS_PER_PDU - 1) / SIGS_PER_PDU;
+	uint32_t chunk = 0;
+	uint8_t count = 0;
+
+	while (chunk < chunks) {
+		if (count == 10) {
+			printf("Failed to send signatures. Terminating.\n");
+			exit(1);
+		}
+		sendSignatures(socketNum, server, chunk);
+		if (pollCall(1000) != socketNum) {
+			count++;
+			continue;
+		}
+		if ((*messageLen = recvfrom(socketNum, recvBuffer, MAXBUF, 0, (struct sockaddr *)server, &servAddrLen)) < 0) {
+			perror("recv call");
+			exit(-1);
+		}
+		if (in_cksum((unsigned short *)recvBuffer, *messageLen)) {
+			continue;
+		}
+		uint8_t flag = recvBuffer[6];
+		if (flag == RR) {
+			uint32_t nextNW = 0;
+			memcpy(&nextNW, recvBuffer + 7, 4);
+			if (ntohl(nextNW) > chunk) {
+				chunk = ntohl(nextNW);
+				count = 0;
+			}
+		} else if (flag == DPACK || flag == DPACK_PACKED || flag == EOFF) {
+			// the last RR was lost, but data means the server has them all
+			return 1;
+		}
+	}
+	return 0;
+}
+
+void sendSignatures(int socketNum, struct sockaddr_in6 * server, uint32_t chunk) {
+	uint8_t payload[4 + SIGS_PER_PDU * SIG_SIZE];
+	uint32_t first = chunk * SIGS_PER_PDU;
+	uint32_t sigs = delta_count - first;
+	if (sigs > SIGS_PER_PDU) {
+		sigs = SIGS_PER_PDU;
+	}
+	uint32_t chunkNW = htonl(chunk);
+	memcpy(payload, &chunkNW, 4);
+	uint32_t i = 0;
+	for (i = 0; i < sigs; i++) {
+		put_signature(payload + 4 + i * SIG_SIZE, &delta_sigs[first + i]);
+	}
+
+	uint8_t sendBuf[MAXBUF];
+	uint16_t length = 4 + sigs * SIG_SIZE;
+	createPDU(sendBuf, SIG, payload, length);
+	int sent = sendtoErr(socketNum, sendBuf, length + 7, 0, (struct sockaddr *)server, sizeof(*server));
+	if (sent <= 0) {
+		perror("send call");
+		exit(-1);
+	}
+}
+
+FileWriter * openDeltaOutput(char * to_name, uint16_t buffer_size) {
+	snprintf(delta_temp, sizeof(delta_temp), "%s.rcopy-XXXXXX", to_name);
+	int fd = mkstemp(delta_temp);
+	if (fd < 0) {
+		perror("Error on open of output file");
+		exit(1);
+	}
+	struct stat st;
+	if (fstat(basis_fd, &st) == 0) {
+		fchmod(fd, st.st_mode & 0777);
+	}
+	delta_target = to_name;
+	to_filename = fdopen(fd, "wb");
+	return create_delta_writer(fd, basis_fd, delta_block, buffer_size, envFlag("RCOPY_SYNC_RANGE"));
+}
+
+int envFlag(char * name) {
+	char * value = getenv(name);
+	return (value != NULL) && (atoi(value) != 0);
+}
+
+int requestPriority(void) {
+	// -1 when RCOPY_PRIORITY is unset or unknown, the server assumes normal
+	char * value = getenv("RCOPY_PRIORITY");
+	if (value == NULL) return -1;
+	if (strcmp(value, "interactive") == 0) return PRIORITY_INTERACTIVE;
+	if (strcmp(value, "bulk") == 0) return PRIORITY_BULK;
+	if (strcmp(value, "normal") == 0) return PRIORITY_NORMAL;
+	return -1;
+}
+
 
 
 int checkArgs(int argc, char * argv[])
@@ -461,14 +852,52 @@ int check_window_size(char * size){
 }
 
 int check_buffer_size(char * size) {
+	if (strcmp(size, "auto") == 0) {
+		return 0;
+	}
 	uint16_t buffer_size = atoi(size);
-	if ((buffer_size < 1) || (buffer_size > 1400)) {
-		printf("buffer size is out of range. please input an amount between 1 and 1400.\n");
+	if ((buffer_size < 1) || (buffer_size > PAYLOAD_LIMIT)) {
+		printf("buffer size is out of range. please input an amount between 1 and %d, or auto.\n", PAYLOAD_LIMIT);
 		return 1;
 	}
 	return 0;
 }
 
+uint16_t choosePayload(char * size, int socketNum, struct sockaddr_in6 * server, uint32_t window_size) {
+	// count what the kernel drops for want of queue space, not the network
+	udpTrackDrops(socketNum);
+	udpEnableTimestamps(socketNum);
+	if (strcmp(size, "auto") != 0) {
+		udpSetBufferSize(socketNum, udpWindowBytes(window_size, atoi(size) + 7), 0);
+		return atoi(size);
+	}
+	auto_payload = 1;
+
+	// the biggest PDU the path carries unfragmented, loopback and jumbo
+	// frame paths go well past the 1400 limit
+	int payload = udpPathMtu(server) - 7;
+	if (payload <= 0) {
+		payload = PAYLOAD_LIMIT;
+	}
+	int pathPayload = payload;
+
+	// but a whole window of them still has to fit our receive buffer,
+	// a burst that overflows it is lost all at once
+	int rcvbuf = udpSetBufferSize(socketNum, udpWindowBytes(window_size, payload + 7), 0);
+	if (rcvbuf > 0) {
+		int fits = rcvbuf / 2 / window_size - 7;
+		int floor = (pathPayload < PAYLOAD_LIMIT) ? pathPayload : PAYLOAD_LIMIT;
+		if (payload > fits) {
+			payload = (fits > floor) ? fits : floor;
+		}
+	}
+	if (payload > PAYLOAD_MAX - 7) {
+		payload = PAYLOAD_MAX - 7;
+	}
+	printf("Buffer size: %d bytes (path allows %d)\n", payload, pathPayload);
+	return payload;
+}
+
 
 int check_filename_length(char * filename, char * fromORto) {
 	if ((strlen(filename) > 100)) {
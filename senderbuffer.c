@@ -30,6 +30,8 @@ void add_packet_to_window(SenderWindow *window, int sequence_number, const char
     window->buffer[index]->sequence_number = sequence_number;
     window->buffer[index]->data_size = data_size;
     window->buffer[index]->valid = 0;
+    window->buffer[index]->sent_ns = 0;
+    window->buffer[index]->sends = 0;
     memcpy(window->buffer[index]->data, data, data_size);
     window->current++;
 }
@@ -37,6 +39,9 @@ void add_packet_to_window(SenderWindow *window, int sequence_number, const char
 void acknowledge_packet(SenderWindow *window, int sequence_number) {
     int i = 0;
 
+    // RRs are cumulative and may be sparse, an old one must not pull lower back
+    if (sequence_number < window->lower) return;
+
     for ( i = window->lower; i <= sequence_number; i++) {
         int index = i % window->window_size;
         if (window->buffer[index] && window->buffer[index]->sequence_number <= sequence_number) {
@@ -1,6 +1,7 @@
 /* Server side - UDP Code				    */
 /* By Hugh Smith	4/1/2017	*/
 
+#define _GNU_SOURCE     // sendmmsg/recvmmsg
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -11,6 +12,9 @@
 #include <arpa/inet.h>
 #include <signal.h>
 #include <sys/wait.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <errno.h>
 
 #include "gethostbyname.h"
 #include "networks.h"
@@ -18,6 +22,14 @@
 #include "cpe464.h"
 #include "pollLib.h"
 #include "buffer.h"
+#include "filereader.h"
+#include "filecache.h"
+#include "timing.h"
+#include "pdu.h"
+#include "stats.h"
+#include "timerwheel.h"
+#include "sessions.h"
+#include "egress.h"
 
 #define MAXBUF 1407
 #define RR 5
@@ -26,31 +38,110 @@
 #define RFLNM 9
 #define EOFF 10
 #define DPACK 16
+#define DPACK_PACKED 19     // data in compress.h's framing, every PDU says which it is
+#define SIG 18
+#define FNAME_MISSING 33
+#define BUSY 34             // at the session limit, rcopy asks again later
 #define ST_RECVDATA 0
 #define ST_FILENAME 1
 #define ST_INORDER 2
 #define ST_BUFFER 3
 #define ST_FLUSH 4
 #define ST_EOF 5
+#define ACK_DRAIN_EVERY 8   // packets sent between checks for RR/SREJ
+#define SEND_BATCH ACK_DRAIN_EVERY // new data PDUs handed to the kernel in one sendmmsg
+#define ACK_BATCH 16        // RR/SREJs taken in one recvmmsg
+#define FNAME_OPT_TREE 0x01 // filename packet option: send the whole directory
+#define FNAME_OPT_DELTA 0x02 // send a delta against the client's signatures
+#define FNAME_OPT_COMPRESS 0x04 // compress data payloads
+#define FNAME_OPT_PMTU 0x08 // buffer size follows the path MTU, never fragment
+#define FNAME_OPT_WEIGHT 0x10 // a weight byte follows, the session's share of a capped egress
+#define FNAME_OPT_PRIORITY 0x20 // a priority byte follows the weight, an EGRESS_ class
+#define FNAME_OPT_NONCE 0x40 // 4 bytes follow the priority, the same in each retry of a request
+#define FNAME_OPT_MANIFEST 0x80 // with FNAME_OPT_TREE, the file lists the paths to send
+#define TREE_WALK 1         // filenamePacketCheck's tree: a directory and everything below it
+#define TREE_LISTED 2       // the paths a manifest file names
+#define SEND_NEW 0          // why sendDataPDU is putting a PDU on the wire
+#define SEND_SREJ 1
+#define SEND_TIMEOUT 2
+#define SEND_PROBE 3
+#define PROBE_ACK_DELAY_NS 10000000ULL  // rcopy holds an RR back up to ACK_DELAY_MS
+#define EOF_COPIES 2        // nothing follows the EOF to show it was lost
+#define CLIENT_SILENT_NS 10000000000ULL // nothing heard for this long ends the session
+#define DSCP_INTERACTIVE 34 // AF41, with RCOPY_DSCP set
+#define DSCP_BULK 8         // CS1, lower effort
+#define BULK_NICE 10        // uncapped, the CPU is what sessions share
 
 void processClient(int socketNum);
-int filenamePacketCheck(int messageLen, uint8_t buff[], char filename[], FILE **from_filename);
+int filenamePacketCheck(int messageLen, uint8_t buff[], char filename[], FILE **from_filename, int *tree);
 int checkArgs(int argc, char *argv[]);
 FILE * check_filename(char * filename);
+int sendDataPDU(int socketNum, uint8_t * pdu, int length, struct sockaddr_in6 * client, int cause);
+void stampDataPDU(uint8_t * pdu, int length, int cause);
+int transmitPDU(int socketNum, uint8_t * pdu, int length, struct sockaddr_in6 * client);
+void queueDataPDU(int socketNum, uint8_t * pdu, int length, struct sockaddr_in6 * client);
+void flushDataPDUs(int socketNum, struct sockaddr_in6 * client);
 void createPDU(uint8_t sendBuf[], uint32_t seq_num, uint8_t flag, uint8_t buffer[], uint16_t bufSize);
-void sendingData(int socketNum, struct sockaddr_in6 *client, FILE * from_filename, int count);
+void sendingData(int socketNum, struct sockaddr_in6 *client, FILE * from_filename);
 void check_error_rate(char * rate);
-void handleEndOfFile(int socketNum, struct sockaddr_in6 * client, int count);
-int checkRRSandSREJs(int socketNum, struct sockaddr_in6 * client, int count);
+void handleEndOfFile(int socketNum, struct sockaddr_in6 * client);
+int awaitAcks(int socketNum, struct sockaddr_in6 * client);
+void retransmitExpired(int socketNum, struct sockaddr_in6 * client);
+uint64_t probeTimeout(void);
+void sendEOF(int socketNum, struct sockaddr_in6 * client);
+int drainAcks(int socketNum, struct sockaddr_in6 * client);
+int checkRRSandSREJs(int socketNum, struct sockaddr_in6 * client, uint8_t * recvBuff, int messageLen, uint64_t arrived);
+int readaheadDepth(void);
+size_t cacheBudget(void);
+int maxSessions(void);
+uint64_t egressRate(void);
+int admitRequest(int socketNum, struct sockaddr_in6 * client, uint8_t * buff, int messageLen);
+uint32_t requestNonce(uint8_t * buff, int messageLen);
+int receiveSignatures(int socketNum, struct sockaddr_in6 * client, uint8_t * reply, int replyLen);
+int compressThreads(void);
+void mappingTruncated(int sig);
 
 SenderWindow * senderBuffer = NULL;
+FileReader * fileReader = NULL;
+FileCache fileCache;
+SessionTable sessionTable;      // parent: children still running
+Egress * egress = NULL;         // shared by every session, decides whose PDU goes next
+int egressSlot = -1;
+uint32_t sessionWeight = 1;     // from the filename PDU
+uint32_t sessionPriority = EGRESS_NORMAL;
+uint64_t egressStart = 0;       // all sessions' bytes when this one joined
+DeltaIndex * deltaIndex = NULL;
+int compressPayload = 0;    // compression workers for this session, 0 = raw
+int pathMtuSizing = 0;      // client sized PDUs to the path MTU, keep them unfragmented
+RttEstimator rtt;           // from RRs of packets sent once, kernel stamped
+uint64_t lastRetransmitNs = 0;  // RRs of packets sent before it are not sampled
+TimerWheel retransmitWheel;     // a deadline per unacked data PDU, rto after its last send
+WheelTimer * retransmitTimers = NULL;   // indexed like the window, sequence % window_size
+uint64_t lastBackoffNs = 0;     // a flight that times out backs the rto off once
+uint64_t lastHeardNs = 0;       // any datagram from the client
+struct mmsghdr sendBatch[SEND_BATCH];   // new data PDUs not yet handed to the kernel
+struct iovec sendBatchIov[SEND_BATCH];
+int sendBatched = 0;
+WheelTimer probeTimer;          // tail loss probe, armed while only the tail is unacked
+WheelTimer eofTimer;            // the EOF is not in the window, it has a timer of its own
+WheelTimer paceTimer;           // the egress scheduler's turn comes back around
+uint8_t eofPDU[8];
+TransferStats * stats = NULL;   // live counters rcopy-stat can read
 uint32_t seqNum = 0;
 
 int main ( int argc, char *argv[]  )
 { 
     int socketNum = 0;                
     int portNumber = 0;
-    signal(SIGCHLD, SIG_IGN);
+    init_file_cache(&fileCache, cacheBudget());
+    if (init_session_table(&sessionTable, maxSessions()) < 0) {
+        perror("session table");
+        exit(-1);
+    }
+    egress = egress_create(maxSessions(), egressRate());
+    if (egress == NULL) {
+        perror("egress scheduler, sessions send unscheduled");
+    }
 
     portNumber = checkArgs(argc, argv);
         
@@ -74,17 +165,30 @@ void processClient(int socketNum)
         int messageLen = 0;
         setupPollSet();
         addToPollSet(socketNum);
-        int clientSocket = pollCall(-1);
+        // wake now and then while children run, so the finished ones get reaped
+        int clientSocket = pollCall(sessionTable.live ? 1000 : POLL_WAIT_FOREVER);
+        reap_sessions(&sessionTable);
+        if (clientSocket == -1) {
+            continue;
+        }
         if ((messageLen = recvfrom(clientSocket, recvBuff, MAXBUF, 0, (struct sockaddr *)&client, &addrLen)) < 0)
         {
             // no message, recv again
             continue;
         }
 
+        // retries and requests past the session limit go no further,
+        // before any file is opened
+        if (!admitRequest(socketNum, &client, recvBuff, messageLen)) {
+            continue;
+        }
+        uint32_t nonce = requestNonce(recvBuff, messageLen);
+
         // check filename packet validity and the from-filename
         char filename[101];
         FILE * from_filename = NULL;
-        int valid = filenamePacketCheck(messageLen, recvBuff, filename, &from_filename);
+        int tree = 0;
+        int valid = filenamePacketCheck(messageLen, recvBuff, filename, &from_filename, &tree);
         if (valid == 1) {
             printf("Invalid filename packet.\n");
             continue;
@@ -94,7 +198,7 @@ void processClient(int socketNum)
             uint8_t smallBuf[1]; 
             uint8_t sendBuff[MAXBUF];
             memset(smallBuf, 0, 1);
-            createPDU(sendBuff, 1, 33, smallBuf, 1);
+            createPDU(sendBuff, 1, FNAME_MISSING, smallBuf, 1);
             int sent = sendtoErr(socketNum, sendBuff, 8, 0, (struct sockaddr *)&client, sizeof(client));
             if (sent <= 0)
             {
@@ -104,7 +208,14 @@ void processClient(int socketNum)
             continue;
 
         } else {
-            // good filename packet
+            // good filename packet, map it once here so every session shares it
+            size_t cachedLength = 0;
+            const uint8_t * cached = NULL;
+            if (!tree) {
+                cached = cache_lookup(&fileCache, filename, fileno(from_filename), &cachedLength);
+                print_cache_stats(&fileCache);
+            }
+            fflush(stdout);     // or the child repeats our buffered output
             pid_t pid = fork();
             if (pid < 0) {
                 perror("fork failed");
@@ -112,39 +223,165 @@ void processClient(int socketNum)
             } else if (pid == 0) {
                 // child
                 close(socketNum); // Close parent's socket
+                struct sigaction bus;
+                memset(&bus, 0, sizeof(bus));
+                bus.sa_handler = mappingTruncated;
+                sigaction(SIGBUS, &bus, NULL);
                 int newSocket = udpServerSetup(0);  // New socket for child
                 if (newSocket < 0) {
                     perror("Failed to create new socket");
                     exit(-1);
                 }
-                char messageBuf[256]; 
-                int size = snprintf(messageBuf, sizeof(messageBuf), "file OK"); 
-                uint8_t sendBuf[MAXBUF];
-                createPDU(sendBuf, 1, RFLNM, (uint8_t *)messageBuf, size +1);
-                int sent = sendtoErr(newSocket, sendBuf, size + 8, 0, (struct sockaddr *)&client, sizeof(client));
-                if (sent <= 0) {
-                    perror("send call");
+                if (pathMtuSizing) {
+                    udpPathMtuDiscovery(newSocket, 1);
+                }
+                // room to queue a whole window of data without blocking
+                udpSetBufferSize(newSocket, 0, udpWindowBytes(senderBuffer->window_size, senderBuffer->buffer_size + 7));
+                udpEnableTimestamps(newSocket);
+                if (sessionPriority != EGRESS_NORMAL && getenv("RCOPY_DSCP") && atoi(getenv("RCOPY_DSCP"))) {
+                    udpSetTrafficClass(newSocket, (sessionPriority == EGRESS_INTERACTIVE) ? DSCP_INTERACTIVE : DSCP_BULK);
+                }
+                if (sessionPriority == EGRESS_BULK) {
+                    setpriority(PRIO_PROCESS, 0, BULK_NICE);
+                }
+                rtt_init(&rtt);
+                wheel_init(&retransmitWheel, clock_ns());
+                retransmitTimers = calloc(senderBuffer->window_size, sizeof(WheelTimer));
+                lastHeardNs = clock_ns();
+                stats = stats_open(STATS_SERVER, filename, senderBuffer->window_size);
+                egressSlot = egress_join(egress, sessionWeight, sessionPriority);
+                egressStart = egress ? atomic_load(&egress->bytes) : 0;
+                // Handle file transfer with the client. Only a delta waits for
+                // an answer to go first, otherwise the first data PDU is the OK
+                // and rcopy takes the compression it asked for as accepted.
+                if (deltaIndex) {
+                    char messageBuf[256]; 
+                    int size = snprintf(messageBuf, sizeof(messageBuf), "delta OK"); 
+                    // options we honour follow the string
+                    messageBuf[size + 1] = compressPayload ? FNAME_OPT_COMPRESS : 0;
+                    uint8_t sendBuf[MAXBUF];
+                    createPDU(sendBuf, 1, RFLNM, (uint8_t *)messageBuf, size + 2);
+                    int sent = sendtoErr(newSocket, sendBuf, size + 9, 0, (struct sockaddr *)&client, sizeof(client));
+                    if (sent <= 0) {
+                        perror("send call");
+                        exit(-1);
+                    }
+                    if (receiveSignatures(newSocket, &client, sendBuf, size + 9)) {
+                        printf("Client stopped sending signatures, terminating\n");
+                        exit(0);
+                    }
+                    build_delta_index(deltaIndex);
+                    fileReader = create_delta_reader(fileno(from_filename), cached, cachedLength, senderBuffer->buffer_size, readaheadDepth(), deltaIndex, compressPayload);
+                } else if (tree == TREE_LISTED) {
+                    fileReader = create_manifest_reader(filename, senderBuffer->buffer_size, readaheadDepth(), compressPayload);
+                } else if (tree) {
+                    fileReader = create_tree_reader(filename, senderBuffer->buffer_size, readaheadDepth(), compressPayload);
+                } else if (cached != NULL) {
+                    fileReader = create_mapped_reader(cached, cachedLength, senderBuffer->buffer_size, compressPayload);
+                } else {
+                    fileReader = create_file_reader(fileno(from_filename), senderBuffer->buffer_size, readaheadDepth(), compressPayload);
+                }
+                if (fileReader == NULL) {
+                    perror("Failed to create file reader");
                     exit(-1);
                 }
-                // Handle file transfer with the client
-                int count = 0;
-                sendingData(newSocket, &client, from_filename, count);
-                handleEndOfFile(newSocket, &client, count);
+                sendingData(newSocket, &client, from_filename);
+                handleEndOfFile(newSocket, &client);
+                printf("Disk stalls: %llu (%.1f ms)\n", (unsigned long long)fileReader->stalls, fileReader->stall_usec / 1000.0);
+                if (tree) {
+                    printf("Sent %llu files\n", (unsigned long long)fileReader->files);
+                }
+                if (fileReader->pool) {
+                    uint64_t packedIn = 0, packedOut = 0, sentRaw = 0;
+                    compress_totals(fileReader->pool, &packedIn, &packedOut, &sentRaw);
+                    printf("Compression: %llu KB packed into %llu KB, %llu KB sent raw\n",
+                        (unsigned long long)packedIn / 1024, (unsigned long long)packedOut / 1024,
+                        (unsigned long long)sentRaw / 1024);
+                }
+                if (rtt.samples) {
+                    printf("RTT: %llu samples, min/srtt/max %.1f/%.1f/%.1f us, rttvar %.1f us, rto %.1f us\n",
+                        (unsigned long long)rtt.samples, rtt.min_ns / 1000.0, rtt.srtt_ns / 1000.0,
+                        rtt.max_ns / 1000.0, rtt.rttvar_ns / 1000.0, rtt.rto_ns / 1000.0);
+                }
+                if (stats_get(&stats->tail_probes)) {
+                    printf("Tail loss probes: %llu\n", (unsigned long long)stats_get(&stats->tail_probes));
+                }
+                stats_print_latency(stdout, stats, "");
+                if (egressSlot >= 0) {
+                    // share of everything the server sent while this session ran
+                    EgressSlot *slot = &egress->slots[egressSlot];
+                    uint64_t all = atomic_load(&egress->bytes) - egressStart;
+                    static const char *priorities[EGRESS_PRIORITIES] = { "normal", "interactive", "bulk" };
+                    printf("Egress: %llu KB, class %s, weight %u, %.1f%% of %llu KB sent meanwhile, %llu waits %.1f ms, queue max %u here %u server wide\n",
+                        (unsigned long long)slot->bytes / 1024, priorities[slot->priority], slot->requested, all ? 100.0 * slot->bytes / all : 100.0,
+                        (unsigned long long)all / 1024, (unsigned long long)slot->waits, slot->wait_ns / 1e6,
+                        slot->max_backlog, egress->max_depth);
+                }
+                if (deltaIndex) {
+                    printf("Delta: %llu blocks matched, %llu literal bytes\n",
+                        (unsigned long long)fileReader->matched, (unsigned long long)fileReader->literal);
+                }
+                // one line the benchmark harness reads back for the whole session
+                struct rusage usage;
+                getrusage(RUSAGE_SELF, &usage);
+                printf("Session: %llu data PDUs for %u packets, cpu %.3f s user %.3f s sys, max RSS %ld KB\n",
+                    (unsigned long long)stats_get(&stats->packets), seqNum,
+                    usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6,
+                    usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6, usage.ru_maxrss);
+                fflush(stdout);
+                free_file_reader(fileReader);
+                fileReader = NULL;
                 close(newSocket);
-                fclose(from_filename);
+                if (from_filename) fclose(from_filename);
                 free_sender_window(senderBuffer); // Free sender window memory
                 senderBuffer = NULL;
+                free(retransmitTimers);
+                retransmitTimers = NULL;
                 exit(0);
             } else {
-                // Parent: Reap zombies
-                waitpid(-1, NULL, WNOHANG);
+                // Parent: the child has its own copy of the file and window
+                add_session(&sessionTable, pid, &client, nonce);
+                if (from_filename) fclose(from_filename);
+                free_sender_window(senderBuffer);
+                senderBuffer = NULL;
+                free_delta_index(deltaIndex);
+                deltaIndex = NULL;
                 continue;
             }
         }
     }
 }
 
-void sendingData(int socketNum, struct sockaddr_in6 *client, FILE * from_filename, int count) {
+int admitRequest(int socketNum, struct sockaddr_in6 * client, uint8_t * buff, int messageLen) {
+    // 0 for a filename PDU from a client whose session is already running,
+    // rcopy repeats it until data arrives, or one past the session limit,
+    // which gets a BUSY back. Anything else is left to filenamePacketCheck.
+    if (messageLen < PDU_HEADER || buff[6] != SFLNM || in_cksum((unsigned short *)buff, messageLen)) {
+        return 1;
+    }
+    uint32_t nonce = requestNonce(buff, messageLen);
+    if (find_session(&sessionTable, client, nonce)) {
+        sessionTable.duplicates++;
+        printf("Retried request from a running session ignored (%llu so far)\n", (unsigned long long)sessionTable.duplicates);
+        fflush(stdout);     // no fork follows to flush it
+        return 0;
+    }
+    if (sessionTable.live >= sessionTable.max) {
+        sessionTable.rejected++;
+        printf("Session limit %d reached, client told to retry (%llu so far)\n", sessionTable.max, (unsigned long long)sessionTable.rejected);
+        fflush(stdout);
+        uint8_t blankBuf = 0;
+        uint8_t sendBuf[8];
+        createPDU(sendBuf, 1, BUSY, &blankBuf, 1);
+        if (sendtoErr(socketNum, sendBuf, 8, 0, (struct sockaddr *)client, sizeof(*client)) <= 0) {
+            perror("send call");
+        }
+        return 0;
+    }
+    return 1;
+}
+
+void sendingData(int socketNum, struct sockaddr_in6 *client, FILE * from_filename) {
     
     setupPollSet();
     addToPollSet(socketNum);
@@ -152,174 +389,240 @@ void sendingData(int socketNum, struct sockaddr_in6 *client, FILE * from_filenam
 
     while (!eof_reached) {
         while (windowOpen(senderBuffer) && !eof_reached) {
-            uint8_t dataBuffer[senderBuffer->buffer_size];
-            size_t bytesRead = fread(dataBuffer, 1, senderBuffer->buffer_size, from_filename);
+            // the egress scheduler's turn first, asked for a full sized PDU
+            uint32_t ready = senderBuffer->window_size - (seqNum - senderBuffer->lower);
+            int granted = senderBuffer->buffer_size + PDU_HEADER;
+            uint64_t wait = egress_grant(egress, egressSlot, granted, ready, clock_ns());
+            stats_set(&stats->egress_queue, wait ? ready : 0);
+            if (wait) {
+                wheel_arm(&retransmitWheel, &paceTimer, clock_ns() + wait);
+                break;
+            }
+
+            // payload comes straight out of the reader's ring, no copy
+            const uint8_t *dataBuffer = NULL;
+            int bytesRead = next_slice(fileReader, &dataBuffer);
             
             if (bytesRead <= 0) {
+                egress_charge(egress, egressSlot, -granted);
+                egress_idle(egress, egressSlot);
+                if (fileReader->failed) {
+                    // an EOF now would have rcopy keep a short file as complete
+                    printf("Read error, terminating transfer\n");
+                    close(socketNum);free_file_reader(fileReader);fileReader = NULL;if (from_filename) fclose(from_filename);free_sender_window(senderBuffer); senderBuffer = NULL;exit(-1);
+                }
                 eof_reached = 1;
                 break;
             }
             
             // Create and send the data packet
             uint8_t sendBuf[bytesRead+7];
-            createPDU(sendBuf, seqNum, DPACK, dataBuffer, bytesRead);
+            createPDU(sendBuf, seqNum, compressPayload ? DPACK_PACKED : DPACK, (uint8_t *)dataBuffer, bytesRead);
             // store PDU in window
             add_packet_to_window(senderBuffer, seqNum, (const char *)sendBuf, bytesRead+7);
-            int sent = sendtoErr(socketNum, sendBuf, bytesRead + 7, 0, (struct sockaddr *)client, sizeof(*client));
-            if (sent <= 0) {
-                perror("send call");
+            // the window's copy stays put until it is acked, the batch points at it
+            int data_size = 0;
+            Packet *stored = get_packet(senderBuffer, seqNum, &data_size);
+            if (stored == NULL) {
+                perror("Failed to store packet");
                 exit(-1);
             }
+            queueDataPDU(socketNum, stored->data, data_size, client);
+            if (bytesRead + PDU_HEADER != granted) {
+                egress_charge(egress, egressSlot, bytesRead + PDU_HEADER - granted);
+            }
             seqNum++;
+            stats_set(&stats->window_used, seqNum - senderBuffer->lower);
             
-            // Process any acknowledgments that might have arrived
-            while (pollCall(0) != -1) {
-                count = 0;
-                checkRRSandSREJs(socketNum, client, count);
+            // Process any acknowledgments that might have arrived, once per
+            // batch of sends instead of one poll() per packet
+            if ((seqNum % ACK_DRAIN_EVERY) == 0 || !windowOpen(senderBuffer)) {
+                flushDataPDUs(socketNum, client);
+                drainAcks(socketNum, client);
+                retransmitExpired(socketNum, client);
             }
         }
+        flushDataPDUs(socketNum, client);
         
-        // If we're not at EOF but the window is full, wait for acknowledgments
-        if (!eof_reached && !windowOpen(senderBuffer)) {
-            int poll_result;
-            count = 0;
-            while (!windowOpen(senderBuffer) && count < 10) {
-                poll_result = pollCall(1000);
-                if (poll_result != -1) {
-                    count = 0;
-                    checkRRSandSREJs(socketNum, client, count);
-                } else {
-                    // No response, resend the lowest packet
-                    count++;
-                    int data_size;
-                    Packet *packet = get_packet(senderBuffer, senderBuffer->lower, &data_size);
-                    if (packet == NULL) {
-                        printf("Packet %d doesn't exist!\n", senderBuffer->lower);
-                    } else {
-                        int sent = sendtoErr(socketNum, packet->data, data_size, 0, (struct sockaddr *)client, sizeof(*client));
-                        if (sent <= 0) {
-                            perror("send call");
-                            exit(-1);
-                        }
-                    }
-                }
-            }
-            
-            if (count >= 10) {
+        // If we're not at EOF but the window is full, wait for acknowledgments,
+        // resending whatever times out in the meantime. Held back by the
+        // egress scheduler, wait for the turn the same way.
+        if (!windowOpen(senderBuffer)) {
+            egress_idle(egress, egressSlot);
+        }
+        while (!eof_reached && (!windowOpen(senderBuffer) || paceTimer.armed)) {
+            if (awaitAcks(socketNum, client) < 0) {
                 printf("Client not responding, terminating transfer\n");
-                close(socketNum);fclose(from_filename);free_sender_window(senderBuffer); senderBuffer = NULL;exit(0);
+                close(socketNum);free_file_reader(fileReader);fileReader = NULL;if (from_filename) fclose(from_filename);free_sender_window(senderBuffer); senderBuffer = NULL;exit(0);
             }
         }
     }
 }
 
-void handleEndOfFile(int socketNum, struct sockaddr_in6 * client, int count) {
-    // Make sure all data packets have been acknowledged before sending EOF
-    while (senderBuffer->lower < seqNum) {
-        int poll_result = pollCall(1000);
-        if (poll_result != -1) {
-            count = 0;
-            checkRRSandSREJs(socketNum, client, count);
-        } else {
-            // Resend the lowest unacknowledged packet
-            count++;
-            if (count >= 10) {
-                printf("Client not responding, terminating transfer\n");
-                return;
-            }
-            
-            int data_size;
-            Packet *packet = get_packet(senderBuffer, senderBuffer->lower, &data_size);
-            if (packet == NULL) {
-                printf("Packet %d doesn't exist!\n", senderBuffer->lower);
-            } else {
-                int sent = sendtoErr(socketNum, packet->data, data_size, 0, (struct sockaddr *)client, sizeof(*client));
-                if (sent <= 0) {
-                    perror("send call");
-                    exit(-1);
-                }
-            }
-        }
-    }
+void mappingTruncated(int sig) {
+    // The file was cut short under a shared mapping, the cache's or the delta
+    // source's, and a page past the new end was touched. Whatever the sender
+    // or reader thread was doing can not go on. No EOF goes out so rcopy never
+    // takes the short copy as complete, and our egress slot is reclaimed
+    // once it goes quiet.
+    static const char message[] = "File truncated while mapped, terminating transfer\n";
+    (void)sig;
+    if (write(STDOUT_FILENO, message, sizeof(message) - 1) < 0) {}
+    _exit(-1);
+}
 
-    // Create and send the EOF packet
-    uint8_t sendBuf[8];
+void handleEndOfFile(int socketNum, struct sockaddr_in6 * client) {
+    // The EOF goes out as soon as the window has room for it, right behind
+    // the last data. rcopy acts on it only once everything before it is in,
+    // and one arriving past a hole gets the hole SREJed, so a file that fits
+    // in the window is done in a single round trip.
+    // No new packet follows the last ones to show rcopy a hole, so each time
+    // the tail stalls, resend the highest packet after a couple of round
+    // trips: rcopy RRs it as a duplicate or SREJs whatever is missing below.
     uint8_t blankBuf = 0;
-    createPDU(sendBuf, seqNum, EOFF, (uint8_t *)&blankBuf, 1);
-    int sent = sendtoErr(socketNum, sendBuf, 8, 0, (struct sockaddr *)client, sizeof(*client));
-    if (sent <= 0) {
-        perror("send call");
-        exit(-1);
-    }
-    
-    // Wait for EOF acknowledgment
-    count = 0;
+    createPDU(eofPDU, seqNum, EOFF, (uint8_t *)&blankBuf, 1);
+    eofTimer.id = seqNum;
+    int eofSent = 0;
+    int probedLower = -1;
     int eof_acked = 0;
+
+    while (!eof_acked) {
+        if (!eofSent && seqNum - senderBuffer->lower < (uint32_t)senderBuffer->window_size) {
+            sendEOF(socketNum, client);
+            wheel_arm(&retransmitWheel, &eofTimer, clock_ns() + probeTimeout());
+            eofSent = 1;
+        }
+        if (senderBuffer->lower < seqNum && senderBuffer->lower != probedLower) {
+            probedLower = senderBuffer->lower;
+            wheel_arm(&retransmitWheel, &probeTimer, clock_ns() + probeTimeout());
+        }
+        eof_acked = awaitAcks(socketNum, client);
+        if (eof_acked < 0) {
+            printf("Client not responding, terminating transfer\n");
+            break;
+        }
+    }
+    wheel_cancel(&retransmitWheel, &probeTimer);
+    wheel_cancel(&retransmitWheel, &eofTimer);
     
-    while (!eof_acked && count < 10) {
-        int poll_result = pollCall(1000);
-        if (poll_result != -1) {
-            // Process received packets
-            uint8_t recvBuff[MAXBUF];
-            socklen_t clientLen = sizeof(*client);
-            int messageLen = recvfrom(socketNum, recvBuff, MAXBUF, 0, (struct sockaddr *)client, &clientLen);
-            
-            if (messageLen < 0) {
-                perror("recvfrom call");
-                continue;
-            }
-            
-            uint16_t calculatedChecksum = in_cksum((unsigned short *)recvBuff, messageLen);
-            if (calculatedChecksum) {
-                //printf("Checksum mismatch. Discarding packet.\n");
-                continue;
+    if (eof_acked <= 0) {
+        printf("Failed to receive EOF acknowledgment, terminating\n");
+    } else {
+        printf("File transfer completed successfully\n");
+    }
+}
+
+void sendEOF(int socketNum, struct sockaddr_in6 * client) {
+    int i = 0;
+    for (i = 0; i < EOF_COPIES; i++) {
+        if (sendtoErr(socketNum, eofPDU, 8, 0, (struct sockaddr *)client, sizeof(*client)) <= 0) {
+            perror("send call");
+            exit(-1);
+        }
+    }
+}
+
+uint64_t probeTimeout(void) {
+    // two round trips and the longest rcopy sits on an RR, never past the rto
+    if (rtt.samples == 0) return rtt.rto_ns;
+    uint64_t timeout = 2 * rtt.srtt_ns + PROBE_ACK_DELAY_NS;
+    return (timeout < rtt.rto_ns) ? timeout : rtt.rto_ns;
+}
+
+int awaitAcks(int socketNum, struct sockaddr_in6 * client) {
+    // waits for an RR/SREJ or the earliest retransmit deadline, 1 if the
+    // EOF was acked, -1 once the client has been silent for CLIENT_SILENT_NS
+    int result = 0;
+    if (pollCall(wheel_timeout_ms(&retransmitWheel, clock_ns(), 1000)) != -1) {
+        result = drainAcks(socketNum, client);
+    } else if (clock_ns() - lastHeardNs > CLIENT_SILENT_NS) {
+        return -1;
+    }
+    retransmitExpired(socketNum, client);
+    return result;
+}
+
+void retransmitExpired(int socketNum, struct sockaddr_in6 * client) {
+    // every data PDU whose deadline passed goes out again, not just the lowest
+    uint64_t now = clock_ns();
+    WheelTimer *timer = wheel_expire(&retransmitWheel, now);
+    while (timer) {
+        WheelTimer *next = timer->next;    // resending re-arms it
+        if (timer == &paceTimer) {
+            // only here to end the wait, sendingData asks for a turn again
+            timer = next;
+            continue;
+        }
+        if (timer == &eofTimer) {
+            rtt_backoff(&rtt);
+            sendEOF(socketNum, client);
+            wheel_arm(&retransmitWheel, &eofTimer, now + rtt.rto_ns);
+            timer = next;
+            continue;
+        }
+        int data_size;
+        Packet *packet = get_packet(senderBuffer, (timer == &probeTimer) ? seqNum - 1 : (int)timer->id, &data_size);
+        if (packet && timer == &probeTimer) {
+            if (sendDataPDU(socketNum, packet->data, data_size, client, SEND_PROBE) <= 0) {
+                perror("send call");
+                exit(-1);
             }
-            
-            uint8_t recv_flag;
-            uint32_t recv_seq_num;
-            memcpy(&recv_flag, recvBuff+6, 1);
-            memcpy(&recv_seq_num, recvBuff+7, 4);
-            recv_seq_num = ntohl(recv_seq_num);
-            
-            if (recv_flag == EOFF) {
-                printf("Received EOF acknowledgment\n");
-                eof_acked = 1;
-                break;
+        } else if (packet) {
+            // Karn: back off once per flight, not once per packet in it
+            if (packet->sent_ns > lastBackoffNs) {
+                rtt_backoff(&rtt);
+                lastBackoffNs = now;
+                stats_set(&stats->rto_us, rtt.rto_ns / 1000);
             }
-        } else {
-            // No response, resend the EOF packet
-            count++;
-            int sent = sendtoErr(socketNum, sendBuf, 8, 0, (struct sockaddr *)client, sizeof(*client));
+            int sent = sendDataPDU(socketNum, packet->data, data_size, client, SEND_TIMEOUT);
             if (sent <= 0) {
                 perror("send call");
                 exit(-1);
             }
         }
-    }
-    
-    if (!eof_acked) {
-        printf("Failed to receive EOF acknowledgment, terminating\n");
-    } else {
-        printf("File transfer completed successfully\n");
+        timer = next;
     }
 }
 
-int checkRRSandSREJs(int socketNum, struct sockaddr_in6 * client, int count) {
-    int messageLen = 0;
-    socklen_t clientLen = sizeof(*client);  
-    uint8_t recvBuff[MAXBUF];
-    memset(recvBuff, 0, sizeof(recvBuff));  
+int drainAcks(int socketNum, struct sockaddr_in6 * client) {
+    // every RR/SREJ already queued, ACK_BATCH to a recvmmsg(), 1 if the EOF was acked
+    uint8_t recvBuff[ACK_BATCH][MAXBUF];
+    UdpPacket packets[ACK_BATCH];
+    struct mmsghdr msgs[ACK_BATCH];
+    int received = ACK_BATCH;
+    int eofAcked = 0;
 
-    if ((messageLen = recvfrom(socketNum, recvBuff, MAXBUF, 0, (struct sockaddr *)client, &clientLen)) < 0) {
-        printf("Empty message\n");
-        return 0;  // Return without processing
+    while (received == ACK_BATCH && !eofAcked) {
+        int i = 0;
+        for (i = 0; i < ACK_BATCH; i++) {
+            udpPacketSetup(&packets[i], recvBuff[i], MAXBUF, client);
+            msgs[i].msg_hdr = packets[i].msg;
+        }
+        if ((received = recvmmsg(socketNum, msgs, ACK_BATCH, MSG_DONTWAIT, NULL)) < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                perror("recv call");
+            }
+            break;
+        }
+        lastHeardNs = clock_ns();
+        for (i = 0; i < received && !eofAcked; i++) {
+            // arrival time as the kernel saw it, before we got around to reading
+            UdpPacketInfo info;
+            packets[i].msg = msgs[i].msg_hdr;   // the kernel filled in the copy
+            udpPacketInfo(&packets[i], &info);
+            uint64_t arrived = info.software_ns ? stamp_clock_ns(info.software_ns) : clock_ns();
+            eofAcked = checkRRSandSREJs(socketNum, client, recvBuff[i], msgs[i].msg_len, arrived);
+        }
     }
+    return eofAcked;
+}
 
+int checkRRSandSREJs(int socketNum, struct sockaddr_in6 * client, uint8_t * recvBuff, int messageLen, uint64_t arrived) {
     uint16_t calculatedChecksum = in_cksum((unsigned short *)recvBuff, messageLen);
 
     if (calculatedChecksum) {
         //printf("Checksum mismatch. Discarding packet.\n");
-        count++;
+        stats_add(&stats->checksum_failures, 1);
         return 0;
     }
 
@@ -331,16 +634,41 @@ int checkRRSandSREJs(int socketNum, struct sockaddr_in6 * client, int count) {
     
     switch (recv_flag) {
         case RR:
+            {
+                // Karn: a retransmitted packet's RR could belong to either send, and
+                // anything sent before the latest retransmission may have sat behind
+                // the hole it repaired, so only packets sent after it are sampled
+                int data_size;
+                Packet *packet = get_packet(senderBuffer, recv_seq_num - 1, &data_size);
+                if (packet && packet->sends == 1 && packet->sent_ns > lastRetransmitNs && arrived > packet->sent_ns) {
+                    rtt_sample(&rtt, arrived - packet->sent_ns);
+                    stats_set(&stats->srtt_us, rtt.srtt_ns / 1000);
+                    stats_set(&stats->rto_us, rtt.rto_ns / 1000);
+                }
+                // turnaround of everything this RR newly covers, holds behind holes
+                // included, and none of it needs its retransmit timer any more
+                int i = 0;
+                for (i = senderBuffer->lower; i < (int)recv_seq_num; i++) {
+                    wheel_cancel(&retransmitWheel, &retransmitTimers[i % senderBuffer->window_size]);
+                    Packet *covered = get_packet(senderBuffer, i, &data_size);
+                    if (covered && covered->sends == 1 && arrived > covered->sent_ns) {
+                        stats_latency(stats, LATENCY_ACK, arrived - covered->sent_ns);
+                    }
+                }
+            }
             acknowledge_packet(senderBuffer, recv_seq_num - 1);  // Acknowledge all packets up to expected-1
+            stats_add(&stats->rr, 1);
+            stats_set(&stats->window_used, seqNum - senderBuffer->lower);
             break;
         case SREJ: 
             {
+                stats_add(&stats->srej, 1);
                 int data_size;
                 Packet *packet = get_packet(senderBuffer, recv_seq_num, &data_size);
                 if (packet == NULL) {
                     printf("Packet %d doesn't exist!\n", recv_seq_num);
                 } else {
-                    int sent = sendtoErr(socketNum, packet->data, data_size, 0, (struct sockaddr *)client, sizeof(*client));
+                    int sent = sendDataPDU(socketNum, packet->data, data_size, client, SEND_SREJ);
                     if (sent <= 0) {
                         perror("send call");
                         exit(-1);
@@ -357,7 +685,29 @@ int checkRRSandSREJs(int socketNum, struct sockaddr_in6 * client, int count) {
     return 0;
 }
 
-int filenamePacketCheck(int messageLen, uint8_t buff[], char filename[], FILE **from_filename) {
+uint32_t requestNonce(uint8_t * buff, int messageLen) {
+    // after the options byte and whatever it says follows, 0 from clients
+    // that send none, all of their retries then look alike
+    int filenameAt = PDU_HEADER + 6;
+    if (messageLen <= filenameAt) {
+        return 0;
+    }
+    int at = filenameAt + strnlen((const char *)buff + filenameAt, messageLen - filenameAt) + 1;
+    if (at >= messageLen) {
+        return 0;
+    }
+    uint8_t options = buff[at++];
+    at += (options & FNAME_OPT_DELTA) ? 8 : 0;
+    at += (options & FNAME_OPT_WEIGHT) ? 1 : 0;
+    at += (options & FNAME_OPT_PRIORITY) ? 1 : 0;
+    uint32_t nonce = 0;
+    if ((options & FNAME_OPT_NONCE) && at + 4 <= messageLen) {
+        memcpy(&nonce, buff + at, 4);
+    }
+    return nonce;
+}
+
+int filenamePacketCheck(int messageLen, uint8_t buff[], char filename[], FILE **from_filename, int *tree) {
     uint16_t checksum = in_cksum((unsigned short *)buff, messageLen);
     uint8_t flag;
     memcpy(&flag, buff+6, 1);
@@ -368,33 +718,221 @@ int filenamePacketCheck(int messageLen, uint8_t buff[], char filename[], FILE **
         uint8_t filename_length = strlen(filename);
         filename[filename_length] = '\0';
         //printf("from-filename is %s\n", filename);
-        *from_filename = check_filename(filename);  // Assign to the caller's pointer
 
-        if (*from_filename == NULL) {
-            return 2;
+        // options byte follows the filename, absent from older clients
+        uint8_t options = 0;
+        if (13 + filename_length + 1 < messageLen) {
+            options = buff[13 + filename_length + 1];
+        }
+        struct stat st;
+        *tree = 0;
+        if (options & FNAME_OPT_TREE) {
+            *tree = (options & FNAME_OPT_MANIFEST) ? TREE_LISTED : TREE_WALK;
+        }
+        compressPayload = (options & FNAME_OPT_COMPRESS) ? compressThreads() : 0;
+        pathMtuSizing = (options & FNAME_OPT_PMTU) != 0;
+        if (*tree == TREE_LISTED) {
+            if (stat(filename, &st) < 0 || !S_ISREG(st.st_mode)) {
+                return 2;
+            }
+        } else if (*tree) {
+            if (stat(filename, &st) < 0 || !S_ISDIR(st.st_mode)) {
+                return 2;
+            }
+        } else {
+            *from_filename = check_filename(filename);  // Assign to the caller's pointer
+            if (*from_filename == NULL) {
+                return 2;
+            }
+            // fopen() succeeds on a directory, but it cannot be sent as one file
+            if (fstat(fileno(*from_filename), &st) < 0 || !S_ISREG(st.st_mode)) {
+                fclose(*from_filename);
+                *from_filename = NULL;
+                return 2;
+            }
         }
         uint32_t window_size = 0;
         uint16_t buffer_size = 0;
         memcpy(&(window_size), buff+7, 4);
         memcpy(&(buffer_size), buff+11, 2);
         senderBuffer = create_sender_window(window_size, buffer_size);
+
+        // block size and count of the signatures the client will upload
+        int deltaAt = 13 + filename_length + 2;
+        if ((options & FNAME_OPT_DELTA) && !*tree && deltaAt + 8 <= messageLen) {
+            uint32_t deltaNW[2];
+            memcpy(deltaNW, buff + deltaAt, 8);
+            uint32_t block_size = ntohl(deltaNW[0]);
+            uint32_t count = ntohl(deltaNW[1]);
+            if (block_size >= DELTA_BLOCK_MIN && block_size <= DELTA_BLOCK_MAX && count > 0 && count <= DELTA_MAX_BLOCKS) {
+                deltaIndex = create_delta_index(block_size, count);
+            }
+        }
+        // weight and priority bytes after the delta fields, each only if flagged
+        int weightAt = deltaAt + ((options & FNAME_OPT_DELTA) ? 8 : 0);
+        int priorityAt = weightAt + ((options & FNAME_OPT_WEIGHT) ? 1 : 0);
+        sessionWeight = 1;
+        sessionPriority = EGRESS_NORMAL;
+        if ((options & FNAME_OPT_WEIGHT) && weightAt < messageLen) {
+            sessionWeight = buff[weightAt];
+        }
+        if ((options & FNAME_OPT_PRIORITY) && priorityAt < messageLen && buff[priorityAt] < EGRESS_PRIORITIES) {
+            sessionPriority = buff[priorityAt];
+        }
         return 0;
     }
 }
 	
+int receiveSignatures(int socketNum, struct sockaddr_in6 * client, uint8_t * reply, int replyLen) {
+    // stop and wait: ack every chunk with an RR naming the next one we want
+    uint32_t chunks = (deltaIndex->count + SIGS_PER_PDU - 1) / SIGS_PER_PDU;
+    uint32_t expected = 0;
+    int count = 0;
+
+    setupPollSet();
+    addToPollSet(socketNum);
+    while (expected < chunks) {
+        if (pollCall(1000) == -1) {
+            if (++count >= 10) return -1;
+            // nothing yet, the answer may not have arrived
+            if (expected == 0 && sendtoErr(socketNum, reply, replyLen, 0, (struct sockaddr *)client, sizeof(*client)) <= 0) {
+                perror("send call");
+                exit(-1);
+            }
+            continue;
+        }
+        uint8_t recvBuff[MAXBUF];
+        socklen_t clientLen = sizeof(*client);
+        int messageLen = recvfrom(socketNum, recvBuff, MAXBUF, 0, (struct sockaddr *)client, &clientLen);
+        if (messageLen < 7 || in_cksum((unsigned short *)recvBuff, messageLen)) {
+            continue;
+        }
+        if (recvBuff[6] == SFLNM) {
+            // our answer was lost, the client is still asking for the file
+            if (sendtoErr(socketNum, reply, replyLen, 0, (struct sockaddr *)client, sizeof(*client)) <= 0) {
+                perror("send call");
+                exit(-1);
+            }
+            continue;
+        }
+        if (messageLen < 11 || recvBuff[6] != SIG) {
+            continue;
+        }
+        count = 0;
+
+        uint32_t chunkNW = 0;
+        memcpy(&chunkNW, recvBuff + 7, 4);
+        uint32_t chunk = ntohl(chunkNW);
+        if (chunk == expected) {
+            uint32_t first = chunk * SIGS_PER_PDU;
+            uint32_t sigs = (messageLen - 11) / SIG_SIZE;
+            uint32_t i = 0;
+            for (i = 0; i < sigs && first + i < deltaIndex->count; i++) {
+                get_signature(recvBuff + 11 + i * SIG_SIZE, &deltaIndex->sigs[first + i]);
+            }
+            expected++;
+        }
+
+        // duplicates get acked again in case our RR was the one lost
+        uint32_t expectedNW = htonl(expected);
+        uint8_t sendBuf[11];
+        createPDU(sendBuf, 0, RR, (uint8_t *)&expectedNW, 4);
+        if (sendtoErr(socketNum, sendBuf, 11, 0, (struct sockaddr *)client, sizeof(*client)) <= 0) {
+            perror("send call");
+            exit(-1);
+        }
+    }
+    return 0;
+}
+
+int sendDataPDU(int socketNum, uint8_t * pdu, int length, struct sockaddr_in6 * client, int cause) {
+    stampDataPDU(pdu, length, cause);
+    return transmitPDU(socketNum, pdu, length, client);
+}
+
+void queueDataPDU(int socketNum, uint8_t * pdu, int length, struct sockaddr_in6 * client) {
+    // new data goes out SEND_BATCH at a time, flushDataPDUs() before any ack is read
+    stampDataPDU(pdu, length, SEND_NEW);
+    struct mmsghdr *message = &sendBatch[sendBatched];
+    memset(message, 0, sizeof(*message));
+    sendBatchIov[sendBatched].iov_base = pdu;
+    sendBatchIov[sendBatched].iov_len = length;
+    message->msg_hdr.msg_iov = &sendBatchIov[sendBatched];
+    message->msg_hdr.msg_iovlen = 1;
+    message->msg_hdr.msg_name = client;
+    message->msg_hdr.msg_namelen = sizeof(*client);
+    sendBatched++;
+    if (sendBatched == SEND_BATCH) {
+        flushDataPDUs(socketNum, client);
+    }
+}
+
+void flushDataPDUs(int socketNum, struct sockaddr_in6 * client) {
+    // one sendmmsg() for the batch, what it refused goes one at a time so an
+    // EMSGSIZE still reaches the path MTU handling in transmitPDU()
+    int sent = 0;
+    if (sendBatched > 0) {
+        sent = sendmmsgErr(socketNum, sendBatch, sendBatched, 0);
+    }
+    int i = 0;
+    for (i = (sent < 0) ? 0 : sent; i < sendBatched; i++) {
+        if (transmitPDU(socketNum, sendBatchIov[i].iov_base, sendBatchIov[i].iov_len, client) <= 0) {
+            perror("send call");
+            exit(-1);
+        }
+    }
+    sendBatched = 0;
+}
+
+void stampDataPDU(uint8_t * pdu, int length, int cause) {
+    // stamp the window slot, an RR for it later turns into an RTT sample
+    uint32_t sequence = 0;
+    int data_size = 0;
+    memcpy(&sequence, pdu, 4);
+    Packet *packet = get_packet(senderBuffer, ntohl(sequence), &data_size);
+    if (packet) {
+        packet->sent_ns = clock_ns();
+        packet->sends++;
+        WheelTimer *timer = &retransmitTimers[packet->sequence_number % senderBuffer->window_size];
+        timer->id = packet->sequence_number;
+        wheel_arm(&retransmitWheel, timer, packet->sent_ns + rtt.rto_ns);
+    }
+    stats_add(&stats->packets, 1);
+    if (cause == SEND_NEW) {
+        stats_add(&stats->bytes, length - PDU_HEADER);
+    } else {
+        // never held back, but the session's share pays for it
+        egress_charge(egress, egressSlot, length);
+        lastRetransmitNs = clock_ns();
+        stats_add((cause == SEND_SREJ) ? &stats->retransmit_srej :
+                  (cause == SEND_PROBE) ? &stats->tail_probes : &stats->retransmit_timeout, 1);
+    }
+}
+
+int transmitPDU(int socketNum, uint8_t * pdu, int length, struct sockaddr_in6 * client) {
+    int sent = sendtoErr(socketNum, pdu, length, 0, (struct sockaddr *)client, sizeof(*client));
+    if (sent < 0 && errno == EMSGSIZE && pathMtuSizing) {
+        // an ICMP too big lowered the path MTU, cut the slices still to come
+        int fits = udpPathMtu(client) - 7;
+        if (fits > 0 && fits < senderBuffer->buffer_size) {
+            limit_slices(fileReader, fits);
+            printf("Path MTU dropped, sending %d byte payloads\n", fits);
+        }
+        // this PDU already has its sequence number, let it go out fragmented
+        udpPathMtuDiscovery(socketNum, 0);
+        sent = sendtoErr(socketNum, pdu, length, 0, (struct sockaddr *)client, sizeof(*client));
+        udpPathMtuDiscovery(socketNum, 1);
+    }
+    return sent;
+}
+
 FILE * check_filename(char * filename) {
 	FILE* file_pointer = fopen(filename, "rb");
 	return file_pointer;
 }
 
 void createPDU(uint8_t sendBuf[], uint32_t seq_num, uint8_t flag, uint8_t buffer[], uint16_t bufSize) {
-    uint32_t seq_num_NW = htonl(seq_num);
-    memcpy(sendBuf, &seq_num_NW, 4);
-    memset(sendBuf + 4, 0, 2); 
-    memcpy(sendBuf + 6, &flag, 1);
-    memcpy(sendBuf + 7, buffer, bufSize);
-    uint16_t checksum = in_cksum((unsigned short *)sendBuf, bufSize + 7);
-    memcpy(sendBuf + 4, &checksum, 2); 
+    build_pdu(sendBuf, seq_num, flag, buffer, bufSize);
 }
 
 
@@ -427,3 +965,48 @@ void check_error_rate(char * rate) {
 	}
 	sendtoErr_init(error_rate, DROP_ON, FLIP_ON, DEBUG_ON, RSEED_ON);
 }
+
+int readaheadDepth(void) {
+	// blocks the disk reader may run ahead of the sender (RCOPY_READAHEAD)
+	char * depth = getenv("RCOPY_READAHEAD");
+	if ((depth == NULL) || (atoi(depth) < 2)) {
+		return READAHEAD_DEFAULT;
+	}
+	return atoi(depth);
+}
+
+int compressThreads(void) {
+	// workers packing payloads when a client asks for compression (RCOPY_COMPRESS_THREADS)
+	char * threads = getenv("RCOPY_COMPRESS_THREADS");
+	if ((threads == NULL) || (atoi(threads) < 1)) {
+		return COMPRESS_WORKERS;
+	}
+	return atoi(threads);
+}
+
+uint64_t egressRate(void) {
+	// bytes per second all sessions together may send (RCOPY_EGRESS_RATE, in KB/s), 0 for no cap
+	char * rate = getenv("RCOPY_EGRESS_RATE");
+	if ((rate == NULL) || (atoll(rate) < 0)) {
+		return 0;
+	}
+	return (uint64_t)atoll(rate) * 1024;
+}
+
+int maxSessions(void) {
+	// sessions running at once before new requests are told to retry (RCOPY_MAX_SESSIONS)
+	char * sessions = getenv("RCOPY_MAX_SESSIONS");
+	if ((sessions == NULL) || (atoi(sessions) < 1)) {
+		return SESSIONS_DEFAULT;
+	}
+	return atoi(sessions);
+}
+
+size_t cacheBudget(void) {
+	// memory the parent may keep mapped for hot files (RCOPY_CACHE_MB)
+	char * megabytes = getenv("RCOPY_CACHE_MB");
+	if ((megabytes == NULL) || (atoi(megabytes) < 0)) {
+		return (size_t)FILE_CACHE_BUDGET_MB * 1024 * 1024;
+	}
+	return (size_t)atoi(megabytes) * 1024 * 1024;
+}
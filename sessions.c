@@ -0,0 +1,55 @@
+#include "sessions.h"
+#include <string.h>
+#include <sys/wait.h>
+
+int init_session_table(SessionTable *table, int max) {
+    memset(table, 0, sizeof(*table));
+    table->sessions = calloc(max, sizeof(Session));
+    if (table->sessions == NULL) return -1;
+    table->max = max;
+    return 0;
+}
+
+Session* find_session(SessionTable *table, const struct sockaddr_in6 *client, uint32_t nonce) {
+    int i = 0;
+    for (i = 0; i < table->max; i++) {
+        Session *session = &table->sessions[i];
+        if (session->pid && session->nonce == nonce &&
+            session->client.sin6_port == client->sin6_port &&
+            memcmp(&session->client.sin6_addr, &client->sin6_addr, sizeof(client->sin6_addr)) == 0) {
+            return session;
+        }
+    }
+    return NULL;
+}
+
+void add_session(SessionTable *table, pid_t pid, const struct sockaddr_in6 *client, uint32_t nonce) {
+    int i = 0;
+    for (i = 0; i < table->max; i++) {
+        Session *session = &table->sessions[i];
+        if (session->pid == 0) {
+            session->pid = pid;
+            session->client = *client;
+            session->nonce = nonce;
+            table->live++;
+            return;
+        }
+    }
+}
+
+int reap_sessions(SessionTable *table) {
+    int reaped = 0;
+    pid_t pid = 0;
+    while ((pid = waitpid(-1, NULL, WNOHANG)) > 0) {
+        int i = 0;
+        for (i = 0; i < table->max; i++) {
+            if (table->sessions[i].pid == pid) {
+                table->sessions[i].pid = 0;
+                table->live--;
+                break;
+            }
+        }
+        reaped++;
+    }
+    return reaped;
+}
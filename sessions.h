@@ -0,0 +1,32 @@
+#ifndef SESSIONS_H
+#define SESSIONS_H
+#include <stdlib.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <netinet/in.h>
+
+#define SESSIONS_DEFAULT 256
+
+typedef struct Session {
+    pid_t pid;                  // 0 when the entry is free
+    struct sockaddr_in6 client;
+    uint32_t nonce;             // rcopy sends the same one in every filename PDU retry
+} Session;
+
+// Lives in the parent server, one entry per forked session still running.
+// A retried filename PDU finds the session it already started instead of
+// forking another, and the count decides whether a new one is admitted.
+typedef struct SessionTable {
+    Session *sessions;
+    int max;
+    int live;
+    uint64_t duplicates;
+    uint64_t rejected;
+} SessionTable;
+
+int init_session_table(SessionTable *table, int max);
+Session* find_session(SessionTable *table, const struct sockaddr_in6 *client, uint32_t nonce);
+void add_session(SessionTable *table, pid_t pid, const struct sockaddr_in6 *client, uint32_t nonce);
+int reap_sessions(SessionTable *table);    // collects exited children, returns how many
+
+#endif // SESSIONS_H
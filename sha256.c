@@ -0,0 +1,117 @@
+#include "sha256.h"
+#include <string.h>
+
+static void compress_block(Sha256 *hash, const uint8_t *block);
+
+static const uint32_t ROUND_K[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline uint32_t rotr(uint32_t value, int bits) {
+    return (value >> bits) | (value << (32 - bits));
+}
+
+void sha256_init(Sha256 *hash) {
+    static const uint32_t initial[8] = {
+        0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+    };
+    memcpy(hash->state, initial, sizeof(initial));
+    hash->length = 0;
+    hash->fill = 0;
+}
+
+void sha256_update(Sha256 *hash, const uint8_t *data, size_t length) {
+    hash->length += length;
+    if (hash->fill > 0) {
+        size_t chunk = 64 - hash->fill;
+        if (chunk > length) chunk = length;
+        memcpy(hash->block + hash->fill, data, chunk);
+        hash->fill += chunk;
+        data += chunk;
+        length -= chunk;
+        if (hash->fill < 64) return;
+        compress_block(hash, hash->block);
+        hash->fill = 0;
+    }
+    // whole blocks straight from the caller's buffer
+    while (length >= 64) {
+        compress_block(hash, data);
+        data += 64;
+        length -= 64;
+    }
+    memcpy(hash->block, data, length);
+    hash->fill = length;
+}
+
+void sha256_final(Sha256 *hash, uint8_t digest[SHA256_SIZE]) {
+    uint64_t bits = hash->length * 8;
+    hash->block[hash->fill++] = 0x80;
+    if (hash->fill > 56) {
+        memset(hash->block + hash->fill, 0, 64 - hash->fill);
+        compress_block(hash, hash->block);
+        hash->fill = 0;
+    }
+    memset(hash->block + hash->fill, 0, 56 - hash->fill);
+    int i = 0;
+    for (i = 0; i < 8; i++)
+        hash->block[56 + i] = bits >> (56 - 8 * i);
+    compress_block(hash, hash->block);
+
+    for (i = 0; i < 8; i++) {
+        digest[4 * i] = hash->state[i] >> 24;
+        digest[4 * i + 1] = hash->state[i] >> 16;
+        digest[4 * i + 2] = hash->state[i] >> 8;
+        digest[4 * i + 3] = hash->state[i];
+    }
+}
+
+void sha256(const uint8_t *data, size_t length, uint8_t digest[SHA256_SIZE]) {
+    Sha256 hash;
+    sha256_init(&hash);
+    sha256_update(&hash, data, length);
+    sha256_final(&hash, digest);
+}
+
+static void compress_block(Sha256 *hash, const uint8_t *block) {
+    uint32_t w[64];
+    int i = 0;
+    for (i = 0; i < 16; i++) {
+        w[i] = ((uint32_t)block[4 * i] << 24) | ((uint32_t)block[4 * i + 1] << 16) |
+               ((uint32_t)block[4 * i + 2] << 8) | block[4 * i + 3];
+    }
+    for (i = 16; i < 64; i++) {
+        uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    uint32_t a = hash->state[0], b = hash->state[1], c = hash->state[2], d = hash->state[3];
+    uint32_t e = hash->state[4], f = hash->state[5], g = hash->state[6], h = hash->state[7];
+    for (i = 0; i < 64; i++) {
+        uint32_t t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + ROUND_K[i] + w[i];
+        uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+    hash->state[0] += a;
+    hash->state[1] += b;
+    hash->state[2] += c;
+    hash->state[3] += d;
+    hash->state[4] += e;
+    hash->state[5] += f;
+    hash->state[6] += g;
+    hash->state[7] += h;
+}
@@ -0,0 +1,21 @@
+#ifndef SHA256_H
+#define SHA256_H
+#include <stdlib.h>
+#include <stdint.h>
+
+#define SHA256_SIZE 32
+
+// FIPS 180-4 SHA-256, fed in pieces of any length.
+typedef struct Sha256 {
+    uint32_t state[8];
+    uint64_t length;        // bytes fed so far
+    uint8_t block[64];
+    size_t fill;
+} Sha256;
+
+void sha256_init(Sha256 *hash);
+void sha256_update(Sha256 *hash, const uint8_t *data, size_t length);
+void sha256_final(Sha256 *hash, uint8_t digest[SHA256_SIZE]);
+void sha256(const uint8_t *data, size_t length, uint8_t digest[SHA256_SIZE]);
+
+#endif // SHA256_H
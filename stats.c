@@ -0,0 +1,120 @@
+#include "stats.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "timing.h"
+
+static TransferStats *page = NULL;
+static char page_name[64];
+
+static void stats_remove(void) {
+    if (page == NULL) return;
+    atomic_store(&page->state, STATS_DONE);
+    shm_unlink(page_name);
+    page = NULL;
+}
+
+TransferStats* stats_open(char role, const char *file, uint32_t window) {
+    TransferStats *stats = NULL;
+    char *enabled = getenv("RCOPY_STATS");
+    if (page == NULL && (enabled == NULL || atoi(enabled) != 0)) {
+        snprintf(page_name, sizeof(page_name), "/" STATS_PREFIX "%s-%d",
+            role == STATS_SERVER ? "server" : "client", (int)getpid());
+        int fd = shm_open(page_name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd >= 0) {
+            if (ftruncate(fd, sizeof(TransferStats)) == 0) {
+                stats = mmap(NULL, sizeof(TransferStats), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+                if (stats == MAP_FAILED) stats = NULL;
+            }
+            close(fd);
+            if (stats == NULL) {
+                shm_unlink(page_name);
+            } else {
+                page = stats;
+                atexit(stats_remove);
+            }
+        }
+    }
+    if (stats == NULL) {
+        // counting still works, just nobody can see it
+        stats = calloc(1, sizeof(TransferStats));
+        if (stats == NULL) {
+            perror("calloc");
+            exit(-1);
+        }
+    }
+
+    stats->pid = getpid();
+    stats->role = role;
+    snprintf(stats->file, sizeof(stats->file), "%s", file ? file : "");
+    stats->start_ns = clock_ns();
+    stats_set(&stats->window_size, window);
+    stats->version = STATS_VERSION;
+    atomic_store(&stats->state, STATS_RUNNING);
+    // last, a reader that sees the magic sees the header filled in
+    atomic_thread_fence(memory_order_release);
+    stats->magic = STATS_MAGIC;
+    return stats;
+}
+
+const TransferStats* stats_map(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat info;
+    const TransferStats *stats = NULL;
+    if (fstat(fd, &info) == 0 && info.st_size >= (off_t)sizeof(TransferStats)) {
+        stats = mmap(NULL, sizeof(TransferStats), PROT_READ, MAP_SHARED, fd, 0);
+        if (stats == MAP_FAILED) stats = NULL;
+    }
+    close(fd);
+    if (stats && (stats->magic != STATS_MAGIC || stats->version != STATS_VERSION)) {
+        stats_unmap(stats);
+        stats = NULL;
+    }
+    return stats;
+}
+
+void stats_unmap(const TransferStats *stats) {
+    if (stats) munmap((void *)stats, sizeof(TransferStats));
+}
+
+static uint64_t bucket_top(int bucket) {
+    if (bucket < (1 << LATENCY_SUB_BITS)) return bucket;
+    int shift = (bucket >> LATENCY_SUB_BITS) - 1;
+    uint64_t step = (uint64_t)((bucket & ((1 << LATENCY_SUB_BITS) - 1)) | (1 << LATENCY_SUB_BITS));
+    return ((step + 1) << shift) - 1;
+}
+
+uint64_t stats_percentile(const LatencyHistogram *hist, double fraction) {
+    uint64_t count = stats_get(&hist->count);
+    if (count == 0) return 0;
+    // rank of the sample that has the fraction at or below it, at least the first
+    uint64_t rank = (uint64_t)(fraction * count + 0.999999);
+    if (rank == 0) rank = 1;
+    uint64_t seen = 0;
+    int i = 0;
+    for (i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += stats_get(&hist->buckets[i]);
+        if (seen >= rank) break;
+    }
+    uint64_t max = stats_get(&hist->max_ns);
+    uint64_t top = (i < LATENCY_BUCKETS) ? bucket_top(i) : max;
+    return (top < max) ? top : max;
+}
+
+void stats_print_latency(FILE *out, const TransferStats *stats, const char *indent) {
+    static const char *names[LATENCY_KINDS] = { "handshake", "ack", "repair" };
+    int kind = 0;
+    for (kind = 0; kind < LATENCY_KINDS; kind++) {
+        const LatencyHistogram *hist = &stats->latency[kind];
+        uint64_t count = stats_get(&hist->count);
+        if (count == 0) continue;
+        fprintf(out, "%sLatency %s: %llu samples, p50/p99/p999 %.1f/%.1f/%.1f us, max %.1f us\n",
+            indent, names[kind], (unsigned long long)count,
+            stats_percentile(hist, 0.50) / 1000.0, stats_percentile(hist, 0.99) / 1000.0,
+            stats_percentile(hist, 0.999) / 1000.0, stats_get(&hist->max_ns) / 1000.0);
+    }
+}
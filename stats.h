@@ -0,0 +1,108 @@
+#ifndef STATS_H
+#define STATS_H
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdatomic.h>
+
+// Every server session and every rcopy keeps its live counters in a shared
+// memory page, /dev/shm/rcopy-<role>-<pid>, that rcopy-stat maps read only.
+// Each page has a single writer, so counters are bumped with relaxed
+// loads and stores, no locked instructions on the packet path.
+#define STATS_MAGIC 0x52435354      // "RCST"
+#define STATS_VERSION 4
+#define STATS_PREFIX "rcopy-"
+#define STATS_DIR "/dev/shm"
+#define STATS_NAME_MAX 128
+#define STATS_SERVER 's'
+#define STATS_CLIENT 'c'
+#define STATS_RUNNING 1
+#define STATS_DONE 2
+
+typedef _Atomic uint64_t stat_t;
+
+// Latency histograms, log buckets split into 32 linear steps the way HDR
+// histograms do it, so every recorded value is within 3% of its bucket.
+// Fixed size, recording is an index computation and one counter bump.
+#define LATENCY_SUB_BITS 5
+#define LATENCY_MAX_EXP 36          // 2^36 ns, about 69 s, longer lands in the top bucket
+#define LATENCY_BUCKETS ((LATENCY_MAX_EXP - LATENCY_SUB_BITS + 2) << LATENCY_SUB_BITS)
+
+#define LATENCY_HANDSHAKE 0         // receiver: filename PDU sent to first data arrived
+#define LATENCY_ACK 1               // sender: data PDU sent to the RR covering it
+#define LATENCY_REPAIR 2            // receiver: SREJ sent to the hole filled
+#define LATENCY_KINDS 3
+
+typedef struct LatencyHistogram {
+    stat_t count;
+    stat_t max_ns;
+    stat_t buckets[LATENCY_BUCKETS];
+} LatencyHistogram;
+
+// Sender and receiver share the layout, a few fields only mean something
+// on one side.
+typedef struct TransferStats {
+    uint32_t magic;
+    uint32_t version;
+    int32_t pid;
+    char role;
+    char file[STATS_NAME_MAX];
+    _Atomic uint32_t state;
+    uint64_t start_ns;          // clock_ns(), CLOCK_MONOTONIC
+    stat_t bytes;               // payload sent / written in order
+    stat_t packets;             // data PDUs sent / received, retransmissions included
+    stat_t retransmit_srej;     // sender: resent for an SREJ
+    stat_t retransmit_timeout;  // sender: resent after an RR timeout
+    stat_t tail_probes;         // sender: last packet resent to draw an RR at the tail
+    stat_t checksum_failures;
+    stat_t duplicates;          // receiver: data PDUs it already had
+    stat_t rr;                  // RRs received / sent
+    stat_t srej;                // SREJs received / sent
+    stat_t kernel_drops;        // receiver: full socket queue
+    stat_t window_used;         // sender: unacked PDUs, receiver: buffered span
+    stat_t window_size;
+    stat_t egress_queue;        // sender: PDUs the window allows held back by the egress scheduler
+    stat_t rto_us;              // sender
+    stat_t srtt_us;             // sender
+    LatencyHistogram latency[LATENCY_KINDS];
+} TransferStats;
+
+// Never NULL, falls back to private memory if the page can not be made or
+// RCOPY_STATS=0. The page is removed again when the process exits.
+TransferStats* stats_open(char role, const char *file, uint32_t window);
+// Maps the page at path read only, NULL if it is not a stats page.
+const TransferStats* stats_map(const char *path);
+void stats_unmap(const TransferStats *stats);
+// Upper end of the bucket holding the given fraction of samples, 0 if empty.
+uint64_t stats_percentile(const LatencyHistogram *hist, double fraction);
+// One line per histogram that has samples.
+void stats_print_latency(FILE *out, const TransferStats *stats, const char *indent);
+
+static inline void stats_add(stat_t *counter, uint64_t amount) {
+    atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + amount, memory_order_relaxed);
+}
+
+static inline void stats_set(stat_t *counter, uint64_t value) {
+    atomic_store_explicit(counter, value, memory_order_relaxed);
+}
+
+static inline uint64_t stats_get(const stat_t *counter) {
+    return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+static inline int stats_latency_bucket(uint64_t ns) {
+    if (ns < (1ULL << LATENCY_SUB_BITS)) return (int)ns;
+    int exponent = 63 - __builtin_clzll(ns);
+    if (exponent > LATENCY_MAX_EXP) return LATENCY_BUCKETS - 1;
+    return ((exponent - LATENCY_SUB_BITS + 1) << LATENCY_SUB_BITS) |
+        (int)((ns >> (exponent - LATENCY_SUB_BITS)) & ((1 << LATENCY_SUB_BITS) - 1));
+}
+
+static inline void stats_latency(TransferStats *stats, int kind, uint64_t ns) {
+    LatencyHistogram *hist = &stats->latency[kind];
+    stats_add(&hist->buckets[stats_latency_bucket(ns)], 1);
+    stats_add(&hist->count, 1);
+    if (ns > stats_get(&hist->max_ns)) stats_set(&hist->max_ns, ns);
+}
+
+#endif // STATS_H
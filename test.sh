@@ -338,6 +338,283 @@ start_server 0
 run_copy "nonexistent_file.dat" "should_not_exist.dat" 10 1000 0 "" "9: File not found error handling"
 stop_server
 
+# Test 11: Many clients pulling the same file (shared file cache)
+echo "========================================================"
+echo "TEST CASE 11: 100 clients fetching one file"
+echo "========================================================"
+
+start_server 0
+rm -f $OUTPUT_DIR/many_*.dat
+start_time=$(date +%s%N)
+for i in $(seq 1 100); do
+    ./rcopy $TEST_DIR/large.dat $OUTPUT_DIR/many_$i.dat 50 1400 0 $SERVER_HOST $SERVER_PORT > /dev/null 2>&1 &
+done
+wait $(jobs -p | grep -v "^$SERVER_PID$")
+end_time=$(date +%s%N)
+stop_server
+
+many_result="PASS"
+for i in $(seq 1 100); do
+    if ! cmp -s "$TEST_DIR/large.dat" "$OUTPUT_DIR/many_$i.dat"; then
+        many_result="FAIL"
+    fi
+done
+echo "100 transfers took $(( (end_time - start_time) / 1000000 )) ms"
+grep "File cache" "$LOG_DIR/server.log" | tail -n 1
+record_test_result "11: 100 clients fetching one file" "$many_result"
+
+echo "========================================================"
+echo "TEST CASE 12: Directory tree in one session"
+echo "========================================================"
+
+rm -rf $TEST_DIR/tree $OUTPUT_DIR/tree
+mkdir -p $TEST_DIR/tree/sub/deeper $TEST_DIR/tree/empty
+cp $TEST_DIR/large.dat $TEST_DIR/tree/
+cp $TEST_DIR/small.dat $TEST_DIR/tree/sub/
+: > $TEST_DIR/tree/sub/deeper/zero
+for i in $(seq 1 50); do
+    head -c $((i * 37)) /dev/urandom > $TEST_DIR/tree/sub/deeper/f$i
+done
+start_server 0.1
+./rcopy $TEST_DIR/tree/ $OUTPUT_DIR/tree 20 1000 0.1 $SERVER_HOST $SERVER_PORT > $LOG_DIR/rcopy_tree.log 2>&1
+stop_server
+if diff -r $TEST_DIR/tree $OUTPUT_DIR/tree > /dev/null; then
+    record_test_result "12.1: Directory tree in one session" "PASS"
+else
+    record_test_result "12.1: Directory tree in one session" "FAIL"
+fi
+
+# @list asks for the paths the server's file list names, relative to the
+# server's directory, and they arrive under the same names
+rm -rf $OUTPUT_DIR/listed
+cat > $TEST_DIR/tree.list <<EOF
+# one path per line
+$TEST_DIR/tree/large.dat
+$TEST_DIR/tree/sub/deeper/
+EOF
+start_server 0.1
+./rcopy @$TEST_DIR/tree.list $OUTPUT_DIR/listed 20 1000 0.1 $SERVER_HOST $SERVER_PORT > $LOG_DIR/rcopy_manifest.log 2>&1
+stop_server
+if cmp -s $TEST_DIR/tree/large.dat $OUTPUT_DIR/listed/$TEST_DIR/tree/large.dat && \
+   diff -r $TEST_DIR/tree/sub/deeper $OUTPUT_DIR/listed/$TEST_DIR/tree/sub/deeper > /dev/null && \
+   [ ! -e $OUTPUT_DIR/listed/$TEST_DIR/tree/sub/small.dat ]; then
+    record_test_result "12.2: Listed files in one session" "PASS"
+else
+    record_test_result "12.2: Listed files in one session" "FAIL"
+fi
+
+echo "========================================================"
+echo "TEST CASE 13: Delta against an existing destination"
+echo "========================================================"
+
+head -c 2000000 /dev/urandom > $TEST_DIR/delta_old.dat
+( head -c 700000 $TEST_DIR/delta_old.dat; echo "changed"; tail -c +700100 $TEST_DIR/delta_old.dat ) > $TEST_DIR/delta_new.dat
+cp $TEST_DIR/delta_old.dat $OUTPUT_DIR/delta_out.dat
+start_server 0.1
+RCOPY_DELTA=1 ./rcopy $TEST_DIR/delta_new.dat $OUTPUT_DIR/delta_out.dat 20 1000 0.1 $SERVER_HOST $SERVER_PORT > $LOG_DIR/rcopy_delta.log 2>&1
+stop_server
+grep "Delta" $LOG_DIR/rcopy_delta.log
+if cmp -s $TEST_DIR/delta_new.dat $OUTPUT_DIR/delta_out.dat; then
+    record_test_result "13: Delta against an existing destination" "PASS"
+else
+    record_test_result "13: Delta against an existing destination" "FAIL"
+fi
+
+echo "========================================================"
+echo "TEST CASE 14: Compressed transfer"
+echo "========================================================"
+
+# text compresses, the random tail should go out through the bypass
+( for i in $(seq 1 20000); do echo "line $i of a compressible log file"; done; cat $TEST_DIR/large.dat ) > $TEST_DIR/text.dat
+rm -f $OUTPUT_DIR/text_out.dat
+start_server 0.1
+RCOPY_COMPRESS=1 ./rcopy $TEST_DIR/text.dat $OUTPUT_DIR/text_out.dat 20 1000 0.1 $SERVER_HOST $SERVER_PORT > $LOG_DIR/rcopy_compress.log 2>&1
+stop_server
+grep "Compression" $LOG_DIR/server.log | tail -n 1
+if cmp -s $TEST_DIR/text.dat $OUTPUT_DIR/text_out.dat; then
+    record_test_result "14: Compressed transfer" "PASS"
+else
+    record_test_result "14: Compressed transfer" "FAIL"
+fi
+
+echo "========================================================"
+echo "TEST CASE 15: Buffer size picked from the path MTU"
+echo "========================================================"
+
+rm -f $OUTPUT_DIR/large_auto.dat
+start_server 0.1
+./rcopy $TEST_DIR/large.dat $OUTPUT_DIR/large_auto.dat 10 auto 0.1 $SERVER_HOST $SERVER_PORT > $LOG_DIR/rcopy_auto.log 2>&1
+stop_server
+grep "Buffer size" $LOG_DIR/rcopy_auto.log
+if cmp -s $TEST_DIR/large.dat $OUTPUT_DIR/large_auto.dat; then
+    record_test_result "15: Buffer size picked from the path MTU" "PASS"
+else
+    record_test_result "15: Buffer size picked from the path MTU" "FAIL"
+fi
+
+echo "========================================================"
+echo "TEST CASE 16: Window larger than the default socket buffer"
+echo "========================================================"
+
+rm -f $OUTPUT_DIR/large_window.dat
+start_server 0
+start_time=$(date +%s%N)
+./rcopy $TEST_DIR/large.dat $OUTPUT_DIR/large_window.dat 400 1400 0 $SERVER_HOST $SERVER_PORT > $LOG_DIR/rcopy_window.log 2>&1
+end_time=$(date +%s%N)
+stop_server
+echo "Window 400 took $(( (end_time - start_time) / 1000000 )) ms"
+grep "Kernel dropped" $LOG_DIR/rcopy_window.log
+if cmp -s $TEST_DIR/large.dat $OUTPUT_DIR/large_window.dat; then
+    record_test_result "16: Window larger than the default socket buffer" "PASS"
+else
+    record_test_result "16: Window larger than the default socket buffer" "FAIL"
+fi
+
+echo "========================================================"
+echo "TEST CASE 17: Scripted drop spans"
+echo "========================================================"
+
+# a range, an open ended stride and a bounded stride on the server side
+rm -f $OUTPUT_DIR/large_spans.dat
+export CPE464_OVERRIDE_ERR_DROP="30-39,200:97,500-600:25"
+start_server 0
+unset CPE464_OVERRIDE_ERR_DROP
+./rcopy $TEST_DIR/large.dat $OUTPUT_DIR/large_spans.dat 10 1000 0 $SERVER_HOST $SERVER_PORT > $LOG_DIR/rcopy_spans.log 2>&1
+stop_server
+if cmp -s $TEST_DIR/large.dat $OUTPUT_DIR/large_spans.dat; then
+    record_test_result "17: Scripted drop spans" "PASS"
+else
+    record_test_result "17: Scripted drop spans" "FAIL"
+fi
+
+echo "========================================================"
+echo "TEST CASE 18: Lost tail and EOF, start without a filename answer"
+echo "========================================================"
+
+# the server drops its last four data PDUs and both copies of the EOF,
+# nothing reaches rcopy to show it the hole, only a tail loss probe or a
+# timeout can recover them
+rm -f $OUTPUT_DIR/medium_tail.dat
+export CPE464_OVERRIDE_ERR_DROP="49-54"
+start_server 0
+unset CPE464_OVERRIDE_ERR_DROP
+./rcopy $TEST_DIR/medium.dat $OUTPUT_DIR/medium_tail.dat 10 1000 0 $SERVER_HOST $SERVER_PORT > $LOG_DIR/rcopy_tail.log 2>&1
+stop_server
+if cmp -s $TEST_DIR/medium.dat $OUTPUT_DIR/medium_tail.dat && grep -q "Tail loss probes" $LOG_DIR/server.log; then
+    record_test_result "18.1: Lost tail and EOF" "PASS"
+else
+    record_test_result "18.1: Lost tail and EOF" "FAIL"
+fi
+
+# a file smaller than one PDU: the filename PDU goes out once, no answer
+# comes back ahead of the data, and a single data PDU plus the EOF finish it
+rm -f $OUTPUT_DIR/small_zero_rtt.dat
+start_server 0
+./rcopy $TEST_DIR/small.dat $OUTPUT_DIR/small_zero_rtt.dat 10 1000 0 $SERVER_HOST $SERVER_PORT > $LOG_DIR/rcopy_zero_rtt.log 2>&1
+stop_server
+if cmp -s $TEST_DIR/small.dat $OUTPUT_DIR/small_zero_rtt.dat && \
+   [ "$(grep -c "FLAGS  8" $LOG_DIR/rcopy_zero_rtt.log)" -eq 1 ] && \
+   ! grep -q "FLAGS  9" $LOG_DIR/rcopy_zero_rtt.log && \
+   [ "$(grep -c "RECV .*FLAGS 16" $LOG_DIR/rcopy_zero_rtt.log)" -eq 1 ]; then
+    record_test_result "18.2: Small file without a filename answer" "PASS"
+else
+    record_test_result "18.2: Small file without a filename answer" "FAIL"
+fi
+
+echo "========================================================"
+echo "TEST CASE 19: Retried requests and the session limit"
+echo "========================================================"
+
+# the first twenty data PDUs are lost, rcopy sends its filename PDU again
+# while the session already runs, the server must not start a second one
+rm -f $OUTPUT_DIR/medium_retry.dat
+export CPE464_OVERRIDE_ERR_DROP="1-20"
+start_server 0
+unset CPE464_OVERRIDE_ERR_DROP
+./rcopy $TEST_DIR/medium.dat $OUTPUT_DIR/medium_retry.dat 10 1000 0 $SERVER_HOST $SERVER_PORT > $LOG_DIR/rcopy_retry.log 2>&1
+stop_server
+if cmp -s $TEST_DIR/medium.dat $OUTPUT_DIR/medium_retry.dat && grep -q "Retried request" $LOG_DIR/server.log; then
+    record_test_result "19.1: Retried request starts one session" "PASS"
+else
+    record_test_result "19.1: Retried request starts one session" "FAIL"
+fi
+
+# six clients against two sessions, the rest are told to retry and still finish
+export RCOPY_MAX_SESSIONS=2
+start_server 0
+unset RCOPY_MAX_SESSIONS
+pids=""
+for i in 1 2 3 4 5 6; do
+    rm -f $OUTPUT_DIR/large_busy_$i.dat
+    ./rcopy $TEST_DIR/large.dat $OUTPUT_DIR/large_busy_$i.dat 5 1000 0 $SERVER_HOST $SERVER_PORT > $LOG_DIR/rcopy_busy_$i.log 2>&1 &
+    pids="$pids $!"
+done
+wait $pids
+stop_server
+all_match=1
+for i in 1 2 3 4 5 6; do
+    cmp -s $TEST_DIR/large.dat $OUTPUT_DIR/large_busy_$i.dat || all_match=0
+done
+if [ $all_match -eq 1 ] && grep -q "Session limit" $LOG_DIR/server.log; then
+    record_test_result "19.2: Session limit with 6 clients" "PASS"
+else
+    record_test_result "19.2: Session limit with 6 clients" "FAIL"
+fi
+
+echo "========================================================"
+echo "TEST CASE 20: Small transfer next to bulk under an egress cap"
+echo "========================================================"
+
+# 4 MB with a 400 PDU window against a 2000 KB/s cap takes about two
+# seconds, the small copy started behind it should get its share at once
+head -c 4000000 /dev/urandom > $TEST_DIR/bulk.dat
+rm -f $OUTPUT_DIR/bulk_out.dat $OUTPUT_DIR/medium_fair.dat
+export RCOPY_EGRESS_RATE=2000
+start_server 0
+unset RCOPY_EGRESS_RATE
+./rcopy $TEST_DIR/bulk.dat $OUTPUT_DIR/bulk_out.dat 400 1400 0 $SERVER_HOST $SERVER_PORT > $LOG_DIR/rcopy_bulk.log 2>&1 &
+bulk_pid=$!
+sleep 0.3
+start_time=$(date +%s%N)
+./rcopy $TEST_DIR/medium.dat $OUTPUT_DIR/medium_fair.dat 10 1000 0 $SERVER_HOST $SERVER_PORT > $LOG_DIR/rcopy_fair.log 2>&1
+end_time=$(date +%s%N)
+wait $bulk_pid
+stop_server
+small_ms=$(( (end_time - start_time) / 1000000 ))
+echo "Small transfer took $small_ms ms"
+grep "Egress" $LOG_DIR/server.log
+if cmp -s $TEST_DIR/bulk.dat $OUTPUT_DIR/bulk_out.dat && cmp -s $TEST_DIR/medium.dat $OUTPUT_DIR/medium_fair.dat && [ $small_ms -lt 1000 ]; then
+    record_test_result "20: Small transfer next to bulk under an egress cap" "PASS"
+else
+    record_test_result "20: Small transfer next to bulk under an egress cap" "FAIL"
+fi
+
+echo "========================================================"
+echo "TEST CASE 21: Interactive transfer next to bulk priority"
+echo "========================================================"
+
+# same load as case 20, marked: the bulk copy yields, the small one goes first
+rm -f $OUTPUT_DIR/bulk_out.dat $OUTPUT_DIR/medium_interactive.dat
+export RCOPY_EGRESS_RATE=2000 RCOPY_DSCP=1
+start_server 0
+unset RCOPY_EGRESS_RATE RCOPY_DSCP
+RCOPY_PRIORITY=bulk ./rcopy $TEST_DIR/bulk.dat $OUTPUT_DIR/bulk_out.dat 400 1400 0 $SERVER_HOST $SERVER_PORT > $LOG_DIR/rcopy_bulk.log 2>&1 &
+bulk_pid=$!
+sleep 0.3
+start_time=$(date +%s%N)
+RCOPY_PRIORITY=interactive ./rcopy $TEST_DIR/medium.dat $OUTPUT_DIR/medium_interactive.dat 10 1000 0 $SERVER_HOST $SERVER_PORT > $LOG_DIR/rcopy_interactive.log 2>&1
+end_time=$(date +%s%N)
+wait $bulk_pid
+stop_server
+small_ms=$(( (end_time - start_time) / 1000000 ))
+echo "Interactive transfer took $small_ms ms"
+grep "Egress" $LOG_DIR/server.log
+if cmp -s $TEST_DIR/bulk.dat $OUTPUT_DIR/bulk_out.dat && cmp -s $TEST_DIR/medium.dat $OUTPUT_DIR/medium_interactive.dat && grep -q "interactive" $LOG_DIR/server.log && [ $small_ms -lt 1000 ]; then
+    record_test_result "21: Interactive transfer next to bulk priority" "PASS"
+else
+    record_test_result "21: Interactive transfer next to bulk priority" "FAIL"
+fi
+
 # Test 10: Check for any sleep/seek functions
 echo "========================================================"
 echo "TEST CASE 10: Check for prohibited functions"
@@ -0,0 +1,147 @@
+#include "timerwheel.h"
+#include <string.h>
+
+#define LEVEL_SHIFT(level) (WHEEL_BITS * (level))
+#define WHEEL_SPAN (1ULL << LEVEL_SHIFT(WHEEL_LEVELS))   // ticks the top level reaches
+
+static uint64_t rotate(uint64_t bits, int by) {
+    // right, so bit by lands on bit 0
+    by &= WHEEL_SLOTS - 1;
+    return by ? (bits >> by) | (bits << (64 - by)) : bits;
+}
+
+static void link_timer(TimerWheel *wheel, WheelTimer *timer) {
+    uint64_t delta = (timer->expires > wheel->now) ? timer->expires - wheel->now : 0;
+    // past the top level's reach it goes round again when that slot cascades
+    uint64_t at = (delta >= WHEEL_SPAN) ? wheel->now + WHEEL_SPAN - 1 : timer->expires;
+    int level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >= (1ULL << LEVEL_SHIFT(level + 1))) level++;
+    int slot = (at >> LEVEL_SHIFT(level)) & (WHEEL_SLOTS - 1);
+
+    timer->level = level;
+    timer->slot = slot;
+    timer->prev = NULL;
+    timer->next = wheel->slots[level][slot];
+    if (timer->next) timer->next->prev = timer;
+    wheel->slots[level][slot] = timer;
+    wheel->occupied[level] |= 1ULL << slot;
+}
+
+static void unlink_timer(TimerWheel *wheel, WheelTimer *timer) {
+    if (timer->prev) {
+        timer->prev->next = timer->next;
+    } else {
+        wheel->slots[timer->level][timer->slot] = timer->next;
+        if (timer->next == NULL) wheel->occupied[timer->level] &= ~(1ULL << timer->slot);
+    }
+    if (timer->next) timer->next->prev = timer->prev;
+    timer->next = timer->prev = NULL;
+}
+
+static void cascade(TimerWheel *wheel, int level, int slot) {
+    // everything here is due within the level below's reach now
+    WheelTimer *timer = wheel->slots[level][slot];
+    wheel->slots[level][slot] = NULL;
+    wheel->occupied[level] &= ~(1ULL << slot);
+    while (timer) {
+        WheelTimer *next = timer->next;
+        link_timer(wheel, timer);
+        timer = next;
+    }
+}
+
+void wheel_init(TimerWheel *wheel, uint64_t now_ns) {
+    memset(wheel, 0, sizeof(*wheel));
+    wheel->now = now_ns / WHEEL_TICK_NS;
+}
+
+void wheel_arm(TimerWheel *wheel, WheelTimer *timer, uint64_t deadline_ns) {
+    if (timer->armed) {
+        unlink_timer(wheel, timer);
+    } else {
+        wheel->count++;
+    }
+    // rounded up, a timer never fires before its deadline
+    timer->expires = (deadline_ns + WHEEL_TICK_NS - 1) / WHEEL_TICK_NS;
+    if (timer->expires <= wheel->now) timer->expires = wheel->now + 1;
+    timer->armed = 1;
+    link_timer(wheel, timer);
+}
+
+void wheel_cancel(TimerWheel *wheel, WheelTimer *timer) {
+    if (!timer->armed) return;
+    unlink_timer(wheel, timer);
+    timer->armed = 0;
+    wheel->count--;
+}
+
+WheelTimer *wheel_expire(TimerWheel *wheel, uint64_t now_ns) {
+    uint64_t target = now_ns / WHEEL_TICK_NS;
+    WheelTimer *expired = NULL;
+    WheelTimer **tail = &expired;
+
+    while (wheel->now < target) {
+        if (wheel->count == 0) {
+            wheel->now = target;
+            break;
+        }
+        // next tick with something in level 0 before level 0 wraps, or the wrap
+        int index = wheel->now & (WHEEL_SLOTS - 1);
+        uint64_t ahead = (index == WHEEL_SLOTS - 1) ? 0 : wheel->occupied[0] & (~0ULL << (index + 1));
+        uint64_t tick = ahead ? (wheel->now & ~(uint64_t)(WHEEL_SLOTS - 1)) + __builtin_ctzll(ahead)
+                              : (wheel->now | (WHEEL_SLOTS - 1)) + 1;
+        if (tick > target) {
+            wheel->now = target;
+            break;
+        }
+        wheel->now = tick;
+
+        int level = 1;
+        while (level < WHEEL_LEVELS && ((tick >> LEVEL_SHIFT(level - 1)) & (WHEEL_SLOTS - 1)) == 0) {
+            cascade(wheel, level, (tick >> LEVEL_SHIFT(level)) & (WHEEL_SLOTS - 1));
+            level++;
+        }
+
+        index = tick & (WHEEL_SLOTS - 1);
+        WheelTimer *timer = wheel->slots[0][index];
+        wheel->slots[0][index] = NULL;
+        wheel->occupied[0] &= ~(1ULL << index);
+        while (timer) {
+            WheelTimer *next = timer->next;
+            if (timer->expires > tick) {
+                // not due yet, never hand a timer back early
+                link_timer(wheel, timer);
+            } else {
+                timer->armed = 0;
+                timer->prev = NULL;
+                timer->next = NULL;
+                *tail = timer;
+                tail = &timer->next;
+                wheel->count--;
+            }
+            timer = next;
+        }
+    }
+    return expired;
+}
+
+int wheel_timeout_ms(const TimerWheel *wheel, uint64_t now_ns, int cap_ms) {
+    if (wheel->count == 0) return cap_ms;
+
+    // level 0 slots hold exact ticks, upper slots only say when they cascade
+    uint64_t earliest = UINT64_MAX;
+    int level = 0;
+    for (level = 0; level < WHEEL_LEVELS; level++) {
+        if (wheel->occupied[level] == 0) continue;
+        uint64_t base = wheel->now >> LEVEL_SHIFT(level);
+        int index = base & (WHEEL_SLOTS - 1);
+        uint64_t bits = rotate(wheel->occupied[level], index + 1);
+        uint64_t tick = (base + 1 + __builtin_ctzll(bits)) << LEVEL_SHIFT(level);
+        if (tick < earliest) earliest = tick;
+    }
+
+    uint64_t at_ns = earliest * WHEEL_TICK_NS;
+    if (at_ns <= now_ns) return 0;
+    uint64_t ms = (at_ns - now_ns + 999999) / 1000000;
+    return (ms > (uint64_t)cap_ms) ? cap_ms : (int)ms;
+}
@@ -0,0 +1,46 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+#include <stdlib.h>
+#include <stdint.h>
+
+// Hierarchical hashed timer wheel. Arming and cancelling are O(1), and an
+// occupancy bitmap per level means finding the next deadline or skipping
+// an idle stretch never walks empty slots. 4 levels of 64 slots at 1 ms
+// ticks cover about 4.6 hours, anything later waits in the top level.
+#define WHEEL_TICK_NS 1000000ULL
+#define WHEEL_BITS 6
+#define WHEEL_SLOTS (1 << WHEEL_BITS)
+#define WHEEL_LEVELS 4
+
+// Embedded in whatever it times, the wheel never allocates.
+typedef struct WheelTimer {
+    struct WheelTimer *next;
+    struct WheelTimer *prev;
+    uint64_t expires;           // tick
+    uint32_t id;                // caller's, e.g. the sequence number
+    uint8_t armed;
+    uint8_t level;
+    uint8_t slot;
+} WheelTimer;
+
+typedef struct TimerWheel {
+    uint64_t now;               // every tick up to this one has been expired
+    uint64_t occupied[WHEEL_LEVELS];
+    WheelTimer *slots[WHEEL_LEVELS][WHEEL_SLOTS];
+    int count;
+} TimerWheel;
+
+void wheel_init(TimerWheel *wheel, uint64_t now_ns);
+void wheel_arm(TimerWheel *wheel, WheelTimer *timer, uint64_t deadline_ns);  // re-arms if armed
+void wheel_cancel(TimerWheel *wheel, WheelTimer *timer);
+
+// Unlinks every timer due by now_ns and returns them chained through next,
+// earliest tick first. They are disarmed, so each may be re-armed while
+// walking the chain as long as next was read first.
+WheelTimer *wheel_expire(TimerWheel *wheel, uint64_t now_ns);
+
+// Milliseconds until the earliest deadline, at most cap_ms, for poll().
+// May come out early for timers in the upper levels, never late.
+int wheel_timeout_ms(const TimerWheel *wheel, uint64_t now_ns, int cap_ms);
+
+#endif // TIMERWHEEL_H
@@ -0,0 +1,74 @@
+#include "timing.h"
+#include <math.h>
+#include <time.h>
+
+void rtt_init(RttEstimator *rtt) {
+    rtt->srtt_ns = 0;
+    rtt->rttvar_ns = 0;
+    rtt->rto_ns = RTO_INITIAL_NS;
+    rtt->min_ns = 0;
+    rtt->max_ns = 0;
+    rtt->samples = 0;
+}
+
+void rtt_sample(RttEstimator *rtt, uint64_t sample_ns) {
+    if (rtt->samples == 0) {
+        rtt->srtt_ns = sample_ns;
+        rtt->rttvar_ns = sample_ns / 2;
+        rtt->min_ns = sample_ns;
+    } else {
+        // alpha 1/8, beta 1/4
+        uint64_t error = (sample_ns > rtt->srtt_ns) ? sample_ns - rtt->srtt_ns : rtt->srtt_ns - sample_ns;
+        rtt->rttvar_ns = (3 * rtt->rttvar_ns + error) / 4;
+        rtt->srtt_ns = (7 * rtt->srtt_ns + sample_ns) / 8;
+    }
+    if (sample_ns < rtt->min_ns) rtt->min_ns = sample_ns;
+    if (sample_ns > rtt->max_ns) rtt->max_ns = sample_ns;
+    rtt->samples++;
+
+    rtt->rto_ns = rtt->srtt_ns + 4 * rtt->rttvar_ns;
+    if (rtt->rto_ns < RTO_MIN_NS) rtt->rto_ns = RTO_MIN_NS;
+    if (rtt->rto_ns > RTO_MAX_NS) rtt->rto_ns = RTO_MAX_NS;
+}
+
+void rtt_backoff(RttEstimator *rtt) {
+    // RFC 6298 5.5, the next sample recomputes it from srtt
+    if (rtt->rto_ns >= RTO_BACKOFF_MAX_NS) return;
+    rtt->rto_ns *= 2;
+    if (rtt->rto_ns > RTO_BACKOFF_MAX_NS) rtt->rto_ns = RTO_BACKOFF_MAX_NS;
+}
+
+void arrival_sample(ArrivalStats *stats, uint64_t stamp_ns) {
+    // converted stamps can step back when the wall clock is adjusted, skip that gap
+    if (stats->last_ns != 0 && stamp_ns >= stats->last_ns) {
+        uint64_t gap = stamp_ns - stats->last_ns;
+        stats->count++;
+        double delta = gap - stats->mean_ns;
+        stats->mean_ns += delta / stats->count;
+        stats->m2 += delta * (gap - stats->mean_ns);
+        if (gap > stats->max_ns) stats->max_ns = gap;
+    }
+    stats->last_ns = stamp_ns;
+}
+
+double arrival_stddev_ns(const ArrivalStats *stats) {
+    return (stats->count > 1) ? sqrt(stats->m2 / (stats->count - 1)) : 0.0;
+}
+
+uint64_t clock_ns(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+uint64_t stamp_clock_ns(uint64_t stamp_ns) {
+    // the wall clock is only read to take its offset right now, an
+    // adjustment since the stamp skews this one sample and nothing else
+    struct timespec wall;
+    uint64_t now = clock_ns();
+    clock_gettime(CLOCK_REALTIME, &wall);
+    uint64_t wall_ns = (uint64_t)wall.tv_sec * 1000000000ULL + wall.tv_nsec;
+    if (stamp_ns >= wall_ns) return now;
+    uint64_t age = wall_ns - stamp_ns;
+    return (age < now) ? now - age : 0;
+}
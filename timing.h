@@ -0,0 +1,40 @@
+#ifndef TIMING_H
+#define TIMING_H
+#include <stdlib.h>
+#include <stdint.h>
+
+#define RTO_INITIAL_NS 1000000000ULL    // before the first sample, the old fixed 1 s
+#define RTO_MIN_NS 20000000ULL          // covers rcopy holding an RR back for 10 ms
+#define RTO_MAX_NS 60000000000ULL
+#define RTO_BACKOFF_MAX_NS 1000000000ULL // backing off stops at the old 1 s, a silent client gets ten tries
+
+// Smoothed round trip time and retransmit timeout as in RFC 6298, fed with
+// kernel receive stamps so scheduler delay on our side stays out of it.
+typedef struct RttEstimator {
+    uint64_t srtt_ns;
+    uint64_t rttvar_ns;
+    uint64_t rto_ns;
+    uint64_t min_ns;
+    uint64_t max_ns;
+    uint64_t samples;
+} RttEstimator;
+
+// Gaps between consecutive packet arrivals, running mean and variance.
+typedef struct ArrivalStats {
+    uint64_t last_ns;
+    uint64_t count;
+    double mean_ns;
+    double m2;
+    uint64_t max_ns;
+} ArrivalStats;
+
+void rtt_init(RttEstimator *rtt);
+void rtt_sample(RttEstimator *rtt, uint64_t sample_ns);
+void rtt_backoff(RttEstimator *rtt);    // after a timeout, until the next sample
+void arrival_sample(ArrivalStats *stats, uint64_t stamp_ns);
+double arrival_stddev_ns(const ArrivalStats *stats);
+uint64_t clock_ns(void);    // CLOCK_MONOTONIC, for every deadline and interval
+// A kernel receive stamp, CLOCK_REALTIME, moved onto clock_ns()'s clock.
+uint64_t stamp_clock_ns(uint64_t stamp_ns);
+
+#endif // TIMING_H